@@ -0,0 +1,471 @@
+/*
+    End-to-end macro-benchmark
+
+    Generates a deterministic synthetic corpus, runs readfiles on it for every feature mode and then a fixed
+    set of queries through cbir for every mode, all offline. Both tools are run as child processes from the
+    build directory, exactly as a user would run them, with their output discarded. The throughput of each
+    ingest, the latency percentiles of the queries and the peak resident set sizes are written to a JSON file
+    so that two builds can be compared with a diff.
+
+    Queries are timed for two kinds of images: corpus images, whose stored features are reused (no decoding or
+    extraction), and the same number of held-out images generated alongside the corpus but never ingested,
+    which pay for decoding and extraction like the query of a new photo.
+
+    Synthetic images have a two-color gradient background with random rectangles and circles and a little
+    noise. A fraction of them also get a face: the sample face image given with -face pasted at a random
+    place and size, or a drawn face (skin-toned oval with eyes, brows and a mouth) without one.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <limits.h>
+#include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "faceDetect.h"
+
+// feature modes benchmarked by default (dnn and dnn_hsv need the precomputed ResNet18 embeddings)
+#define BENCH_MODES "baseline,hist,hist2,multihist,sobel,hsv,face,phash"
+
+// default resolution mix (width x height : relative weight)
+#define BENCH_SIZES "640x480:6,1024x768:3,4000x3000:1"
+
+struct BenchSize
+{
+    int width;
+    int height;
+    int weight;
+};
+
+struct RunResult
+{
+    int status = -1;       // exit status of the child (-1 if it could not be run)
+    double seconds = 0.0;  // wall time
+    long peak_rss_kb = 0;  // peak resident set size of the child
+};
+
+struct QueryStats
+{
+    int failed = 0;        // queries that exited with a non-zero status
+    double p50 = 0.0;      // latency percentiles in ms
+    double p95 = 0.0;
+    double p99 = 0.0;
+    long peak_rss_kb = 0;  // largest peak resident set size of the queries
+};
+
+// Splits a comma separated list
+static std::vector<std::string> split_list(const char *list)
+{
+    std::vector<std::string> items;
+    std::string item;
+    for (const char *p = list;; p++)
+    {
+        if (*p == ',' || *p == '\0')
+        {
+            if (!item.empty())
+                items.push_back(item);
+            item.clear();
+            if (*p == '\0')
+                break;
+        }
+        else
+            item += *p;
+    }
+    return items;
+}
+
+// Parses a resolution mix such as "640x480:6,4000x3000:1" (the weight defaults to 1)
+// Returns non-zero if an entry is malformed
+static int parse_sizes(const char *list, std::vector<BenchSize> &sizes)
+{
+    for (std::string &item : split_list(list))
+    {
+        BenchSize size = {0, 0, 1};
+        if (sscanf(item.c_str(), "%dx%d:%d", &size.width, &size.height, &size.weight) < 2 ||
+            size.width <= 0 || size.height <= 0 || size.weight <= 0)
+            return (-1);
+        sizes.push_back(size);
+    }
+    return sizes.empty() ? -1 : 0;
+}
+
+// Draws a simple frontal face into a rectangle of the image
+static void draw_face(cv::Mat &img, cv::Rect r, cv::RNG &rng)
+{
+    cv::Point c(r.x + r.width / 2, r.y + r.height / 2);
+    int w = r.width / 2, h = r.height / 2;
+    cv::Scalar skin(rng.uniform(90, 140), rng.uniform(130, 170), rng.uniform(190, 235));
+    cv::Scalar dark(40, 40, 50);
+
+    cv::ellipse(img, c, cv::Size(w * 8 / 10, h), 0, 0, 360, skin, cv::FILLED, cv::LINE_AA);
+    for (int side = -1; side <= 1; side += 2)
+    {
+        cv::Point eye(c.x + side * w * 3 / 10, c.y - h / 5);
+        cv::ellipse(img, eye, cv::Size(w / 7, h / 12), 0, 0, 360, cv::Scalar(245, 245, 245), cv::FILLED, cv::LINE_AA);
+        cv::circle(img, eye, std::max(1, h / 14), dark, cv::FILLED, cv::LINE_AA);
+        cv::ellipse(img, cv::Point(eye.x, eye.y - h / 6), cv::Size(w / 6, h / 20), 0, 180, 360, dark, std::max(1, h / 30), cv::LINE_AA);
+    }
+    cv::ellipse(img, cv::Point(c.x, c.y + h / 10), cv::Size(w / 14, h / 6), 0, 0, 360, skin * 0.85, cv::FILLED, cv::LINE_AA);
+    cv::ellipse(img, cv::Point(c.x, c.y + h * 4 / 10), cv::Size(w / 3, h / 10), 0, 0, 180, cv::Scalar(60, 60, 150), std::max(1, h / 20), cv::LINE_AA);
+}
+
+// Generates one synthetic image (the same index and seed always give the same image)
+static void synth_image(int index, unsigned seed, const std::vector<BenchSize> &sizes, double face_fraction,
+                        cv::Mat &face_sample, cv::Mat &img)
+{
+    cv::RNG rng((uint64_t)seed * 1000003 + index);
+
+    int total = 0;
+    for (const BenchSize &s : sizes)
+        total += s.weight;
+    int pick = rng.uniform(0, total);
+    const BenchSize *size = &sizes[0];
+    for (const BenchSize &s : sizes)
+    {
+        if (pick < s.weight)
+        {
+            size = &s;
+            break;
+        }
+        pick -= s.weight;
+    }
+    img.create(size->height, size->width, CV_8UC3);
+
+    // vertical gradient between two random colors
+    cv::Scalar top(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+    cv::Scalar bottom(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+    for (int i = 0; i < img.rows; i++)
+    {
+        double t = (double)i / std::max(1, img.rows - 1);
+        cv::Vec3b color;
+        for (int k = 0; k < 3; k++)
+            color[k] = (uchar)(top[k] * (1.0 - t) + bottom[k] * t);
+        cv::Vec3b *ptr = img.ptr<cv::Vec3b>(i);
+        for (int j = 0; j < img.cols; j++)
+            ptr[j] = color;
+    }
+
+    // random shapes
+    int nshapes = rng.uniform(5, 25);
+    int scale = std::min(img.cols, img.rows);
+    for (int s = 0; s < nshapes; s++)
+    {
+        cv::Scalar color(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+        cv::Point p(rng.uniform(0, img.cols), rng.uniform(0, img.rows));
+        int extent = rng.uniform(scale / 20 + 1, scale / 3 + 2);
+        if (rng.uniform(0, 2) == 0)
+            cv::rectangle(img, p, cv::Point(p.x + extent, p.y + extent * rng.uniform(1, 4) / 2), color, cv::FILLED);
+        else
+            cv::circle(img, p, extent / 2, color, cv::FILLED, cv::LINE_AA);
+    }
+
+    // some of the images get a face
+    if (rng.uniform(0.0, 1.0) < face_fraction)
+    {
+        int side = rng.uniform(scale / 5, scale / 2 + 1);
+        cv::Rect r(rng.uniform(0, img.cols - side + 1), rng.uniform(0, img.rows - side + 1), side, side);
+        if (!face_sample.empty())
+        {
+            cv::Mat face;
+            cv::Mat dst = img(r);
+            cv::resize(face_sample, face, r.size(), 0, 0, cv::INTER_AREA);
+            face.copyTo(dst);
+        }
+        else
+            draw_face(img, r, rng);
+    }
+
+    // sensor-like noise so that the jpeg files have realistic sizes
+    cv::Mat noise(img.rows, img.cols, CV_8UC3);
+    cv::randu(noise, cv::Scalar(0, 0, 0), cv::Scalar(8, 8, 8));
+    img += noise;
+}
+
+// Runs a program in a directory with its output discarded and measures its wall time and peak memory
+static RunResult run_command(const std::vector<std::string> &args, const std::string &cwd)
+{
+    RunResult result;
+    std::vector<char *> argv;
+    for (const std::string &a : args)
+        argv.push_back((char *)a.c_str());
+    argv.push_back(nullptr);
+
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0)
+        return result;
+    if (pid == 0)
+    {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0)
+        {
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        if (chdir(cwd.c_str()) != 0)
+            _exit(127);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0)
+        return result;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.peak_rss_kb = usage.ru_maxrss;
+    result.status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    return result;
+}
+
+// Nearest-rank percentile of sorted values
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0.0;
+    size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+    return sorted[std::clamp(rank, (size_t)1, sorted.size()) - 1];
+}
+
+// Runs every query image through cbir with one feature mode and collects the latency percentiles
+static QueryStats run_queries(const std::string &cbir_bin, const std::vector<std::string> &queries, const std::string &mode,
+                              const std::string &topn_arg, const std::string &work_dir)
+{
+    QueryStats stats;
+    std::vector<double> latencies;
+    for (const std::string &query : queries)
+    {
+        RunResult run = run_command({cbir_bin, query, mode, topn_arg, "-nocache", "-nodisplay"}, work_dir);
+        if (run.status != 0)
+            stats.failed++;
+        latencies.push_back(run.seconds * 1000.0);
+        stats.peak_rss_kb = std::max(stats.peak_rss_kb, run.peak_rss_kb);
+    }
+    std::sort(latencies.begin(), latencies.end());
+    stats.p50 = percentile(latencies, 50);
+    stats.p95 = percentile(latencies, 95);
+    stats.p99 = percentile(latencies, 99);
+    return stats;
+}
+
+/*
+    Runs the macro-benchmark
+
+    Argv:
+        - work_dir: directory for the corpus and the feature databases (created if missing)
+        - [-images n]: optional, number of synthetic images (default 200)
+        - [-sizes list]: optional, resolution mix as WxH:weight pairs (default 640x480:6,1024x768:3,4000x3000:1)
+        - [-faces f]: optional, fraction of the images with a face (default 0.2)
+        - [-face image]: optional, sample face pasted into the images (default: a drawn face)
+        - [-seed s]: optional, seed of the corpus (default 1)
+        - [-modes list]: optional, comma separated feature modes (default baseline,hist,hist2,multihist,sobel,hsv,face,phash)
+        - [-queries q]: optional, number of corpus images queried per mode, and of held-out images (default 50)
+        - [-topn N]: optional, number of matches per query (default 10)
+        - [-bin dir]: optional, directory holding read and cbir (default: the directory of this program)
+        - [-o file]: optional, JSON results file (default bench_results.json)
+*/
+int main(int argc, char *argv[])
+{
+    int nimages = 200;
+    double face_fraction = 0.2;
+    unsigned seed = 1;
+    int nqueries = 50;
+    int topn = 10;
+    const char *sizes_arg = BENCH_SIZES;
+    const char *modes_arg = BENCH_MODES;
+    const char *face_file = NULL;
+    const char *out_file = "bench_results.json";
+    std::string bin_dir;
+
+    // check for sufficient arguments
+    if (argc < 2)
+    {
+        printf("usage: %s <work dir>, [-images <n>], [-sizes <WxH:weight,...>], [-faces <fraction>], [-face <image>], [-seed <s>], [-modes <list>], [-queries <q>], [-topn <N>], [-bin <dir>], [-o <json file>]\n", argv[0]);
+        exit(-1);
+    }
+
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-images") == 0 && i + 1 < argc)
+            nimages = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-sizes") == 0 && i + 1 < argc)
+            sizes_arg = argv[++i];
+        else if (strcmp(argv[i], "-faces") == 0 && i + 1 < argc)
+            face_fraction = atof(argv[++i]);
+        else if (strcmp(argv[i], "-face") == 0 && i + 1 < argc)
+            face_file = argv[++i];
+        else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+            seed = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-modes") == 0 && i + 1 < argc)
+            modes_arg = argv[++i];
+        else if (strcmp(argv[i], "-queries") == 0 && i + 1 < argc)
+            nqueries = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-topn") == 0 && i + 1 < argc)
+            topn = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-bin") == 0 && i + 1 < argc)
+            bin_dir = argv[++i];
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            out_file = argv[++i];
+        else
+        {
+            printf("Unknown option %s\n", argv[i]);
+            exit(-1);
+        }
+    }
+
+    std::vector<BenchSize> sizes;
+    if (parse_sizes(sizes_arg, sizes) != 0)
+    {
+        printf("Invalid resolution mix %s\n", sizes_arg);
+        exit(-1);
+    }
+    std::vector<std::string> modes = split_list(modes_arg);
+    if (nimages < 1 || modes.empty())
+    {
+        printf("Nothing to benchmark\n");
+        exit(-1);
+    }
+    nqueries = std::clamp(nqueries, 1, nimages);
+    topn = std::clamp(topn, 1, std::max(1, nimages - 1));
+
+    // the tools are looked up next to this program unless told otherwise
+    char path[PATH_MAX];
+    if (bin_dir.empty())
+    {
+        ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+        path[len > 0 ? len : 0] = '\0';
+        char *slash = strrchr(path, '/');
+        bin_dir = slash ? std::string(path, slash - path) : ".";
+    }
+    std::string read_bin = bin_dir + "/read";
+    std::string cbir_bin = bin_dir + "/cbir";
+    if (access(read_bin.c_str(), X_OK) != 0 || access(cbir_bin.c_str(), X_OK) != 0)
+    {
+        printf("Cannot find read and cbir in %s\n", bin_dir.c_str());
+        exit(-1);
+    }
+
+    // absolute paths, since the tools run inside the work directory
+    mkdir(argv[1], 0755);
+    if (realpath(argv[1], path) == NULL)
+    {
+        printf("Cannot create directory %s\n", argv[1]);
+        exit(-1);
+    }
+    std::string work_dir = path;
+    std::string corpus_dir = work_dir + "/corpus";
+    std::string heldout_dir = work_dir + "/queries";
+    mkdir(corpus_dir.c_str(), 0755);
+    mkdir(heldout_dir.c_str(), 0755);
+
+    // the face detector loads its cascade from the working directory
+    if (std::find(modes.begin(), modes.end(), "face") != modes.end())
+    {
+        std::string link = work_dir + "/" + std::string(FACE_CASCADE_FILE).substr(2);
+        if (realpath(FACE_CASCADE_FILE, path) != NULL)
+        {
+            unlink(link.c_str());
+            if (symlink(path, link.c_str()) != 0)
+                printf("Cannot link %s into %s\n", FACE_CASCADE_FILE, work_dir.c_str());
+        }
+        else if (access(link.c_str(), R_OK) != 0)
+        {
+            printf("%s not found, skipping the face mode\n", FACE_CASCADE_FILE);
+            modes.erase(std::find(modes.begin(), modes.end(), "face"));
+        }
+    }
+
+    cv::Mat face_sample;
+    if (face_file != NULL)
+    {
+        face_sample = cv::imread(face_file);
+        if (face_sample.empty())
+        {
+            printf("Cannot read the face sample %s\n", face_file);
+            exit(-1);
+        }
+    }
+
+    // generate the corpus, then the held-out queries (outside the corpus directory, so they are never ingested)
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> images, heldout;
+    long long pixels = 0;
+    cv::Mat img;
+    for (int i = 0; i < nimages + nqueries; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "synth.%05d.jpg", i);
+        std::vector<std::string> &files = i < nimages ? images : heldout;
+        files.push_back((i < nimages ? corpus_dir : heldout_dir) + "/" + name);
+        synth_image(i, seed, sizes, face_fraction, face_sample, img);
+        if (i < nimages)
+            pixels += (long long)img.rows * img.cols;
+        if (!cv::imwrite(files.back(), img))
+        {
+            printf("Cannot write %s\n", files.back().c_str());
+            exit(-1);
+        }
+    }
+    printf("Generated %d images (%.1f MP) and %d held-out queries in %.2f s\n", nimages, pixels / 1e6, nqueries,
+           std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+    FILE *fp = fopen(out_file, "w");
+    if (fp == NULL)
+    {
+        printf("Cannot write %s\n", out_file);
+        exit(-1);
+    }
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"corpus\": {\"images\": %d, \"megapixels\": %.1f, \"sizes\": \"%s\", \"faces\": %.3f, \"face_sample\": %s, \"seed\": %u},\n",
+            nimages, pixels / 1e6, sizes_arg, face_fraction, face_file ? "true" : "false", seed);
+    fprintf(fp, "  \"hardware_threads\": %u,\n", std::thread::hardware_concurrency());
+
+    // ingest every mode
+    fprintf(fp, "  \"ingest\": [\n");
+    for (size_t m = 0; m < modes.size(); m++)
+    {
+        RunResult run = run_command({read_bin, corpus_dir, modes[m]}, work_dir);
+        if (run.status != 0)
+            printf("read %s failed with status %d\n", modes[m].c_str(), run.status);
+        double rate = run.seconds > 0.0 ? nimages / run.seconds : 0.0;
+        printf("ingest %-10s %8.1f images/s  %7.2f s  peak RSS %ld MB\n", modes[m].c_str(), rate, run.seconds, run.peak_rss_kb / 1024);
+        fprintf(fp, "    {\"mode\": \"%s\", \"status\": %d, \"seconds\": %.4f, \"images_per_s\": %.2f, \"peak_rss_kb\": %ld}%s\n",
+                modes[m].c_str(), run.status, run.seconds, rate, run.peak_rss_kb, m + 1 < modes.size() ? "," : "");
+    }
+    fprintf(fp, "  ],\n");
+
+    // query every mode with the same evenly spaced corpus images and the same held-out images
+    std::vector<std::string> indexed;
+    for (int q = 0; q < nqueries; q++)
+        indexed.push_back(images[(size_t)q * nimages / nqueries]);
+    const std::pair<const char *, std::vector<std::string> *> kinds[] = {{"indexed", &indexed}, {"held_out", &heldout}};
+    std::string topn_arg = std::to_string(topn);
+    fprintf(fp, "  \"query\": [\n");
+    for (size_t m = 0; m < modes.size(); m++)
+    {
+        for (size_t k = 0; k < 2; k++)
+        {
+            QueryStats stats = run_queries(cbir_bin, *kinds[k].second, modes[m], topn_arg, work_dir);
+            printf("query  %-10s %-8s p50 %8.2f ms  p95 %8.2f ms  p99 %8.2f ms  peak RSS %ld MB%s\n", modes[m].c_str(),
+                   kinds[k].first, stats.p50, stats.p95, stats.p99, stats.peak_rss_kb / 1024,
+                   stats.failed ? "  (some queries failed)" : "");
+            fprintf(fp, "    {\"mode\": \"%s\", \"kind\": \"%s\", \"queries\": %d, \"failed\": %d, \"p50_ms\": %.3f, \"p95_ms\": %.3f, \"p99_ms\": %.3f, \"peak_rss_kb\": %ld}%s\n",
+                    modes[m].c_str(), kinds[k].first, nqueries, stats.failed, stats.p50, stats.p95, stats.p99,
+                    stats.peak_rss_kb, m + 1 < modes.size() || k == 0 ? "," : "");
+        }
+    }
+    fprintf(fp, "  ]\n}\n");
+    fclose(fp);
+    printf("Wrote %s\n", out_file);
+
+    return (0);
+}
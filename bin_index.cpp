@@ -0,0 +1,172 @@
+/*
+    Inverted index from histogram bins to database rows
+
+    File layout of <csv>.bins (after the sidecar header):
+        float threshold, int32 bins, int64 rows of the database, int64 postings
+        uint32 offsets[bins + 1] - start of each bin in ids
+        uint32 ids[postings]     - rows listed under each bin
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include "bin_index.hpp"
+
+// sidecar format identifier
+static const char BINS_MAGIC[] = "CBIRBIN1";
+
+// Returns true if a feature mode stores plain histograms that can be indexed by bin (hist, hist2, hsv)
+bool bin_index_mode(const char *feature_mode)
+{
+    return strcmp(feature_mode, "hist") == 0 || strcmp(feature_mode, "hist2") == 0 || strcmp(feature_mode, "hsv") == 0;
+}
+
+// Calls fn(bin) for every bin of a row that goes into the index
+template <typename F>
+static void for_each_heavy_bin(const std::vector<float> &row, float threshold, F fn)
+{
+    if (row.empty())
+        return;
+    float mass = std::accumulate(row.begin(), row.end(), 0.0f);
+    int heaviest = std::max_element(row.begin(), row.end()) - row.begin();
+    for (int b = 0; b < (int)row.size(); b++)
+    {
+        if (b == heaviest || row[b] > threshold * mass)
+            fn(b);
+    }
+}
+
+// Lists every row of a database under the bins holding more than threshold of its mass
+void build_bin_index(FeatureDB &db, float threshold, BinIndex &index)
+{
+    index.threshold = threshold;
+    index.db_rows = db.size();
+    index.bins = db.size() > 0 ? db.data[0].size() : 0;
+    index.offsets.assign(index.bins + 1, 0);
+
+    // counting sort of the (bin, row) pairs by bin, rows stay in increasing order within a bin
+    for (size_t i = 0; i < db.size(); i++)
+        for_each_heavy_bin(db.data[i], threshold, [&](int b)
+                           { index.offsets[b + 1]++; });
+    for (int b = 0; b < index.bins; b++)
+        index.offsets[b + 1] += index.offsets[b];
+
+    index.rows.resize(index.offsets[index.bins]);
+    std::vector<uint32_t> pos(index.offsets.begin(), index.offsets.end() - 1);
+    for (size_t i = 0; i < db.size(); i++)
+        for_each_heavy_bin(db.data[i], threshold, [&](int b)
+                           { index.rows[pos[b]++] = i; });
+}
+
+// Writes the index of a database to <csv>.bins
+// Returns non-zero if the file could not be written
+int write_bin_index(char *csv, BinIndex &index)
+{
+    char sidecar[512];
+    DBStamp stamp;
+    snprintf(sidecar, sizeof(sidecar), "%s.bins", csv);
+    if (db_stamp(csv, stamp) != 0)
+        return (-1);
+
+    FILE *fp = fopen(sidecar, "wb");
+    if (!fp)
+    {
+        printf("Unable to write %s\n", sidecar);
+        return (-1);
+    }
+    long long postings = index.rows.size();
+    write_sidecar_header(fp, BINS_MAGIC, stamp);
+    fwrite(&index.threshold, sizeof(index.threshold), 1, fp);
+    fwrite(&index.bins, sizeof(index.bins), 1, fp);
+    fwrite(&index.db_rows, sizeof(index.db_rows), 1, fp);
+    fwrite(&postings, sizeof(postings), 1, fp);
+    fwrite(index.offsets.data(), sizeof(uint32_t), index.offsets.size(), fp);
+    fwrite(index.rows.data(), sizeof(uint32_t), index.rows.size(), fp);
+    fclose(fp);
+    return (0);
+}
+
+// Returns true if the offsets of an index read from a file are ascending and every row it lists is in the database
+static bool valid_postings(const BinIndex &index)
+{
+    if (!std::is_sorted(index.offsets.begin(), index.offsets.end()))
+        return false;
+    for (uint32_t row : index.rows)
+    {
+        if (row >= index.db_rows)
+            return false;
+    }
+    return true;
+}
+
+// Loads the index of a database from <csv>.bins, or builds it from the loaded rows with the default
+// threshold and writes the sidecar if it is missing or was built from another version of the csv
+void load_bin_index(char *csv, FeatureDB &db, BinIndex &index)
+{
+    char sidecar[512];
+    DBStamp stamp;
+    snprintf(sidecar, sizeof(sidecar), "%s.bins", csv);
+    db_stamp(csv, stamp);
+
+    // try the index written at ingest first
+    FILE *fp = fopen(sidecar, "rb");
+    if (fp)
+    {
+        long long postings;
+        if (read_sidecar_header(fp, BINS_MAGIC, stamp) == 0 &&
+            fread(&index.threshold, sizeof(index.threshold), 1, fp) == 1 &&
+            fread(&index.bins, sizeof(index.bins), 1, fp) == 1 &&
+            index.bins == (db.size() > 0 ? (int)db.data[0].size() : 0) &&
+            fread(&index.db_rows, sizeof(index.db_rows), 1, fp) == 1 && index.db_rows == (long long)db.size() &&
+            fread(&postings, sizeof(postings), 1, fp) == 1 && postings >= 0 &&
+            (long long)((index.bins + 1) + postings) * (long long)sizeof(uint32_t) <= sidecar_remaining(fp))
+        {
+            index.offsets.resize(index.bins + 1);
+            index.rows.resize(postings);
+            if (fread(index.offsets.data(), sizeof(uint32_t), index.offsets.size(), fp) == index.offsets.size() &&
+                fread(index.rows.data(), sizeof(uint32_t), index.rows.size(), fp) == index.rows.size() &&
+                index.offsets.back() == postings && valid_postings(index))
+            {
+                fclose(fp);
+                return;
+            }
+        }
+        fclose(fp);
+    }
+
+    printf("Building bin index %s\n", sidecar);
+    build_bin_index(db, BIN_INDEX_THRESHOLD, index);
+    write_bin_index(csv, index);
+}
+
+/*
+    Scores only the rows sharing a heavy bin with the query and returns the K best of them
+    The candidates are the rows listed under the query's M heaviest bins
+*/
+void bin_index_topk(MetricType metric, std::vector<float> &featVec, FeatureDB &db, BinIndex &index, int M, int K,
+                    std::vector<std::pair<float, int>> &results, ScanStats &stats)
+{
+    // the query's heaviest bins (empty bins list no rows worth finding)
+    std::vector<int> probes(std::min((int)featVec.size(), index.bins));
+    std::iota(probes.begin(), probes.end(), 0);
+    M = std::min(M, (int)probes.size());
+    std::partial_sort(probes.begin(), probes.begin() + M, probes.end(), [&](int a, int b)
+                      { return featVec[a] != featVec[b] ? featVec[a] > featVec[b] : a < b; });
+
+    std::vector<uint32_t> cand;
+    for (int p = 0; p < M && featVec[probes[p]] > 0.0f; p++)
+        cand.insert(cand.end(), index.rows.begin() + index.offsets[probes[p]], index.rows.begin() + index.offsets[probes[p] + 1]);
+
+    // a row can be listed under several of the probed bins
+    std::sort(cand.begin(), cand.end());
+    cand.erase(std::unique(cand.begin(), cand.end()), cand.end());
+
+    TopK top(std::min(K, (int)cand.size()), true);
+    for (uint32_t row : cand)
+    {
+        stats.rows++;
+        top.push(apply_metric(metric, featVec, db.data[row]), row);
+    }
+    top.sorted(results);
+}
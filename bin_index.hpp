@@ -0,0 +1,76 @@
+/*
+    Inverted index from histogram bins to database rows for the histogram modes (hist, hist2, hsv)
+
+    Two normalized histograms can only have a large intersection if they share some of their heavy bins.
+    For every bin the index lists the rows in which that bin holds more than a threshold fraction of the row's
+    mass (each row is also listed under its heaviest bin, so no row becomes unreachable). A query gathers the
+    rows listed under its own M heaviest bins and scores only those candidates with the mode's metric.
+    Matches that share none of the query's top bins are missed, so the number of candidates and the recall
+    against the full scan are reported to tune the threshold and M per corpus.
+
+    readfiles builds the index at ingest and stores it next to the database in <csv>.bins
+*/
+
+#ifndef BIN_INDEX_H
+#define BIN_INDEX_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "distance.hpp"
+#include "feature_db.hpp"
+#include "scan.hpp"
+
+// default fraction of a row's mass a bin must hold for the row to be listed under it
+#define BIN_INDEX_THRESHOLD 0.05f
+
+// rows of every bin, stored bin after bin
+struct BinIndex
+{
+    float threshold = BIN_INDEX_THRESHOLD;
+    int bins = 0;
+    long long db_rows = 0;         // rows of the database the index was built from
+    std::vector<uint32_t> offsets; // start of each bin in rows (bins + 1 values)
+    std::vector<uint32_t> rows;    // rows listed under each bin, in increasing order
+
+    size_t postings(int bin) const { return offsets[bin + 1] - offsets[bin]; }
+};
+
+// Returns true if a feature mode stores plain histograms that can be indexed by bin (hist, hist2, hsv)
+bool bin_index_mode(const char *feature_mode);
+
+// Lists every row of a database under the bins holding more than threshold of its mass
+// Args: db        - loaded database
+//       threshold - fraction of the row's mass a bin must hold
+//       index     - index to be filled
+void build_bin_index(FeatureDB &db, float threshold, BinIndex &index);
+
+// Writes the index of a database to <csv>.bins
+// Returns non-zero if the file could not be written
+int write_bin_index(char *csv, BinIndex &index);
+
+// Loads the index of a database from <csv>.bins, or builds it from the loaded rows with the default
+// threshold and writes the sidecar if it is missing or was built from another version of the csv
+// Args: csv   - csv database filename
+//       db    - loaded database
+//       index - index to be filled
+void load_bin_index(char *csv, FeatureDB &db, BinIndex &index);
+
+/*
+    Scores only the rows sharing a heavy bin with the query and returns the K best of them
+    The candidates are the rows listed under the query's M heaviest bins
+
+    Args:
+        - metric: distance metric of the mode
+        - featVec: query feature vector
+        - db: feature database
+        - index: bin index of the database
+        - M: number of query bins probed
+        - K: number of matches to return
+        - results: vector of (distance, row) pairs to be filled, best first (fewer than K if there are fewer candidates)
+        - stats: scan counters to be filled (rows counts the candidates scored)
+*/
+void bin_index_topk(MetricType metric, std::vector<float> &featVec, FeatureDB &db, BinIndex &index, int M, int K,
+                    std::vector<std::pair<float, int>> &results, ScanStats &stats);
+
+#endif
@@ -0,0 +1,117 @@
+/*
+    Offline job that builds the vantage-point tree of a feature database
+
+    The tree is written next to the database in <csv>.vpt and searched by cbir -vptree. A set of database rows
+    is then run as queries through the tree and through the exhaustive scan to check that both give the same
+    matches and to report how many distance evaluations the tree saves
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "feature_db.hpp"
+#include "scan.hpp"
+#include "vp_tree.hpp"
+
+/*
+    Builds the vantage-point tree of the database of a feature mode
+
+    Argv:
+        - feature_mode: feature mode whose database is used (baseline, hist, hist2, multihist, sobel, hsv, or any
+                        mode reduced with PCA)
+        - [-queries q]: optional, number of database rows used as check queries, evenly spaced (default 100, 0 skips the check)
+        - [-K k]: optional, number of matches per check query (default 10)
+*/
+int main(int argc, char *argv[])
+{
+    char csv[256];
+    MetricType metric;
+    FeatureDB db;
+    VPTree tree;
+    int nqueries = 100;
+    int K = 10;
+
+    // check for sufficient arguments
+    if (argc < 2)
+    {
+        printf("usage: %s <feature mode>, [-queries <q>], [-K <k>]\n", argv[0]);
+        exit(-1);
+    }
+
+    if (feature_mode_db(argv[1], csv, metric) != 0)
+    {
+        printf("Invalid feature mode %s\n", argv[1]);
+        exit(-1);
+    }
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-queries") == 0)
+            nqueries = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-K") == 0)
+            K = atoi(argv[i + 1]);
+        else
+        {
+            printf("Unknown option %s\n", argv[i]);
+            exit(-1);
+        }
+    }
+    if (!vp_tree_metric(metric))
+    {
+        printf("The distance of the %s mode is not a metric, a vantage-point tree cannot search it exactly\n", argv[1]);
+        exit(-1);
+    }
+
+    if (load_feature_db(csv, db) != 0 || db.size() < 2)
+        exit(-1);
+    K = std::clamp(K, 1, (int)db.size());
+    nqueries = std::clamp(nqueries, 0, (int)db.size());
+
+    auto start = std::chrono::steady_clock::now();
+    build_vp_tree(metric, db, tree);
+    printf("Built vantage-point tree of %zu rows: %zu nodes (%.2f s)\n", db.size(), tree.nodes.size(),
+           std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    if (write_vp_tree(csv, tree) != 0)
+        exit(-1);
+    printf("Wrote %s.vpt\n", csv);
+    if (nqueries == 0)
+        return (0);
+
+    // check the tree against the exhaustive scan
+    int mismatches = 0;
+    long evaluations = 0;
+    double tree_ms = 0.0, scan_ms = 0.0;
+    std::vector<std::pair<float, int>> exact, found;
+    for (int q = 0; q < nqueries; q++)
+    {
+        std::vector<float> &featVec = db.data[(size_t)q * db.size() / nqueries];
+        ScanStats scan_stats, tree_stats;
+
+        start = std::chrono::steady_clock::now();
+        scan_topk(metric, featVec, db, K, true, false, exact, scan_stats);
+        scan_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        vp_tree_topk(featVec, db, tree, K, found, tree_stats);
+        tree_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        evaluations += tree_stats.rows;
+        if (found != exact)
+            mismatches++;
+    }
+
+    double per_query = (double)evaluations / nqueries;
+    printf("%d check queries (K = %d): %.1f distance evaluations per query of %zu rows (%.1f%% pruned)\n", nqueries, K,
+           per_query, db.size(), 100.0 * (1.0 - per_query / db.size()));
+    printf("Tree %.3f ms, scan %.3f ms per query (speedup %.1fx)\n", tree_ms / nqueries, scan_ms / nqueries,
+           scan_ms / std::max(tree_ms, 1e-6));
+    if (mismatches > 0)
+    {
+        printf("%d queries did not match the exhaustive scan\n", mismatches);
+        exit(-1);
+    }
+    printf("Every query matched the exhaustive scan\n");
+
+    return (0);
+}
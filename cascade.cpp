@@ -0,0 +1,285 @@
+/*
+    Cascade retrieval: a cheap coarse-signature scan followed by an exact re-rank of the best candidates
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "cascade.hpp"
+#include "csv_util.h"
+
+// sidecar format identifier
+static const char COARSE_MAGIC[] = "CBIRCRS1";
+
+// Returns the coarse signature layout used for a feature mode (COARSE_NONE if the mode has none)
+CoarseLayout coarse_layout_for_mode(const char *feature_mode)
+{
+    if (strcmp(feature_mode, "hist2") == 0 || strcmp(feature_mode, "multihist") == 0 || strcmp(feature_mode, "sobel") == 0)
+        return COARSE_RGB;
+    if (strcmp(feature_mode, "hist") == 0)
+        return COARSE_RG;
+    if (strcmp(feature_mode, "hsv") == 0)
+        return COARSE_HSV;
+    if (strcmp(feature_mode, "face") == 0)
+        return COARSE_FACE;
+    if (strcmp(feature_mode, "dnn") == 0)
+        return COARSE_DNN;
+    if (strcmp(feature_mode, "dnn_hsv") == 0)
+        return COARSE_DNN_HSV;
+    return COARSE_NONE;
+}
+
+// Returns the coarse signature layout of a feature database (COARSE_NONE if it has none)
+CoarseLayout coarse_layout_for_db(const char *feature_mode, char *csv)
+{
+    // the coarse layouts assume the default rg16, rgb8 and hs16 histograms
+    char config[64];
+    if (read_image_data_header(csv, "histogram", config, sizeof(config)) == 0 &&
+        strcmp(config, "rg16") != 0 && strcmp(config, "rgb8") != 0 && strcmp(config, "hs16") != 0)
+        return COARSE_NONE;
+    return coarse_layout_for_mode(feature_mode);
+}
+
+// Sums 8x8x8 RGB histograms down to 4x4x4 (one after another)
+static void coarsen_rgb(const float *in, int n, std::vector<float> &out)
+{
+    for (int h = 0; h + 512 <= n; h += 512)
+    {
+        float coarse[64] = {0};
+        for (int r = 0; r < 8; r++)
+            for (int g = 0; g < 8; g++)
+                for (int b = 0; b < 8; b++)
+                    coarse[(r / 2) * 16 + (g / 2) * 4 + b / 2] += in[h + r * 64 + g * 8 + b];
+        out.insert(out.end(), coarse, coarse + 64);
+    }
+}
+
+// Sums (16x16 + black + gray) HS histograms down to (8x8 + black + gray) (one after another)
+static void coarsen_hsv(const float *in, int n, std::vector<float> &out)
+{
+    for (int h = 0; h + 258 <= n; h += 258)
+    {
+        float coarse[64] = {0};
+        for (int i = 0; i < 16; i++)
+            for (int j = 0; j < 16; j++)
+                coarse[(i / 2) * 8 + j / 2] += in[h + i * 16 + j];
+        out.insert(out.end(), coarse, coarse + 64);
+        out.push_back(in[h + 256]); // black bin
+        out.push_back(in[h + 257]); // gray bin
+    }
+}
+
+// Sums consecutive groups of 8 embedding values
+static void coarsen_dnn(const float *in, int n, std::vector<float> &out)
+{
+    for (int i = 0; i + 8 <= n; i += 8)
+    {
+        float sum = 0.0f;
+        for (int k = 0; k < 8; k++)
+            sum += in[i + k];
+        out.push_back(sum);
+    }
+}
+
+// Builds the coarse signature of a full feature vector
+void coarsen(CoarseLayout layout, const std::vector<float> &full, std::vector<float> &coarse)
+{
+    const float *in = full.data();
+    int n = full.size();
+    coarse.clear();
+
+    switch (layout)
+    {
+    case COARSE_RGB:
+        coarsen_rgb(in, n, coarse);
+        break;
+    case COARSE_RG:
+        coarse.assign(64, 0.0f);
+        for (int i = 0; i < 16; i++)
+            for (int j = 0; j < 16; j++)
+                coarse[(i / 2) * 8 + j / 2] += in[i * 16 + j];
+        break;
+    case COARSE_HSV:
+        coarsen_hsv(in, n, coarse);
+        break;
+    case COARSE_FACE:
+        // the face flag is the last value
+        coarsen_hsv(in, n - 1, coarse);
+        coarse.push_back(full.back());
+        break;
+    case COARSE_DNN:
+        coarsen_dnn(in, n, coarse);
+        break;
+    case COARSE_DNN_HSV:
+        coarsen_dnn(in, DNN_FEAT_LENGTH, coarse);
+        coarsen_hsv(in + DNN_FEAT_LENGTH, n - DNN_FEAT_LENGTH, coarse);
+        break;
+    case COARSE_NONE:
+        coarse = full;
+        break;
+    }
+}
+
+// Sum of min(a[i], b[i]) over n values
+static float min_sum(const float *a, const float *b, int n)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < n; i++)
+        sum += std::min(a[i], b[i]);
+    return sum;
+}
+
+// Cosine distance over n values
+static float cosine_dist(const float *a, const float *b, int n)
+{
+    float dot = 0.0f, a_mag = 0.0f, b_mag = 0.0f;
+    for (int i = 0; i < n; i++)
+    {
+        dot += a[i] * b[i];
+        a_mag += a[i] * a[i];
+        b_mag += b[i] * b[i];
+    }
+    return 1.0f - dot / (std::sqrt(a_mag) * std::sqrt(b_mag));
+}
+
+// Calculates the distance between 2 coarse signatures with the coarse version of the mode's metric
+// Summing bins keeps each histogram normalized, so the intersection divisors are the same as for the full vectors
+float coarse_dist(CoarseLayout layout, const float *q, const float *r, int dims)
+{
+    switch (layout)
+    {
+    case COARSE_RGB:
+        return 1.0f - min_sum(q, r, dims) / (dims / 64.0f);
+    case COARSE_RG:
+        return 1.0f - min_sum(q, r, dims);
+    case COARSE_HSV:
+        return 1.0f - min_sum(q, r, dims) / 2.0f;
+    case COARSE_FACE:
+    {
+        float dist = 1.0f - min_sum(q, r, dims - 1) / 2.0f;
+        if (std::fabs(q[dims - 1] - r[dims - 1]) > 0.1)
+            dist += 0.5f; // penalty for face flag mismatch
+        return dist;
+    }
+    case COARSE_DNN:
+        return cosine_dist(q, r, dims);
+    case COARSE_DNN_HSV:
+    {
+        const int dnn_dims = DNN_FEAT_LENGTH / 8;
+        return cosine_dist(q, r, dnn_dims) + 1.0f - min_sum(q + dnn_dims, r + dnn_dims, dims - dnn_dims) / 2.0f;
+    }
+    case COARSE_NONE:
+        break;
+    }
+
+    // plain squared distance
+    float dist = 0.0f;
+    for (int i = 0; i < dims; i++)
+        dist += (q[i] - r[i]) * (q[i] - r[i]);
+    return dist;
+}
+
+// Loads the coarse signatures of a database from <csv>.coarse, or builds them from the loaded rows
+// and writes the sidecar if it is missing or was built from another version of the csv
+void load_coarse_db(char *csv, FeatureDB &db, CoarseLayout layout, CoarseDB &coarse)
+{
+    char sidecar[512];
+    DBStamp stamp;
+    snprintf(sidecar, sizeof(sidecar), "%s.coarse", csv);
+    db_stamp(csv, stamp);
+
+    coarse.layout = layout;
+    coarse.dims = 0;
+    coarse.sigs.clear();
+
+    // every row has the signature length of the first one
+    std::vector<float> sig;
+    if (!db.data.empty())
+        coarsen(layout, db.data[0], sig);
+
+    // try the cached signatures first
+    FILE *fp = fopen(sidecar, "rb");
+    if (fp)
+    {
+        int stored_layout;
+        long long rows;
+        if (read_sidecar_header(fp, COARSE_MAGIC, stamp) == 0 &&
+            fread(&stored_layout, sizeof(stored_layout), 1, fp) == 1 && stored_layout == layout &&
+            fread(&rows, sizeof(rows), 1, fp) == 1 && rows == (long long)db.size() &&
+            fread(&coarse.dims, sizeof(coarse.dims), 1, fp) == 1 && coarse.dims == (int)sig.size() &&
+            rows * coarse.dims * (long long)sizeof(float) <= sidecar_remaining(fp))
+        {
+            coarse.sigs.resize(rows * coarse.dims);
+            if (fread(coarse.sigs.data(), sizeof(float), coarse.sigs.size(), fp) == coarse.sigs.size())
+            {
+                fclose(fp);
+                return;
+            }
+        }
+        fclose(fp);
+    }
+
+    // build the signatures from the stored feature vectors
+    printf("Building coarse signatures %s\n", sidecar);
+    coarse.dims = 0;
+    coarse.sigs.clear();
+    for (size_t i = 0; i < db.size(); i++)
+    {
+        coarsen(layout, db.data[i], sig);
+        coarse.dims = sig.size();
+        coarse.sigs.insert(coarse.sigs.end(), sig.begin(), sig.end());
+    }
+
+    // written to <csv>.coarse.new and renamed, as other processes may be reading the current sidecar
+    std::string staged = std::string(sidecar) + ".new";
+    fp = fopen(staged.c_str(), "wb");
+    if (!fp)
+    {
+        printf("Unable to write %s\n", sidecar);
+        return;
+    }
+    int stored_layout = layout;
+    long long rows = db.size();
+    write_sidecar_header(fp, COARSE_MAGIC, stamp);
+    fwrite(&stored_layout, sizeof(stored_layout), 1, fp);
+    fwrite(&rows, sizeof(rows), 1, fp);
+    fwrite(&coarse.dims, sizeof(coarse.dims), 1, fp);
+    fwrite(coarse.sigs.data(), sizeof(float), coarse.sigs.size(), fp);
+    if (fclose(fp) != 0 || rename(staged.c_str(), sidecar) != 0)
+    {
+        printf("Unable to write %s\n", sidecar);
+        remove(staged.c_str());
+    }
+}
+
+/*
+    Two-stage query plan: scores every row with its coarse signature, keeps the best M candidates
+    and re-ranks only those with the full metric
+*/
+void cascade_topk(MetricType metric, std::vector<float> &featVec, FeatureDB &db, CoarseDB &coarse, int M, int K,
+                  std::vector<std::pair<float, int>> &results, ScanStats &stats)
+{
+    std::vector<float> q_coarse;
+    std::vector<std::pair<float, int>> candidates;
+    coarsen(coarse.layout, featVec, q_coarse);
+
+    // stage 1: coarse scan of every row
+    TopK shortlist(std::min(M, (int)db.size()), true);
+    for (size_t i = 0; i < db.size(); i++)
+    {
+        shortlist.push(coarse_dist(coarse.layout, q_coarse.data(), coarse.row(i), coarse.dims), i);
+    }
+    shortlist.sorted(candidates);
+
+    // stage 2: exact re-rank of the candidates
+    TopK top(std::min(K, (int)candidates.size()), true);
+    for (auto &c : candidates)
+    {
+        stats.rows++;
+        top.push(apply_metric(metric, featVec, db.data[c.second]), c.second);
+    }
+    top.sorted(results);
+}
@@ -0,0 +1,83 @@
+/*
+    Cascade retrieval: a cheap coarse-signature scan followed by an exact re-rank of the best candidates
+
+    The coarse signatures are derived from the stored feature vectors (e.g. 8x8x8 RGB histograms summed
+    down to 4x4x4) and cached next to the database in <csv>.coarse
+*/
+
+#ifndef CASCADE_H
+#define CASCADE_H
+
+#include <utility>
+#include <vector>
+#include "distance.hpp"
+#include "feature_db.hpp"
+#include "scan.hpp"
+
+// coarse signature derived from the stored feature vectors of each mode
+enum CoarseLayout
+{
+    COARSE_NONE,    // no coarse signature (the mode is already cheap)
+    COARSE_RGB,     // 8x8x8 RGB histograms summed to 4x4x4 (hist2, multihist, sobel)
+    COARSE_RG,      // 16x16 rg histogram summed to 8x8 (hist)
+    COARSE_HSV,     // (16x16 + 2) HS histograms summed to (8x8 + 2) (hsv)
+    COARSE_FACE,    // HS histograms summed to (8x8 + 2), face flag kept (face)
+    COARSE_DNN,     // 512 embedding values summed in groups of 8 (dnn)
+    COARSE_DNN_HSV  // summed embedding followed by the summed HS histograms (dnn_hsv)
+};
+
+// coarse signatures of every row of a database, stored row after row
+struct CoarseDB
+{
+    CoarseLayout layout = COARSE_NONE;
+    int dims = 0;
+    std::vector<float> sigs;
+
+    const float *row(size_t i) const { return sigs.data() + i * dims; }
+};
+
+// Returns the coarse signature layout used for a feature mode (COARSE_NONE if the mode has none)
+CoarseLayout coarse_layout_for_mode(const char *feature_mode);
+
+// Returns the coarse signature layout of a feature database
+// The layouts assume the default histograms of the modes, so a database built with another histogram
+// configuration (see read -histogram) has none
+// Args: feature_mode - feature mode of the database
+//       csv          - csv database filename
+CoarseLayout coarse_layout_for_db(const char *feature_mode, char *csv);
+
+// Builds the coarse signature of a full feature vector
+// Args: layout - coarse signature layout
+//       full   - stored feature vector
+//       coarse - coarse signature to be filled
+void coarsen(CoarseLayout layout, const std::vector<float> &full, std::vector<float> &coarse);
+
+// Calculates the distance between 2 coarse signatures with the coarse version of the mode's metric
+float coarse_dist(CoarseLayout layout, const float *q, const float *r, int dims);
+
+// Loads the coarse signatures of a database from <csv>.coarse, or builds them from the loaded rows
+// and writes the sidecar if it is missing or was built from another version of the csv
+// Args: csv    - csv database filename
+//       db     - loaded database
+//       layout - coarse signature layout
+//       coarse - coarse signatures to be filled
+void load_coarse_db(char *csv, FeatureDB &db, CoarseLayout layout, CoarseDB &coarse);
+
+/*
+    Two-stage query plan: scores every row with its coarse signature, keeps the best M candidates
+    and re-ranks only those with the full metric
+
+    Args:
+        - metric: full distance metric
+        - featVec: query feature vector
+        - db: feature database
+        - coarse: coarse signatures of the database
+        - M: number of candidates kept by the coarse stage
+        - K: number of matches to return
+        - results: vector of (distance, row) pairs to be filled, best first
+        - stats: scan counters to be filled (rows counts the rows re-ranked in full)
+*/
+void cascade_topk(MetricType metric, std::vector<float> &featVec, FeatureDB &db, CoarseDB &coarse, int M, int K,
+                  std::vector<std::pair<float, int>> &results, ScanStats &stats);
+
+#endif
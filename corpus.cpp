@@ -0,0 +1,184 @@
+/*
+    Enumeration of the image and video files of a corpus
+
+    The walker keeps a shared stack of directories still to be read. Each thread pops a directory, lists it,
+    pushes its subdirectories back and keeps the image and video files it found, so wide trees (e.g. one folder per day)
+    are listed by all threads at once. The walk ends when the stack is empty and no thread is listing a directory.
+*/
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <filesystem>
+#include <mutex>
+#include <strings.h>
+#include <sys/stat.h>
+#include <thread>
+#include "corpus.hpp"
+
+// Checks whether a filename ends with one of the given extensions (case-insensitive)
+template <size_t N>
+static bool has_extension(const char *filename, const char *(&extensions)[N])
+{
+    const char *dot = strrchr(filename, '.');
+    if (dot == NULL || dot == filename)
+        return false;
+    for (const char *ext : extensions)
+    {
+        if (strlen(dot) == strlen(ext) && strncasecmp(dot, ext, strlen(ext)) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool is_image_file(const char *filename)
+{
+    static const char *extensions[] = {".jpg", ".jpeg", ".png", ".ppm", ".tif", ".tiff"};
+    return has_extension(filename, extensions);
+}
+
+bool is_video_file(const char *filename)
+{
+    static const char *extensions[] = {".mp4", ".m4v", ".mov", ".avi", ".mkv", ".webm"};
+    return has_extension(filename, extensions);
+}
+
+std::string corpus_path(const std::string &root, const std::string &rel)
+{
+    if (root.empty() || root == "." || (!rel.empty() && rel[0] == '/'))
+        return rel;
+    if (root.back() == '/')
+        return root + rel;
+    return root + "/" + rel;
+}
+
+int walk_corpus(const std::string &root, bool recursive, int threads, std::vector<std::string> &paths)
+{
+    DIR *dirp = opendir(root.c_str());
+    if (dirp == NULL)
+        return (-1);
+    closedir(dirp);
+
+    std::vector<std::string> pending = {""}; // directories (relative to root) still to be listed
+    int busy = 0;                            // threads currently listing a directory
+    std::mutex lock;
+    std::condition_variable work;
+
+    auto worker = [&]()
+    {
+        std::vector<std::string> found; // image files found by this thread
+        std::vector<std::string> subdirs;
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;)
+        {
+            work.wait(guard, [&]
+                      { return !pending.empty() || busy == 0; });
+            if (pending.empty())
+                break;
+            std::string rel = std::move(pending.back());
+            pending.pop_back();
+            busy++;
+            guard.unlock();
+
+            // list the directory without holding the lock
+            subdirs.clear();
+            std::string dir = corpus_path(root, rel);
+            DIR *dp = opendir(dir.c_str());
+            struct dirent *entry;
+            while (dp != NULL && (entry = readdir(dp)) != NULL)
+            {
+                const char *name = entry->d_name;
+                if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                    continue;
+                std::string child = rel.empty() ? name : rel + "/" + name;
+
+                bool is_dir = entry->d_type == DT_DIR;
+                bool is_file = entry->d_type == DT_REG;
+                if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK)
+                {
+                    // some file systems do not report the type, and symbolic links are followed
+                    struct stat st;
+                    if (stat(corpus_path(root, child).c_str(), &st) != 0)
+                        continue;
+                    is_dir = S_ISDIR(st.st_mode) && entry->d_type != DT_LNK; // do not follow directory links (cycles)
+                    is_file = S_ISREG(st.st_mode);
+                }
+
+                if (is_dir && recursive)
+                    subdirs.push_back(child);
+                else if (is_file && (is_image_file(name) || is_video_file(name)))
+                    found.push_back(child);
+            }
+            if (dp != NULL)
+                closedir(dp);
+            else
+                printf("Cannot open directory %s\n", dir.c_str());
+
+            guard.lock();
+            busy--;
+            for (std::string &s : subdirs)
+                pending.push_back(std::move(s));
+            work.notify_all();
+        }
+        // merge the files found by this thread (still holding the lock)
+        for (std::string &f : found)
+            paths.push_back(std::move(f));
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 0; t < std::max(1, threads); t++)
+        pool.emplace_back(worker);
+    for (std::thread &t : pool)
+        t.join();
+
+    // the order in which the threads finish is arbitrary
+    std::sort(paths.begin(), paths.end());
+    return (0);
+}
+
+int read_corpus_list(const char *list_file, const std::string &root, std::vector<std::string> &paths)
+{
+    bool from_stdin = strcmp(list_file, "-") == 0;
+    FILE *fp = from_stdin ? stdin : fopen(list_file, "rb");
+    if (fp == NULL)
+        return (-1);
+
+    // paths under the root are stored relative to it, compared after resolving both (so "./root/a.jpg",
+    // "root//a.jpg" and an absolute path all name the same image of "root/")
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    fs::path base = fs::weakly_canonical(root.empty() ? "." : root, ec);
+    bool resolve = !ec;
+
+    std::string path;
+    int ch;
+    do
+    {
+        ch = fgetc(fp);
+        if (ch != EOF && ch != '\n' && ch != '\0' && ch != '\r')
+        {
+            path += (char)ch;
+            continue;
+        }
+        if (!path.empty())
+        {
+            fs::path full = resolve ? fs::weakly_canonical(path, ec) : fs::path();
+            fs::path rel = resolve && !ec ? full.lexically_relative(base) : fs::path();
+            if (!rel.empty() && *rel.begin() != ".." && rel != ".")
+                path = rel.generic_string();
+            else
+                path = fs::path(path).lexically_normal().generic_string();
+        }
+        const char *slash = strrchr(path.c_str(), '/');
+        const char *name = slash ? slash + 1 : path.c_str();
+        if (!path.empty() && (is_image_file(name) || is_video_file(name)))
+            paths.push_back(path);
+        path.clear();
+    } while (ch != EOF);
+
+    if (!from_stdin)
+        fclose(fp);
+    return (0);
+}
@@ -0,0 +1,42 @@
+/*
+    Enumeration of the image and video files of a corpus
+
+    Image and video files are either found by walking a directory tree (in parallel, one directory at a time per thread)
+    or read from a list of paths. Paths are kept relative to the corpus root so that the csv rows stay unique
+    across nested folders and cbir can find the files again from the root stored in the csv header.
+*/
+
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <string>
+#include <vector>
+
+// Checks whether a filename has one of the supported image extensions (.jpg, .jpeg, .png, .ppm, .tif, .tiff)
+// The extension must end the name and is matched case-insensitively
+bool is_image_file(const char *filename);
+
+// Checks whether a filename has one of the supported video extensions (.mp4, .m4v, .mov, .avi, .mkv, .webm)
+bool is_video_file(const char *filename);
+
+// Finds every image and video file under a directory
+// Args: root      - corpus root directory
+//       recursive - whether to descend into subdirectories
+//       threads   - number of threads walking the tree
+//       paths     - vector to be filled with the file paths relative to root, sorted
+// Returns non-zero if the root directory cannot be opened
+int walk_corpus(const std::string &root, bool recursive, int threads, std::vector<std::string> &paths);
+
+// Reads a list of image and video paths separated by newlines or NUL characters (as written by find -print0)
+// Paths under root (resolved against the working directory, following symbolic links) are stored relative to root,
+// other relative paths are taken as relative to root already, and entries that are neither images nor videos are skipped
+// Args: list_file - file holding the list, or "-" for stdin
+//       root      - corpus root directory
+//       paths     - vector to be filled with the file paths relative to root
+// Returns non-zero if the list cannot be opened
+int read_corpus_list(const char *list_file, const std::string &root, std::vector<std::string> &paths);
+
+// Joins the corpus root and a relative path
+std::string corpus_path(const std::string &root, const std::string &rel);
+
+#endif
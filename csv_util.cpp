@@ -161,7 +161,7 @@ int append_image_data_csv( char *filename, char *image_filename, std::vector<flo
 int read_image_data_csv( char *filename, std::vector<char *> &filenames, std::vector<std::vector<float>> &data, int echo_file ) {
   FILE *fp;
   float fval;
-  char img_file[256];
+  char img_file[4096];
 
   fp = fopen(filename, "r");
   if( !fp ) {
@@ -173,6 +173,16 @@ int read_image_data_csv( char *filename, std::vector<char *> &filenames, std::ve
   for(;;) {
     std::vector<float> dvec;
     
+    // skip header lines
+    int first = fgetc( fp );
+    if( first == '#' ) {
+      int ch;
+      while( (ch = fgetc( fp )) != '\n' && ch != EOF );
+      continue;
+    }
+    if( first != EOF ) {
+      ungetc( first, fp );
+    }
     
     // read the filename
     if( getstring( fp, img_file ) ) {
@@ -210,3 +220,145 @@ int read_image_data_csv( char *filename, std::vector<char *> &filenames, std::ve
 
   return(0);
 }
+
+
+/*
+  Writes a header line of the form "#key,value" to the CSV format file.
+  If reset_file is true, then it will open the file in 'write' mode
+  and clear the existing contents.
+
+  Header lines must be written before the first line of data, they
+  are skipped by read_image_data_csv.
+
+  The function returns a non-zero value in case of an error.
+ */
+int write_image_data_header( char *filename, const char *key, const char *value, int reset_file ) {
+  FILE *fp;
+
+  fp = fopen( filename, reset_file ? "w" : "a" );
+  if(!fp) {
+    printf("Unable to open output file %s\n", filename );
+    exit(-1);
+  }
+
+  fprintf( fp, "#%s,%s\n", key, value );
+  fclose(fp);
+
+  return(0);
+}
+
+/*
+  Given a CSV format file, looks for a header line of the form
+  "#key,value" at the top of the file and copies the value into the
+  char array value (at most size bytes including the terminator).
+
+  The function returns a non-zero value if the file cannot be opened
+  or the key is not found.
+ */
+int read_image_data_header( char *filename, const char *key, char *value, int size ) {
+  FILE *fp;
+  char line[8192];
+  int found = 0;
+
+  fp = fopen(filename, "r");
+  if( !fp ) {
+    return(-1);
+  }
+
+  // header lines all start with '#', stop at the first line of data
+  while( fgets( line, sizeof(line), fp ) && line[0] == '#' ) {
+    char *comma = strchr( line, ',' );
+    if( !comma ) {
+      continue;
+    }
+    *comma = '\0';
+    if( strcmp( line + 1, key ) == 0 ) {
+      // copy the value without the end of line
+      char *val = comma + 1;
+      val[strcspn( val, "\r\n" )] = '\0';
+      snprintf( value, size, "%s", val );
+      found = 1;
+      break;
+    }
+  }
+  fclose(fp);
+
+  return(found ? 0 : -1);
+}
+
+/*
+  Given a filename, and image filename, and a set of 64-bit hashes,
+  by default the function will append a line of data to the CSV
+  format file.  If reset_file is true, then it will open the file in
+  'write' mode and clear the existing contents.
+
+  Each hash is written as 16 hexadecimal digits.
+
+  The function returns a non-zero value in case of an error.
+ */
+int append_image_hash_csv( char *filename, char *image_filename, std::vector<uint64_t> &hashes, int reset_file ) {
+  FILE *fp;
+
+  fp = fopen( filename, reset_file ? "w" : "a" );
+  if(!fp) {
+    printf("Unable to open output file %s\n", filename );
+    exit(-1);
+  }
+
+  // write the filename and the hashes to the CSV file
+  fprintf( fp, "%s", image_filename );
+  for(int i=0;i<hashes.size();i++) {
+    fprintf( fp, ",%016llx", (unsigned long long)hashes[i] );
+  }
+  fprintf( fp, "\n" ); // EOL
+
+  fclose(fp);
+
+  return(0);
+}
+
+/*
+  Given a file written by append_image_hash_csv, this function
+  returns the filenames as a std::vector of character arrays, and the
+  hashes of each row as a 2D std::vector<uint64_t>.
+
+  The function returns a non-zero value if something goes wrong.
+ */
+int read_image_hash_csv( char *filename, std::vector<char *> &filenames, std::vector<std::vector<uint64_t>> &hashes ) {
+  FILE *fp;
+  char line[8192];
+
+  fp = fopen(filename, "r");
+  if( !fp ) {
+    printf("Unable to open feature file\n");
+    return(-1);
+  }
+
+  printf("Reading %s\n", filename);
+  while( fgets( line, sizeof(line), fp ) ) {
+    // skip header lines and blank lines
+    if( line[0] == '#' || line[0] == '\n' ) {
+      continue;
+    }
+    line[strcspn( line, "\r\n" )] = '\0';
+
+    // the filename is everything up to the first comma
+    char *field = strtok( line, "," );
+    if( !field ) {
+      continue;
+    }
+    char *fname = new char[strlen(field)+1];
+    strcpy(fname, field);
+    filenames.push_back( fname );
+
+    std::vector<uint64_t> hvec;
+    while( (field = strtok( NULL, "," )) != NULL ) {
+      hvec.push_back( strtoull( field, NULL, 16 ) );
+    }
+    hashes.push_back( hvec );
+  }
+  fclose(fp);
+  printf("Finished reading CSV file\n");
+
+  return(0);
+}
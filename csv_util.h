@@ -10,6 +10,9 @@
 #ifndef CVS_UTIL_H
 #define CVS_UTIL_H
 
+#include <cstdint>
+#include <vector>
+
 /*
   Given a filename, and image filename, and the image features, by
   default the function will append a line of data to the CSV format
@@ -41,4 +44,51 @@ int append_image_data_csv( char *filename, char *image_filename, std::vector<flo
  */
 int read_image_data_csv( char *filename, std::vector<char *> &filenames, std::vector<std::vector<float>> &data, int echo_file = 0 );
 
+/*
+  Writes a header line of the form "#key,value" to the CSV format
+  file.  If reset_file is true, then it will open the file in 'write'
+  mode and clear the existing contents.
+
+  Header lines must be written before the first line of data, they
+  are skipped by read_image_data_csv.
+
+  The function returns a non-zero value in case of an error.
+ */
+int write_image_data_header( char *filename, const char *key, const char *value, int reset_file = 0 );
+
+
+/*
+  Given a CSV format file, looks for a header line of the form
+  "#key,value" at the top of the file and copies the value into the
+  char array value (at most size bytes including the terminator).
+
+  The function returns a non-zero value if the file cannot be opened
+  or the key is not found.
+ */
+int read_image_data_header( char *filename, const char *key, char *value, int size );
+
+/*
+  Given a filename, and image filename, and a set of 64-bit hashes,
+  by default the function will append a line of data to the CSV
+  format file.  If reset_file is true, then it will open the file in
+  'write' mode and clear the existing contents.
+
+  The image filename is written to the first position in the row of
+  data. Each hash is written as 16 hexadecimal digits (packed bits
+  rather than one float per bit).
+
+  The function returns a non-zero value in case of an error.
+ */
+int append_image_hash_csv( char *filename, char *image_filename, std::vector<uint64_t> &hashes, int reset_file = 0 );
+
+
+/*
+  Given a file written by append_image_hash_csv, this function
+  returns the filenames as a std::vector of character arrays, and the
+  hashes of each row as a 2D std::vector<uint64_t>.
+
+  The function returns a non-zero value if something goes wrong.
+ */
+int read_image_hash_csv( char *filename, std::vector<char *> &filenames, std::vector<std::vector<uint64_t>> &hashes );
+
 #endif
@@ -0,0 +1,378 @@
+/*
+    Distance metrics used to compare feature vectors
+
+    Every metric returns a distance where smaller values mean more similar images.
+    The bounded variant gives up on a row as soon as its distance is certain to exceed a bound.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include "distance.hpp"
+
+// Calculates the cosine distance between the 2 feature vectors
+// Returns a float: 1 - cos(theta) = 1 - (v1 dot v2)/(|v1||v2|)
+//                            ^ theta is the angle between the 2 vectors
+float cosine(std::vector<float> &featVec, std::vector<float> &data)
+{
+    if (featVec.size() != data.size())
+    {
+        printf("Error: Vector size mismatch! Image: %lu vs Database: %lu\n", featVec.size(), data.size());
+        exit(-1);
+    }
+
+    float dot = 0.0f;         // dot product
+    float featVec_mag = 0.0f; // magnitude of featVec
+    float data_mag = 0.0f;    // magnitude of data
+
+    for (int i = 0; i < featVec.size(); i++)
+    {
+        dot += featVec[i] * data[i];
+        featVec_mag += featVec[i] * featVec[i];
+        data_mag += data[i] * data[i];
+    }
+
+    featVec_mag = std::sqrt(featVec_mag);
+    data_mag = std::sqrt(data_mag);
+
+    return 1.0f - (dot / (featVec_mag * data_mag));
+}
+
+// Calculates the histogram intersection distance betweeen the 2 vectors (normalized histogram)
+// Divides the sum by the divisor to account for N number of histograms
+// Returns a float: 1 - sum of min(a[i], b[i]) / divisor
+float intersection(std::vector<float> &featVec, std::vector<float> &data, float divisor)
+{
+    if (featVec.size() != data.size())
+    {
+        printf("Error: Vector size mismatch! Image: %lu vs Database: %lu\n", featVec.size(), data.size());
+        exit(-1);
+    }
+
+    float sum = 0;
+
+    for (int i = 0; i < featVec.size(); i++)
+    {
+        sum += std::min(featVec[i], data[i]);
+    }
+
+    return 1.0f - (sum / divisor);
+}
+
+// Calculates the histogram intersection distance betweeen the 2 vectors (normalized histogram)
+// Divides the sum by 2 to account for 2 histograms
+// Adds a penalty (0.5) if the 2 vectors have a mismatch in the flag indicating face presence
+// (e.g. if one image contains a face and another doesn't, the distance receives a penalty)
+// Returns a float
+float face_dist(std::vector<float> &featVec, std::vector<float> &data)
+{
+    if (featVec.size() != data.size())
+    {
+        printf("Error: Vector size mismatch! Image: %lu vs Database: %lu\n", featVec.size(), data.size());
+        exit(-1);
+    }
+
+    float sum = 0;
+
+    // calculate the intersection distance up to N - 1 features
+    for (int i = 0; i < featVec.size() - 1; i++)
+    {
+        sum += std::min(featVec[i], data[i]);
+    }
+
+    float result = 1.0f - (sum / 2.0f);
+    // only check the last feature in the vector
+    if (std::fabs(data.back() - featVec.back()) > 0.1)
+        result += 0.5f; // add penalty for flag mismatch
+
+    return result;
+}
+
+// Calculates the sum squared distance betweeen the 2 vectors
+// Returns a float: sum of (a[i] - b[i])^2
+float ssd(std::vector<float> &featVec, std::vector<float> &data)
+{
+    if (featVec.size() != data.size())
+    {
+        printf("Error: Vector size mismatch! Image: %lu vs Database: %lu\n", featVec.size(), data.size());
+        exit(-1);
+    }
+
+    float dist = 0;
+    float diff;
+
+    for (int i = 0; i < featVec.size(); i++)
+    {
+        diff = featVec[i] - data[i];
+        dist += diff * diff;
+    }
+
+    return dist;
+}
+
+// Calculates the sum of the cosine distance of the DNN embeddings (first 512 values)
+// and the intersection distance of the 2 HSV histograms (remaining values)
+// Returns a float
+float dnn_hsv_dist(std::vector<float> &featVec, std::vector<float> &data)
+{
+    std::vector<float> dnn_feat(featVec.begin(), featVec.begin() + DNN_FEAT_LENGTH);
+    std::vector<float> dnn_data(data.begin(), data.begin() + DNN_FEAT_LENGTH);
+
+    std::vector<float> hsv_feat(featVec.begin() + DNN_FEAT_LENGTH, featVec.end());
+    std::vector<float> hsv_data(data.begin() + DNN_FEAT_LENGTH, data.end());
+
+    float dnn_dist = cosine(dnn_feat, dnn_data);
+    float hsv_dist = intersection(hsv_feat, hsv_data, 2.0f);
+
+    return dnn_dist + hsv_dist;
+}
+
+// Applies the chosen distance metric to calculate the distance between 2 feature vectors
+// Returns the distance as a float
+float apply_metric(MetricType metric, std::vector<float> &featVec, std::vector<float> &data)
+{
+    float dist;
+
+    switch (metric)
+    {
+    case SSD:
+        dist = ssd(featVec, data);
+        break;
+    case INTERSECTION:
+        dist = intersection(featVec, data, 1.0f);
+        break;
+    case RGB_REGION_INTERSECTION:
+        // one normalized 8x8x8 histogram per region
+        dist = intersection(featVec, data, featVec.size() / 512.0f);
+        break;
+    case TWO_HIST_INTERSECTION:
+        dist = intersection(featVec, data, 2.0f);
+        break;
+    case COSINE:
+        dist = cosine(featVec, data);
+        break;
+    case FACE:
+        dist = face_dist(featVec, data);
+        break;
+    case DNN_HSV:
+        dist = dnn_hsv_dist(featVec, data);
+        break;
+    }
+
+    return dist;
+}
+
+// Returns the term a vector element contributes to the suffix sums used by the bounds of the given metric
+// (squares for the cosine parts, histogram mass for the intersection parts, nothing for the face flag)
+static float bound_term(MetricType metric, size_t i, size_t n, float x)
+{
+    switch (metric)
+    {
+    case COSINE:
+        return x * x;
+    case DNN_HSV:
+        return i < DNN_FEAT_LENGTH ? x * x : x;
+    case FACE:
+        return i == n - 1 ? 0.0f : x;
+    default:
+        return x;
+    }
+}
+
+// Computes the suffix sums of a feature vector at every BOUND_BLOCK-th dimension
+// suffix[c] is the sum of the bound terms of all elements from c * BOUND_BLOCK to the end
+// Args: metric - distance metric the bounds are used for
+//       vec    - feature vector
+//       suffix - vector to be filled (vec.size() / BOUND_BLOCK + 1 values)
+void bound_suffix_sums(MetricType metric, const std::vector<float> &vec, std::vector<float> &suffix)
+{
+    size_t n = vec.size();
+    size_t nblocks = n / BOUND_BLOCK + 1;
+    suffix.assign(nblocks, 0.0f);
+
+    // accumulate backwards in double so the bound is not weakened by rounding
+    double sum = 0.0;
+    for (size_t i = n; i-- > 0;)
+    {
+        sum += bound_term(metric, i, n, vec[i]);
+        if (i % BOUND_BLOCK == 0)
+            suffix[i / BOUND_BLOCK] = (float)sum;
+    }
+}
+
+// Returns true if a lower bound on the distance is far enough above the bound to safely abandon the row
+// (the slack covers the rounding difference between the precomputed suffix sums and the running sums)
+static inline bool exceeds(float lower, float bound)
+{
+    return lower > bound + PRUNE_SLACK * (1.0f + std::fabs(bound));
+}
+
+// Accumulates sum of min(a[i], b[i]) over [begin, end), checking the remaining-mass bound after every block
+// The final distance is offset - sum / divisor, and the remaining sum is at most min(q_suffix[c], r_suffix[c])
+// Returns false if the row was abandoned (dist is then set to a lower bound greater than bound)
+static bool bounded_intersection_sum(const float *q, const float *r, size_t begin, size_t end,
+                                     const float *q_suffix, const float *r_suffix,
+                                     float offset, float divisor, float bound, float &sum, float &dist)
+{
+    for (size_t i = begin; i < end;)
+    {
+        size_t block_end = std::min(end, (i / BOUND_BLOCK + 1) * BOUND_BLOCK);
+        for (; i < block_end; i++)
+        {
+            sum += std::min(q[i], r[i]);
+        }
+        if (i < end)
+        {
+            float remaining = std::min(q_suffix[i / BOUND_BLOCK], r_suffix[i / BOUND_BLOCK]);
+            float lower = offset - (sum + remaining) / divisor;
+            if (exceeds(lower, bound))
+            {
+                dist = lower;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+    Applies the chosen distance metric like apply_metric, but abandons the row as soon as its distance
+    is certain to be greater than bound (the current K-th best distance of the scan)
+      - ssd: the partial sum only grows, so it is abandoned once it passes the bound
+      - intersection metrics: the remaining mass is bounded by the suffix sums of the query and the row
+      - cosine: the remaining dot product is bounded by the suffix norms (Cauchy-Schwarz)
+    The arithmetic is performed in the same order as the exact metrics so the distance of every row
+    that is not abandoned is identical to apply_metric
+
+    Args:
+        - metric: distance metric
+        - featVec: query feature vector
+        - data: feature vector of the DB row
+        - q_suffix: suffix sums of the query (see bound_suffix_sums)
+        - r_suffix: suffix sums of the DB row
+        - bound: distance above which the row may be abandoned
+        - dist: set to the exact distance, or to a lower bound greater than bound if abandoned
+    Returns false if the row was abandoned
+*/
+bool apply_metric_bounded(MetricType metric, std::vector<float> &featVec, std::vector<float> &data,
+                          const float *q_suffix, const float *r_suffix, float bound, float &dist)
+{
+    if (featVec.size() != data.size())
+    {
+        // let the exact metric report the mismatch
+        dist = apply_metric(metric, featVec, data);
+        return true;
+    }
+
+    const float *q = featVec.data();
+    const float *r = data.data();
+    size_t n = featVec.size();
+    float sum = 0.0f;
+
+    switch (metric)
+    {
+    case SSD:
+    {
+        float diff;
+        dist = 0.0f;
+        for (size_t i = 0; i < n;)
+        {
+            size_t block_end = std::min(n, i + BOUND_BLOCK);
+            for (; i < block_end; i++)
+            {
+                diff = q[i] - r[i];
+                dist += diff * diff;
+            }
+            if (dist > bound)
+                return false;
+        }
+        return true;
+    }
+    case INTERSECTION:
+    case RGB_REGION_INTERSECTION:
+    case TWO_HIST_INTERSECTION:
+    {
+        float divisor = metric == INTERSECTION ? 1.0f : metric == TWO_HIST_INTERSECTION ? 2.0f
+                                                                                      : n / 512.0f;
+        if (!bounded_intersection_sum(q, r, 0, n, q_suffix, r_suffix, 1.0f, divisor, bound, sum, dist))
+            return false;
+        dist = 1.0f - (sum / divisor);
+        return true;
+    }
+    case FACE:
+    {
+        // the flag penalty is known up front, so it is part of the bound from the start
+        float penalty = std::fabs(data.back() - featVec.back()) > 0.1 ? 0.5f : 0.0f;
+        if (!bounded_intersection_sum(q, r, 0, n - 1, q_suffix, r_suffix, 1.0f + penalty, 2.0f, bound, sum, dist))
+            return false;
+        dist = 1.0f - (sum / 2.0f);
+        if (penalty > 0.0f)
+            dist += penalty;
+        return true;
+    }
+    case COSINE:
+    {
+        float dot = 0.0f, featVec_mag = 0.0f, data_mag = 0.0f;
+        float norms = std::sqrt(q_suffix[0]) * std::sqrt(r_suffix[0]);
+        for (size_t i = 0; i < n;)
+        {
+            size_t block_end = std::min(n, i + BOUND_BLOCK);
+            for (; i < block_end; i++)
+            {
+                dot += q[i] * r[i];
+                featVec_mag += q[i] * q[i];
+                data_mag += r[i] * r[i];
+            }
+            if (i < n && norms > 0.0f)
+            {
+                float remaining = std::sqrt(q_suffix[i / BOUND_BLOCK]) * std::sqrt(r_suffix[i / BOUND_BLOCK]);
+                float lower = 1.0f - (dot + remaining) / norms;
+                if (exceeds(lower, bound))
+                {
+                    dist = lower;
+                    return false;
+                }
+            }
+        }
+        featVec_mag = std::sqrt(featVec_mag);
+        data_mag = std::sqrt(data_mag);
+        dist = 1.0f - (dot / (featVec_mag * data_mag));
+        return true;
+    }
+    case DNN_HSV:
+    {
+        // the cosine part is computed in full, then the intersection part is bounded
+        float dot = 0.0f, featVec_mag = 0.0f, data_mag = 0.0f;
+        for (size_t i = 0; i < DNN_FEAT_LENGTH; i++)
+        {
+            dot += q[i] * r[i];
+            featVec_mag += q[i] * q[i];
+            data_mag += r[i] * r[i];
+        }
+        featVec_mag = std::sqrt(featVec_mag);
+        data_mag = std::sqrt(data_mag);
+        float dnn_dist = 1.0f - (dot / (featVec_mag * data_mag));
+
+        float hsv_lower = 1.0f - std::min(q_suffix[DNN_FEAT_LENGTH / BOUND_BLOCK], r_suffix[DNN_FEAT_LENGTH / BOUND_BLOCK]) / 2.0f;
+        if (exceeds(dnn_dist + hsv_lower, bound))
+        {
+            dist = dnn_dist + hsv_lower;
+            return false;
+        }
+        float hsv_dist;
+        if (!bounded_intersection_sum(q, r, DNN_FEAT_LENGTH, n, q_suffix, r_suffix, 1.0f, 2.0f, bound - dnn_dist, sum, hsv_dist))
+        {
+            dist = dnn_dist + hsv_dist;
+            return false;
+        }
+        hsv_dist = 1.0f - (sum / 2.0f);
+        dist = dnn_dist + hsv_dist;
+        return true;
+    }
+    }
+
+    dist = apply_metric(metric, featVec, data);
+    return true;
+}
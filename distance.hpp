@@ -0,0 +1,81 @@
+/*
+    Distance metrics used to compare feature vectors
+*/
+
+#ifndef DISTANCE_H
+#define DISTANCE_H
+
+#include <vector>
+
+// length of the ResNet18 embedding at the start of a dnn_hsv feature vector
+#define DNN_FEAT_LENGTH 512
+
+// number of dimensions between the checkpoints of the bound-based pruning
+#define BOUND_BLOCK 64
+
+// relative slack added to the pruning bound to absorb float rounding in the suffix sums
+#define PRUNE_SLACK 1e-4f
+
+// available distance metric types
+enum MetricType
+{
+    SSD,
+    INTERSECTION,
+    RGB_REGION_INTERSECTION,
+    TWO_HIST_INTERSECTION,
+    COSINE,
+    FACE,
+    DNN_HSV
+};
+
+// Calculates the cosine distance between the 2 feature vectors
+// Returns a float: 1 - cos(theta) = 1 - (v1 dot v2)/(|v1||v2|)
+float cosine(std::vector<float> &featVec, std::vector<float> &data);
+
+// Calculates the histogram intersection distance betweeen the 2 vectors (normalized histogram)
+// Divides the sum by the divisor to account for N number of histograms
+// Returns a float: 1 - sum of min(a[i], b[i]) / divisor
+float intersection(std::vector<float> &featVec, std::vector<float> &data, float divisor);
+
+// Calculates the histogram intersection distance betweeen the 2 vectors (normalized histogram)
+// Divides the sum by 2 to account for 2 histograms
+// Adds a penalty (0.5) if the 2 vectors have a mismatch in the flag indicating face presence
+// Returns a float
+float face_dist(std::vector<float> &featVec, std::vector<float> &data);
+
+// Calculates the sum squared distance betweeen the 2 vectors
+// Returns a float: sum of (a[i] - b[i])^2
+float ssd(std::vector<float> &featVec, std::vector<float> &data);
+
+// Calculates the sum of the cosine distance of the DNN embeddings (first 512 values)
+// and the intersection distance of the 2 HSV histograms (remaining values)
+// Returns a float
+float dnn_hsv_dist(std::vector<float> &featVec, std::vector<float> &data);
+
+// Applies the chosen distance metric to calculate the distance between 2 feature vectors
+// Returns the distance as a float
+float apply_metric(MetricType metric, std::vector<float> &featVec, std::vector<float> &data);
+
+// Computes the suffix sums of a feature vector at every BOUND_BLOCK-th dimension
+// suffix[c] is the sum of the bound terms of all elements from c * BOUND_BLOCK to the end
+// (squares for cosine parts, histogram mass for intersection parts)
+// Args: metric - distance metric the bounds are used for
+//       vec    - feature vector
+//       suffix - vector to be filled (vec.size() / BOUND_BLOCK + 1 values)
+void bound_suffix_sums(MetricType metric, const std::vector<float> &vec, std::vector<float> &suffix);
+
+// Applies the chosen distance metric like apply_metric, but abandons the row as soon as its distance
+// is certain to be greater than bound (partial sums for ssd, suffix sums for intersection and cosine)
+// The distance of every row that is not abandoned is identical to apply_metric
+// Args: metric   - distance metric
+//       featVec  - query feature vector
+//       data     - feature vector of the DB row
+//       q_suffix - suffix sums of the query (see bound_suffix_sums)
+//       r_suffix - suffix sums of the DB row
+//       bound    - distance above which the row may be abandoned
+//       dist     - set to the exact distance, or to a lower bound greater than bound if abandoned
+// Returns false if the row was abandoned
+bool apply_metric_bounded(MetricType metric, std::vector<float> &featVec, std::vector<float> &data,
+                          const float *q_suffix, const float *r_suffix, float bound, float &dist);
+
+#endif
@@ -0,0 +1,351 @@
+/*
+    Recall versus latency of the approximate query paths
+
+    Runs a set of database rows as queries through the exact scan (what cbir returns today) and through an
+    approximate path, for every value of the path's tuning knob, and reports how close the approximate
+    rankings are to the exact ones and how much faster they are:
+        - recall@K: fraction of the exact top K found by the approximate path
+        - displacement: mean distance between the rank of each exact match and its rank in the approximate
+          result (a match that was not found counts as K)
+        - speedup: mean time of the exact scan over the mean time of the approximate path
+
+    Approximate paths and their knobs:
+        - cascade: number of candidates M kept by the coarse stage (see cascade.hpp)
+        - pca: number of dimensions kept by the projection (see pca.hpp), fitted here for every value
+        - bins: number of query bins probed in the bin index (see bin_index.hpp), which is built here with the
+          given threshold; the mean number of candidates scored per query is reported as well
+        - ivf: number of lists probed in the IVF index (see ivf.hpp), which must have been built for the current
+          database by ivf_index; the mean number of rows scored per query is reported as well
+
+    All paths are timed on one thread, one-time setup (coarse signatures, projection fit) is reported apart.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include "bin_index.hpp"
+#include "cascade.hpp"
+#include "csv_util.h"
+#include "feature_db.hpp"
+#include "ivf.hpp"
+#include "pca.hpp"
+#include "scan.hpp"
+
+// Parses a comma separated list of knob values
+static std::vector<int> parse_knobs(const char *list)
+{
+    std::vector<int> knobs;
+    for (const char *p = list; *p;)
+    {
+        int v = atoi(p);
+        if (v > 0)
+            knobs.push_back(v);
+        const char *comma = strchr(p, ',');
+        if (comma == NULL)
+            break;
+        p = comma + 1;
+    }
+    return knobs;
+}
+
+// Adds the recall and the rank displacement of an approximate result against the exact one
+static void compare_rankings(const std::vector<std::pair<float, int>> &exact, const std::vector<std::pair<float, int>> &approx,
+                             double &recall, double &displacement)
+{
+    int K = exact.size();
+    int found = 0;
+    double moved = 0.0;
+    for (int r = 0; r < K; r++)
+    {
+        int rank = -1;
+        for (int a = 0; a < (int)approx.size(); a++)
+        {
+            if (approx[a].second == exact[r].second)
+            {
+                rank = a;
+                break;
+            }
+        }
+        if (rank >= 0)
+        {
+            found++;
+            moved += std::abs(rank - r);
+        }
+        else
+            moved += K;
+    }
+    recall += K > 0 ? (double)found / K : 1.0;
+    displacement += K > 0 ? moved / K : 0.0;
+}
+
+/*
+    Evaluates an approximate query path against the exact scan
+
+    Argv:
+        - feature_mode: feature mode whose database is queried (baseline, hist, hist2, multihist, sobel, hsv, face, dnn, dnn_hsv)
+        - path: approximate path, "cascade", "pca", "bins" or "ivf"
+        - [-sweep list]: optional, comma separated knob values (default: cascade 20,50,100,200,500,1000,2000
+                         candidates, pca 8,16,32,64,128,256 dimensions, bins 1,2,4,8,16,32 probed bins,
+                         ivf 1,2,4,8,16,32 probed lists)
+        - [-queries q]: optional, number of database rows used as queries, evenly spaced (default 200)
+        - [-K k]: optional, number of matches compared (default 10)
+        - [-sample n]: optional, number of rows the projections are fitted on (default 20000)
+        - [-threshold t]: optional, fraction of a row's mass a bin must hold to index the row (default BIN_INDEX_THRESHOLD)
+        - [-o file]: optional, also write the tradeoff curve to a csv file
+*/
+int main(int argc, char *argv[])
+{
+    char csv[256];
+    char pca_path[512];
+    MetricType metric;
+    FeatureDB db;
+    int nqueries = 200;
+    int K = 10;
+    int sample = 20000;
+    float threshold = BIN_INDEX_THRESHOLD;
+    const char *sweep = NULL;
+    const char *out_file = NULL;
+
+    // check for sufficient arguments
+    if (argc < 3)
+    {
+        printf("usage: %s <feature mode>, <cascade|pca|bins|ivf>, [-sweep <v1,v2,...>], [-queries <q>], [-K <k>], [-sample <rows>], [-threshold <fraction>], [-o <csv file>]\n", argv[0]);
+        exit(-1);
+    }
+
+    if (feature_mode_db(argv[1], csv, metric) != 0)
+    {
+        printf("Invalid feature mode %s\n", argv[1]);
+        exit(-1);
+    }
+    bool cascade = strcmp(argv[2], "cascade") == 0;
+    bool bins = strcmp(argv[2], "bins") == 0;
+    bool ivf = strcmp(argv[2], "ivf") == 0;
+    if (!cascade && !bins && !ivf && strcmp(argv[2], "pca") != 0)
+    {
+        printf("Invalid approximate path %s (use cascade, pca, bins or ivf)\n", argv[2]);
+        exit(-1);
+    }
+    for (int i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-sweep") == 0 && i + 1 < argc)
+            sweep = argv[++i];
+        else if (strcmp(argv[i], "-queries") == 0 && i + 1 < argc)
+            nqueries = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-K") == 0 && i + 1 < argc)
+            K = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-sample") == 0 && i + 1 < argc)
+            sample = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-threshold") == 0 && i + 1 < argc)
+            threshold = atof(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            out_file = argv[++i];
+        else
+        {
+            printf("Unknown option %s\n", argv[i]);
+            exit(-1);
+        }
+    }
+    const char *knob_name = cascade ? "candidates" : bins ? "bins" : ivf ? "nprobe" : "dims";
+    std::vector<int> knobs = parse_knobs(sweep ? sweep : cascade   ? "20,50,100,200,500,1000,2000"
+                                                     : bins || ivf ? "1,2,4,8,16,32"
+                                                                   : "8,16,32,64,128,256");
+    bool counts_scored = bins || ivf;
+    if (knobs.empty())
+    {
+        printf("Invalid sweep %s\n", sweep);
+        exit(-1);
+    }
+
+    // the approximate paths work on the full vectors
+    if (read_image_data_header(csv, "pca", pca_path, sizeof(pca_path)) == 0)
+    {
+        printf("%s is already reduced with %s, rebuild it with the full vectors first\n", csv, pca_path);
+        exit(-1);
+    }
+    CoarseLayout layout = coarse_layout_for_db(argv[1], csv);
+    if (cascade && layout == COARSE_NONE)
+    {
+        printf("%s has no coarse signature (the %s mode has none or the csv uses another histogram configuration)\n", csv, argv[1]);
+        exit(-1);
+    }
+    if (bins && !bin_index_mode(argv[1]))
+    {
+        printf("The %s mode has no bin index (use hist, hist2 or hsv)\n", argv[1]);
+        exit(-1);
+    }
+    IVFIndex ivf_index;
+    bool fresh = false;
+    if (ivf && (read_ivf(csv, metric, ivf_index, fresh) != 0 || !fresh))
+    {
+        printf("No up-to-date IVF index for %s, run ivf_index train or add first\n", csv);
+        exit(-1);
+    }
+    if (load_feature_db(csv, db) != 0 || db.size() < 2)
+        exit(-1);
+    K = std::clamp(K, 1, (int)db.size());
+    nqueries = std::clamp(nqueries, 1, (int)db.size());
+
+    // exact rankings (the pruned scan returns the same matches as the exhaustive one)
+    load_bounds(csv, db, metric);
+    std::vector<std::vector<std::pair<float, int>>> exact(nqueries);
+    auto start = std::chrono::steady_clock::now();
+    for (int q = 0; q < nqueries; q++)
+    {
+        ScanStats stats;
+        scan_topk(metric, db.data[(size_t)q * db.size() / nqueries], db, K, true, true, exact[q], stats);
+    }
+    double exact_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / nqueries;
+    printf("Exact scan of %zu rows: %.3f ms per query over %d queries\n", db.size(), exact_ms, nqueries);
+
+    CoarseDB coarse;
+    if (cascade)
+    {
+        start = std::chrono::steady_clock::now();
+        load_coarse_db(csv, db, layout, coarse);
+        printf("Coarse signatures: %d floats per row (%.2f s setup)\n", coarse.dims,
+               std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    BinIndex index;
+    if (bins)
+    {
+        start = std::chrono::steady_clock::now();
+        build_bin_index(db, threshold, index);
+        printf("Bin index: threshold %.3f, %.1f bins per row (%.2f s setup)\n", threshold, (double)index.rows.size() / db.size(),
+               std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    // the index stores its rows list after list, so its results are mapped back to database rows by name
+    std::vector<int> ivf_rows;
+    if (ivf)
+    {
+        std::unordered_map<std::string, int> rows;
+        for (size_t i = 0; i < db.size(); i++)
+            rows[db.filenames[i]] = i;
+        for (const std::string &name : ivf_index.names)
+            ivf_rows.push_back(rows.count(name) ? rows[name] : -1);
+        printf("IVF index: %d lists, %.1f rows per list\n", ivf_index.lists(),
+               ivf_index.lists() > 0 ? (double)ivf_index.size() / ivf_index.lists() : 0.0);
+    }
+
+    FILE *fp = NULL;
+    if (out_file != NULL)
+    {
+        fp = fopen(out_file, "w");
+        if (fp == NULL)
+        {
+            printf("Cannot write %s\n", out_file);
+            exit(-1);
+        }
+        fprintf(fp, "%s,recall,displacement,approx_ms,exact_ms,speedup%s\n", knob_name, counts_scored ? ",scored" : "");
+    }
+
+    printf("%10s %10s %13s %12s %9s%s\n", knob_name, "recall@K", "displacement", "ms/query", "speedup", counts_scored ? "    scored" : "");
+    std::vector<std::pair<float, int>> approx;
+    for (int knob : knobs)
+    {
+        double recall = 0.0, displacement = 0.0, approx_ms = 0.0;
+        long scored = 0; // candidates scored by the bin index or the IVF lists
+
+        if (ivf)
+        {
+            start = std::chrono::steady_clock::now();
+            for (int q = 0; q < nqueries; q++)
+            {
+                ScanStats stats;
+                ivf_topk(ivf_index, db.data[(size_t)q * db.size() / nqueries], knob, K, approx, stats);
+                scored += stats.rows;
+                for (auto &match : approx)
+                    match.second = ivf_rows[match.second];
+                compare_rankings(exact[q], approx, recall, displacement);
+            }
+            approx_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+        else if (bins)
+        {
+            start = std::chrono::steady_clock::now();
+            for (int q = 0; q < nqueries; q++)
+            {
+                ScanStats stats;
+                bin_index_topk(metric, db.data[(size_t)q * db.size() / nqueries], db, index, knob, K, approx, stats);
+                scored += stats.rows;
+                compare_rankings(exact[q], approx, recall, displacement);
+            }
+            approx_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+        else if (cascade)
+        {
+            int M = std::max(knob, K);
+            start = std::chrono::steady_clock::now();
+            for (int q = 0; q < nqueries; q++)
+            {
+                ScanStats stats;
+                cascade_topk(metric, db.data[(size_t)q * db.size() / nqueries], db, coarse, M, K, approx, stats);
+                compare_rankings(exact[q], approx, recall, displacement);
+            }
+            approx_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+        else
+        {
+            // fit the projection and project every row (setup, not timed as part of the queries)
+            PCAProjection proj;
+            double retained;
+            if (knob > (int)db.data[0].size() || fit_pca(db, knob, sample, proj, retained) != 0)
+            {
+                printf("%10d skipped (the vectors have %zu dimensions)\n", knob, db.data[0].size());
+                continue;
+            }
+            FeatureDB reduced;
+            for (size_t i = 0; i < db.size(); i++)
+            {
+                char *name = new char[strlen(db.filenames[i]) + 1];
+                strcpy(name, db.filenames[i]);
+                reduced.filenames.push_back(name);
+                reduced.data.push_back(db.data[i]);
+                pca_project(proj, reduced.data.back());
+            }
+
+            // a query is projected and then scanned with ssd, as cbir does for reduced databases
+            std::vector<float> query;
+            start = std::chrono::steady_clock::now();
+            for (int q = 0; q < nqueries; q++)
+            {
+                ScanStats stats;
+                query = db.data[(size_t)q * db.size() / nqueries];
+                pca_project(proj, query);
+                scan_topk(SSD, query, reduced, K, true, true, approx, stats);
+                compare_rankings(exact[q], approx, recall, displacement);
+            }
+            approx_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // the ranking comparison is cheap next to the scans and is left in the timing
+        approx_ms /= nqueries;
+        recall /= nqueries;
+        displacement /= nqueries;
+        double speedup = exact_ms / std::max(approx_ms, 1e-6);
+        printf("%10d %10.3f %13.3f %12.3f %8.1fx", knob, recall, displacement, approx_ms, speedup);
+        if (counts_scored)
+            printf(" %9.1f", (double)scored / nqueries);
+        printf("\n");
+        if (fp != NULL)
+        {
+            fprintf(fp, "%d,%.4f,%.4f,%.4f,%.4f,%.3f", knob, recall, displacement, approx_ms, exact_ms, speedup);
+            if (counts_scored)
+                fprintf(fp, ",%.1f", (double)scored / nqueries);
+            fprintf(fp, "\n");
+        }
+    }
+
+    if (fp != NULL)
+    {
+        fclose(fp);
+        printf("Wrote %s\n", out_file);
+    }
+
+    return (0);
+}
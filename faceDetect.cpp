@@ -7,6 +7,7 @@
 
   The path to the Haar cascade file is define in faceDetect.h
 */
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
@@ -19,10 +20,11 @@
   cv::Mat grey  - a greyscale source image in which to detect faces
   std::vector<cv::Rect> &faces - a standard vector of cv::Rect rectangles indicating where faces were found
      if the length of the vector is zero, no faces were found
+  cv::Rect search - part of the image to search (see findSkinRegion), the whole image if empty
  */
-int detectFaces( cv::Mat &grey, std::vector<cv::Rect> &faces ) {
-  // a static variable to hold a half-size image
-  static cv::Mat half;
+int detectFaces( cv::Mat &grey, std::vector<cv::Rect> &faces, cv::Rect search ) {
+  // a static variable to hold the working size image
+  static cv::Mat small;
   
   // a static variable to hold the classifier
   static cv::CascadeClassifier face_cascade;
@@ -41,26 +43,122 @@ int detectFaces( cv::Mat &grey, std::vector<cv::Rect> &faces ) {
   // clear the vector of faces
   faces.clear();
   
-  // cut the image size in half to reduce processing time
-  cv::resize( grey, half, cv::Size(grey.cols/2, grey.rows/2) );
+  // shrink the image to the working resolution to reduce processing time
+  // (a 640 pixel wide image is halved, as it always used to be, and larger ones are never shrunk further)
+  float scale = std::min( 1.0f, (float)FACE_DETECT_SIDE / std::max( grey.cols, grey.rows ) );
+  scale = std::max( scale, 1.0f / FACE_DETECT_MAX_SHRINK );
+  cv::resize( grey, small, cv::Size(grey.cols*scale, grey.rows*scale) );
 
-  // equalize the image
-  cv::equalizeHist( half, half );
+  // equalize the whole image, so that the search region sees the same values as before
+  cv::equalizeHist( small, small );
+
+  // the search region in the working image
+  cv::Rect roi( 0, 0, small.cols, small.rows );
+  if( search.area() > 0 ) {
+    int x0 = std::floor( search.x * scale );
+    int y0 = std::floor( search.y * scale );
+    int x1 = std::ceil( (search.x + search.width) * scale );
+    int y1 = std::ceil( (search.y + search.height) * scale );
+    roi &= cv::Rect( x0, y0, x1 - x0, y1 - y0 );
+    if( roi.area() == 0 )
+      return(0);
+  }
 
   // apply the Haar cascade detector
-  face_cascade.detectMultiScale( half, faces );
+  cv::Mat part = small( roi );
+  face_cascade.detectMultiScale( part, faces );
 
   // adjust the rectangle sizes back to the full size image
   for(int i=0;i<faces.size();i++) {
-    faces[i].x *= 2;
-    faces[i].y *= 2;
-    faces[i].width *= 2;
-    faces[i].height *= 2;
+    faces[i].x = cvRound( (faces[i].x + roi.x) / scale );
+    faces[i].y = cvRound( (faces[i].y + roi.y) / scale );
+    faces[i].width = cvRound( faces[i].width / scale );
+    faces[i].height = cvRound( faces[i].height / scale );
   }
 
   return(0);
 }
 
+/*
+  Skin tone prefilter for detectFaces
+
+  Looks at every 4th pixel of every 4th row of an HSV image and counts the skin-toned ones
+  (red to orange hue, moderate saturation, not too dark) in a 16x16 grid of cells.
+  The search region is the bounding box of the cells that are at least 20% skin,
+  padded by half its size (for the hair and the background around a face) and one cell.
+
+  Arguments:
+  cv::Mat hsv - HSV image (as computed by cv::cvtColor with COLOR_BGR2HSV)
+  cv::Rect &search - set to the part of the image where faces can be, the whole image if
+     the image has too little color to tell
+  Returns false if there are too few skin pixels for a face, in which case detection can be skipped
+ */
+bool findSkinRegion( cv::Mat &hsv, cv::Rect &search ) {
+  const int grid = 16;
+  const int step = 4;
+  int skin[grid][grid] = {{0}};
+  int total[grid][grid] = {{0}};
+  int nskin = 0, ncolor = 0, n = 0;
+
+  search = cv::Rect( 0, 0, hsv.cols, hsv.rows );
+
+  for(int i=0;i<hsv.rows;i+=step) {
+    cv::Vec3b *ptr = hsv.ptr<cv::Vec3b>(i);
+    int gy = i * grid / hsv.rows;
+    for(int j=0;j<hsv.cols;j+=step) {
+      int gx = j * grid / hsv.cols;
+      int h = ptr[j][0], s = ptr[j][1], v = ptr[j][2];
+      n++;
+      total[gy][gx]++;
+      if( s >= 40 )
+        ncolor++;
+      if( (h <= 25 || h >= 165) && s >= 40 && s <= 180 && v >= 60 ) {
+        nskin++;
+        skin[gy][gx]++;
+      }
+    }
+  }
+
+  // grayscale images have no skin tones, but may still have faces
+  if( n == 0 || ncolor < FACE_COLOR_MIN_FRACTION * n )
+    return(true);
+
+  if( nskin < FACE_SKIN_MIN_FRACTION * n )
+    return(false);
+
+  // bounding box of the cells with enough skin
+  int x0 = grid, y0 = grid, x1 = -1, y1 = -1;
+  for(int gy=0;gy<grid;gy++) {
+    for(int gx=0;gx<grid;gx++) {
+      if( total[gy][gx] > 0 && skin[gy][gx] * 5 >= total[gy][gx] ) {
+        x0 = std::min( x0, gx );
+        y0 = std::min( y0, gy );
+        x1 = std::max( x1, gx );
+        y1 = std::max( y1, gy );
+      }
+    }
+  }
+  // the skin pixels are scattered, search everywhere
+  if( x1 < 0 )
+    return(true);
+
+  int padx = (x1 - x0 + 1) / 2 + 1;
+  int pady = (y1 - y0 + 1) / 2 + 1;
+  x0 = std::max( 0, x0 - padx );
+  y0 = std::max( 0, y0 - pady );
+  x1 = std::min( grid, x1 + 1 + padx );
+  y1 = std::min( grid, y1 + 1 + pady );
+
+  // cell edges in pixels (matching the cell of each pixel above)
+  int left = (x0 * hsv.cols + grid - 1) / grid;
+  int top = (y0 * hsv.rows + grid - 1) / grid;
+  int right = (x1 * hsv.cols + grid - 1) / grid;
+  int bottom = (y1 * hsv.rows + grid - 1) / grid;
+  search = cv::Rect( left, top, right - left, bottom - top ) & cv::Rect( 0, 0, hsv.cols, hsv.rows );
+
+  return(true);
+}
+
 /* Draws rectangles into frame given a vector of rectangles
    
    Arguments:
@@ -11,8 +11,22 @@
 // put the path to the haar cascade file here
 #define FACE_CASCADE_FILE "./haarcascade_frontalface_alt2.xml"
 
+// longer side of the working image the detector runs on (larger images are shrunk to it, smaller ones are kept)
+#define FACE_DETECT_SIDE 320
+
+// the working image is never shrunk by more than this factor, so large images keep the smallest detectable
+// face size they always had (the detector used to halve every image)
+#define FACE_DETECT_MAX_SHRINK 2.0f
+
+// the detector is skipped when fewer than this fraction of the pixels have a skin tone
+#define FACE_SKIN_MIN_FRACTION 0.002f
+
+// images with fewer than this fraction of saturated pixels are too gray for the skin prefilter
+#define FACE_COLOR_MIN_FRACTION 0.05f
+
 // prototypes
-int detectFaces( cv::Mat &grey, std::vector<cv::Rect> &faces );
+int detectFaces( cv::Mat &grey, std::vector<cv::Rect> &faces, cv::Rect search = cv::Rect() );
+bool findSkinRegion( cv::Mat &hsv, cv::Rect &search );
 int drawBoxes( cv::Mat &frame, std::vector<cv::Rect> &faces, int minWidth = 50, float scale = 1.0  );
 
 #endif
@@ -0,0 +1,147 @@
+/*
+    Compares the face detections of the skin-tone prefiltered detector (detectFaces with findSkinRegion, as used by
+    extract_face_features) with the original detector, which halved every image and searched all of it
+
+    For every image of a directory it runs both and reports the images where they disagree on the presence of a
+    face or on the first face (the one the face features are computed from), together with the time each took.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "opencv2/opencv.hpp"
+#include "faceDetect.h"
+#include "corpus.hpp"
+
+// The detector as it was before the prefilter: half resolution, whole image
+static void detect_faces_original(cv::Mat &grey, std::vector<cv::Rect> &faces)
+{
+    static cv::CascadeClassifier face_cascade;
+    if (face_cascade.empty() && !face_cascade.load(FACE_CASCADE_FILE))
+    {
+        printf("Unable to load face cascade file\n");
+        exit(-1);
+    }
+
+    cv::Mat half;
+    cv::resize(grey, half, cv::Size(grey.cols / 2, grey.rows / 2));
+    cv::equalizeHist(half, half);
+    face_cascade.detectMultiScale(half, faces);
+    for (cv::Rect &face : faces)
+        face = cv::Rect(face.x * 2, face.y * 2, face.width * 2, face.height * 2);
+}
+
+// Intersection over union of two rectangles
+static float overlap(const cv::Rect &a, const cv::Rect &b)
+{
+    float inter = (a & b).area();
+    float uni = a.area() + b.area() - inter;
+    return uni > 0.0f ? inter / uni : 0.0f;
+}
+
+/*
+    Runs the original and the current face detector on every image of a directory and compares them
+
+    Argv:
+        - directory: directory of images
+        - [-r]: optional, also process the images in subdirectories
+        - [-iou t]: optional, overlap above which two first faces count as the same face (default 0.5)
+        - [-v]: optional, prints every image where the detectors disagree
+*/
+int main(int argc, char *argv[])
+{
+    bool recursive = false;
+    bool verbose = false;
+    float min_iou = 0.5f;
+
+    // check for sufficient arguments
+    if (argc < 2)
+    {
+        printf("usage: %s <directory> [-r] [-iou <t>] [-v]\n", argv[0]);
+        exit(-1);
+    }
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-r") == 0)
+            recursive = true;
+        else if (strcmp(argv[i], "-v") == 0)
+            verbose = true;
+        else if (strcmp(argv[i], "-iou") == 0 && i + 1 < argc)
+            min_iou = atof(argv[++i]);
+        else
+        {
+            printf("Unknown option %s\n", argv[i]);
+            exit(-1);
+        }
+    }
+
+    std::vector<std::string> paths;
+    if (walk_corpus(argv[1], recursive, std::thread::hardware_concurrency(), paths) != 0)
+    {
+        printf("Cannot open directory %s\n", argv[1]);
+        exit(-1);
+    }
+
+    int images = 0, skipped = 0, old_faces = 0, new_faces = 0, lost = 0, gained = 0, moved = 0;
+    double old_ms = 0.0, new_ms = 0.0;
+    for (const std::string &rel : paths)
+    {
+        if (!is_image_file(rel.c_str()))
+            continue;
+        std::string path = corpus_path(argv[1], rel);
+        cv::Mat src = cv::imread(path);
+        if (src.empty())
+            continue;
+        images++;
+
+        cv::Mat grey, hsv;
+        std::vector<cv::Rect> before, after;
+        cv::cvtColor(src, grey, cv::COLOR_BGR2GRAY);
+
+        auto start = std::chrono::steady_clock::now();
+        detect_faces_original(grey, before);
+        old_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        // the current path, as in extract_face_features
+        start = std::chrono::steady_clock::now();
+        cv::Rect search;
+        cv::cvtColor(src, hsv, cv::COLOR_BGR2HSV);
+        if (findSkinRegion(hsv, search))
+            detectFaces(grey, after, search);
+        else
+            skipped++;
+        new_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        old_faces += !before.empty();
+        new_faces += !after.empty();
+        const char *change = NULL;
+        if (!before.empty() && after.empty())
+        {
+            lost++;
+            change = "face lost";
+        }
+        else if (before.empty() && !after.empty())
+        {
+            gained++;
+            change = "face gained";
+        }
+        else if (!before.empty() && overlap(before[0], after[0]) < min_iou)
+        {
+            moved++;
+            change = "first face differs";
+        }
+        if (verbose && change)
+            printf("%s: %s (%zu faces before, %zu after)\n", path.c_str(), change, before.size(), after.size());
+    }
+
+    printf("%d images, %d skipped by the skin prefilter\n", images, skipped);
+    printf("Images with a face: %d original, %d current\n", old_faces, new_faces);
+    printf("Disagreements: %d faces lost, %d gained, %d first faces differ (%.2f%% of the images)\n", lost, gained, moved,
+           images > 0 ? 100.0 * (lost + gained + moved) / images : 0.0);
+    printf("Detection time: %.2f ms per image original, %.2f ms current\n", images > 0 ? old_ms / images : 0.0,
+           images > 0 ? new_ms / images : 0.0);
+
+    return (0);
+}
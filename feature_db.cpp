@@ -0,0 +1,239 @@
+/*
+    In-memory feature database loaded from a csv file written by readfiles
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "csv_util.h"
+#include "feature_db.hpp"
+#include "segment_store.hpp"
+
+FeatureDB::~FeatureDB()
+{
+    // the filenames are allocated by read_image_data_csv
+    for (char *name : filenames)
+        delete[] name;
+}
+
+// csv database and distance metric of each feature mode
+static const struct
+{
+    const char *mode;
+    const char *csv;
+    MetricType metric;
+} FEATURE_MODES[] = {
+    {"baseline", "features_baseline.csv", SSD},
+    {"hist", "features_histogram.csv", INTERSECTION},
+    {"hist2", "features_histogram_rgb.csv", INTERSECTION},
+    {"multihist", "features_multihistogram.csv", RGB_REGION_INTERSECTION},
+    {"sobel", "features_sobel_magnitude.csv", TWO_HIST_INTERSECTION},
+    {"hsv", "features_histogram_hsv.csv", TWO_HIST_INTERSECTION},
+    {"face", "features_histogram_face.csv", FACE},
+    {"dnn", "ResNet18_olym.csv", COSINE},
+    {"dnn_hsv", "features_dnn_hsv.csv", DNN_HSV},
+};
+
+// Finds the csv database and distance metric of a feature mode
+// Returns non-zero if the feature mode is unknown
+int feature_mode_db(const char *feature_mode, char *csv, MetricType &metric)
+{
+    for (auto &m : FEATURE_MODES)
+    {
+        if (strcmp(feature_mode, m.mode) == 0)
+        {
+            strcpy(csv, m.csv);
+            metric = m.metric;
+            // databases reduced with PCA (see pca_fit) are compared with ssd
+            char pca[1024];
+            if (read_image_data_header(csv, "pca", pca, sizeof(pca)) == 0)
+                metric = SSD;
+            return (0);
+        }
+    }
+    return (-1);
+}
+
+// Loads the feature database from a csv file, or from its segment store if it has one (see segment_store.hpp)
+// Returns non-zero if the file could not be read
+int load_feature_db(char *csv, FeatureDB &db)
+{
+    if (has_segment_store(csv))
+        return load_segment_db(csv, db);
+    return read_image_data_csv(csv, db.filenames, db.data);
+}
+
+// Finds the row of an image in the database
+// Returns the row index, or -1 if the image is not in the database
+int find_db_row(const FeatureDB &db, const char *filename)
+{
+    for (size_t i = 0; i < db.size(); i++)
+        if (strcmp(db.filenames[i], filename) == 0)
+            return (int)i;
+    return (-1);
+}
+
+// Finds where the images of a database live and the name an image has in it
+void db_image_name(char *csv, const char *img_filepath, std::string &root, std::string &name)
+{
+    char header[4096];
+    char real_root[PATH_MAX], real_img[PATH_MAX];
+    const char *slash = strrchr(img_filepath, '/');
+
+    // legacy databases: bare filenames in the directory of the query
+    name = slash ? slash + 1 : img_filepath;
+    root = slash ? std::string(img_filepath, slash - img_filepath) : ".";
+    if (read_image_data_header(csv, "root", header, sizeof(header)) != 0)
+        return;
+
+    // images under the root are named by their path relative to it, others (whose basename could belong to
+    // another image of the corpus) get an empty name, which is in no database
+    root = header;
+    name.clear();
+    if (realpath(header, real_root) != NULL && realpath(img_filepath, real_img) != NULL)
+    {
+        size_t len = strlen(real_root);
+        if (strncmp(real_img, real_root, len) == 0 && real_img[len] == '/')
+            name = real_img + len + 1;
+    }
+}
+
+// Precomputes the per-row suffix sums used to prune rows during a scan with the given metric
+// For cosine the first suffix value of each row is its squared norm, which gives the Cauchy-Schwarz bound
+void prepare_bounds(FeatureDB &db, MetricType metric)
+{
+    db.suffix.clear();
+    db.suffix_stride = 0;
+    db.suffix_metric = metric;
+    if (metric == SSD || db.data.empty())
+        return;
+
+    std::vector<float> row_suffix;
+    db.suffix_stride = db.data[0].size() / BOUND_BLOCK + 1;
+    db.suffix.resize(db.size() * db.suffix_stride, 0.0f);
+    for (size_t i = 0; i < db.size(); i++)
+    {
+        bound_suffix_sums(metric, db.data[i], row_suffix);
+        // rows of a different length are reported by the metric itself
+        size_t len = std::min(row_suffix.size(), (size_t)db.suffix_stride);
+        std::copy(row_suffix.begin(), row_suffix.begin() + len, db.suffix.begin() + i * db.suffix_stride);
+    }
+}
+
+// bounds sidecar format identifier
+static const char BOUNDS_MAGIC[] = "CBIRBND1";
+
+// Loads the suffix sums of a database from <csv>.bounds, or computes them from the loaded rows
+// and writes the sidecar if it is missing or was built from another version of the csv
+void load_bounds(char *csv, FeatureDB &db, MetricType metric)
+{
+    // ssd needs no suffix sums
+    if (metric == SSD || db.data.empty())
+    {
+        prepare_bounds(db, metric);
+        return;
+    }
+
+    std::string sidecar = std::string(csv) + ".bounds";
+    DBStamp stamp;
+    db_stamp(csv, stamp);
+    int stride = db.data[0].size() / BOUND_BLOCK + 1;
+
+    // try the cached sums first
+    FILE *fp = fopen(sidecar.c_str(), "rb");
+    if (fp)
+    {
+        int stored_metric, stored_stride;
+        long long rows;
+        if (read_sidecar_header(fp, BOUNDS_MAGIC, stamp) == 0 &&
+            fread(&stored_metric, sizeof(stored_metric), 1, fp) == 1 && stored_metric == metric &&
+            fread(&rows, sizeof(rows), 1, fp) == 1 && rows == (long long)db.size() &&
+            fread(&stored_stride, sizeof(stored_stride), 1, fp) == 1 && stored_stride == stride &&
+            (long long)db.size() * stride * (long long)sizeof(float) <= sidecar_remaining(fp))
+        {
+            db.suffix.resize(db.size() * stride);
+            if (fread(db.suffix.data(), sizeof(float), db.suffix.size(), fp) == db.suffix.size())
+            {
+                db.suffix_stride = stride;
+                db.suffix_metric = metric;
+                fclose(fp);
+                return;
+            }
+        }
+        fclose(fp);
+    }
+
+    prepare_bounds(db, metric);
+
+    // written to <csv>.bounds.new and renamed, as other processes may be reading the current sidecar
+    std::string staged = sidecar + ".new";
+    fp = fopen(staged.c_str(), "wb");
+    if (!fp)
+    {
+        printf("Unable to write %s\n", sidecar.c_str());
+        return;
+    }
+    int stored_metric = metric;
+    long long rows = db.size();
+    write_sidecar_header(fp, BOUNDS_MAGIC, stamp);
+    fwrite(&stored_metric, sizeof(stored_metric), 1, fp);
+    fwrite(&rows, sizeof(rows), 1, fp);
+    fwrite(&db.suffix_stride, sizeof(db.suffix_stride), 1, fp);
+    fwrite(db.suffix.data(), sizeof(float), db.suffix.size(), fp);
+    if (fclose(fp) != 0 || rename(staged.c_str(), sidecar.c_str()) != 0)
+    {
+        printf("Unable to write %s\n", sidecar.c_str());
+        remove(staged.c_str());
+    }
+}
+
+// Reads the stamp (size and modification time) of a csv database file
+// A database with a segment store is stamped by the store, so sidecars follow its writes
+// Returns non-zero if the file does not exist
+int db_stamp(const char *csv, DBStamp &stamp)
+{
+    struct stat st;
+    if (segment_store_stamp(csv, stamp) == 0)
+        return (0);
+    if (stat(csv, &st) != 0)
+        return (-1);
+    stamp.size = st.st_size;
+    stamp.mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    return (0);
+}
+
+// Writes the header of a binary sidecar file (8-byte magic string followed by the stamp of its database)
+void write_sidecar_header(FILE *fp, const char *magic, const DBStamp &stamp)
+{
+    fwrite(magic, 1, 8, fp);
+    fwrite(&stamp.size, sizeof(stamp.size), 1, fp);
+    fwrite(&stamp.mtime_ns, sizeof(stamp.mtime_ns), 1, fp);
+}
+
+// Reads and checks the header of a binary sidecar file
+// Returns non-zero if the format does not match or the sidecar was built from another version of the database
+int read_sidecar_header(FILE *fp, const char *magic, const DBStamp &stamp)
+{
+    char buf[8];
+    DBStamp stored;
+    if (fread(buf, 1, 8, fp) != 8 || memcmp(buf, magic, 8) != 0)
+        return (-1);
+    if (fread(&stored.size, sizeof(stored.size), 1, fp) != 1 || fread(&stored.mtime_ns, sizeof(stored.mtime_ns), 1, fp) != 1)
+        return (-1);
+    return stored == stamp ? 0 : -1;
+}
+
+// Number of bytes left to read in a file opened for binary reading
+long long sidecar_remaining(FILE *fp)
+{
+    struct stat st;
+    long pos = ftell(fp);
+    if (pos < 0 || fstat(fileno(fp), &st) != 0)
+        return 0;
+    return st.st_size - pos;
+}
@@ -0,0 +1,105 @@
+/*
+    In-memory feature database loaded from a csv file written by readfiles
+*/
+
+#ifndef FEATURE_DB_H
+#define FEATURE_DB_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "distance.hpp"
+
+// Identifies one version of a csv database file
+// Sidecar files derived from a database record its stamp and are rebuilt once the database changes
+struct DBStamp
+{
+    long long size = 0;     // file size in bytes
+    long long mtime_ns = 0; // modification time in nanoseconds
+
+    bool operator==(const DBStamp &other) const { return size == other.size && mtime_ns == other.mtime_ns; }
+};
+
+struct FeatureDB
+{
+    std::vector<char *> filenames;        // image filename of each row
+    std::vector<std::vector<float>> data; // feature vector of each row
+
+    // per-row suffix sums at every BOUND_BLOCK-th dimension, used for bound-based pruning (see prepare_bounds)
+    // row i starts at suffix[i * suffix_stride], the first value of each row is its total mass (or squared norm)
+    std::vector<float> suffix;
+    int suffix_stride = 0;
+    MetricType suffix_metric = SSD;
+
+    FeatureDB() = default;
+    FeatureDB(const FeatureDB &) = delete;
+    FeatureDB &operator=(const FeatureDB &) = delete;
+    ~FeatureDB();
+    size_t size() const { return data.size(); }
+    const float *row_suffix(size_t i) const { return suffix.data() + i * suffix_stride; }
+};
+
+// Finds the csv database and distance metric of a feature mode (baseline, hist, hist2, multihist, sobel, hsv, face, dnn, dnn_hsv)
+// Args: feature_mode - feature mode name
+//       csv          - char array to be filled with the csv filename
+//       metric       - set to the distance metric of the mode (ssd if the database was reduced with PCA)
+// Returns non-zero if the feature mode is unknown
+int feature_mode_db(const char *feature_mode, char *csv, MetricType &metric);
+
+// Loads the feature database from a csv file, or from its segment store if it has one (see segment_store.hpp)
+// Args: csv - csv database filename
+//       db  - database to be filled
+// Returns non-zero if the file could not be read
+int load_feature_db(char *csv, FeatureDB &db);
+
+// Finds the row of an image in the database
+// Args: db       - loaded database
+//       filename - image filename (without the directory, as written by readfiles)
+// Returns the row index, or -1 if the image is not in the database
+int find_db_row(const FeatureDB &db, const char *filename);
+
+// Finds where the images of a database live and the name an image has in it
+// Databases written with a "root" header store paths relative to that directory, older ones store bare filenames
+// of the images in the query's own directory. An image outside the root of a rooted database gets an empty name,
+// so it is never taken for the image of the same basename in the database
+// Args: csv          - csv database filename
+//       img_filepath - image file path
+//       root         - set to the directory holding the images of the database
+//       name         - set to the name of the image in the database
+void db_image_name(char *csv, const char *img_filepath, std::string &root, std::string &name);
+
+// Precomputes the per-row suffix sums and norms used to prune rows during a scan with the given metric
+// (nothing is stored for ssd, which only needs the running partial sum)
+// Args: db     - loaded database
+//       metric - distance metric the scan will use
+void prepare_bounds(FeatureDB &db, MetricType metric);
+
+// Loads the suffix sums of prepare_bounds from <csv>.bounds, or computes them from the loaded rows
+// and writes the sidecar if it is missing or was built from another version of the csv
+// Args: csv    - csv database filename
+//       db     - loaded database
+//       metric - distance metric the scan will use
+void load_bounds(char *csv, FeatureDB &db, MetricType metric);
+
+// Reads the stamp of a csv database file (of its segment store if it has one)
+// Returns non-zero if the file does not exist
+int db_stamp(const char *csv, DBStamp &stamp);
+
+// Writes the header of a binary sidecar file (8-byte magic string followed by the stamp of its database)
+// Args: fp    - sidecar file opened for binary writing
+//       magic - 8 character identifier of the sidecar format
+//       stamp - stamp of the database the sidecar was built from
+void write_sidecar_header(FILE *fp, const char *magic, const DBStamp &stamp);
+
+// Reads and checks the header of a binary sidecar file
+// Args: fp    - sidecar file opened for binary reading
+//       magic - expected 8 character identifier of the sidecar format
+//       stamp - stamp of the current database
+// Returns non-zero if the format does not match or the sidecar was built from another version of the database
+int read_sidecar_header(FILE *fp, const char *magic, const DBStamp &stamp);
+
+// Number of bytes left to read in a file opened for binary reading
+// Sidecar readers check the counts stored in a file against it before allocating anything for them
+long long sidecar_remaining(FILE *fp);
+
+#endif
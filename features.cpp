@@ -12,6 +12,8 @@
 #include "opencv2/opencv.hpp"
 #include "csv_util.h"
 #include "faceDetect.h"
+#include "features.hpp"
+#include "histogram.hpp"
 
 // Using the 7x7 square in the middle of the image, builds a feature vector of RGB colors (7x7 image x 3 channels)
 // Args: src     - cv::Mat image
@@ -46,50 +48,7 @@ void extract_baseline_features(cv::Mat &src, std::vector<float> &featVec)
 //       featVec - feature vector to be filled
 void extract_histogram_features(cv::Mat &src, std::vector<float> &featVec)
 {
-    const int histsize = 16;
-
-    cv::Mat hist = cv::Mat::zeros(cv::Size(histsize, histsize), CV_32FC1);
-
-    // loop over all pixels
-    for (int i = 0; i < src.rows; i++)
-    {
-        cv::Vec3b *ptr = src.ptr<cv::Vec3b>(i);
-        for (int j = 0; j < src.cols; j++)
-        {
-            // get RGB values
-            float B = ptr[j][0];
-            float G = ptr[j][1];
-            float R = ptr[j][2];
-
-            // compute the rg chromaticity
-            float divisor = R + G + B;
-            divisor = divisor > 0.0 ? divisor : 1.0; // check for divide-by-zero error
-            float r = R / divisor;
-            float g = G / divisor;
-
-            // compute the index for r and g
-            // r and g are in [0, 1]
-            int rindex = std::min((int)std::floor(r * histsize), histsize - 1);
-            int gindex = std::min((int)std::floor(g * histsize), histsize - 1);
-
-            // increment the histogram
-            hist.at<float>(rindex, gindex)++;
-        }
-    }
-
-    // normalize the histogram by the number of pixels
-    hist /= (float)(src.rows * src.cols); // divides all elements of a cv::Mat by the number of pixels
-
-    // convert the histogram image into a feature vector
-    for (int i = 0; i < histsize; i++)
-    {
-        float *ptr = hist.ptr<float>(i);
-        for (int j = 0; j < histsize; j++)
-        {
-            // flattens the 2D histogram image into a single vector containing floats
-            featVec.push_back(ptr[j]);
-        }
-    }
+    chromaticity_histogram<16>(src, featVec);
 }
 
 // Creates a 3D normalized RGB histogram from the src image (with 8 bins per color channel)
@@ -98,49 +57,7 @@ void extract_histogram_features(cv::Mat &src, std::vector<float> &featVec)
 //       featVec - feature vector to be filled
 void extract_histogram_rgb_features(cv::Mat &src, std::vector<float> &featVec)
 {
-    const int histsize = 8;
-    int size[] = {histsize, histsize, histsize};
-
-    cv::Mat hist = cv::Mat::zeros(3, size, CV_32FC1);
-
-    // loop over all pixels
-    for (int i = 0; i < src.rows; i++)
-    {
-        cv::Vec3b *ptr = src.ptr<cv::Vec3b>(i);
-        for (int j = 0; j < src.cols; j++)
-        {
-            // get RGB values
-            uchar B = ptr[j][0];
-            uchar G = ptr[j][1];
-            uchar R = ptr[j][2];
-
-            // quantize RGB values into histogram bins
-            int divisor = 256 / histsize;
-            // compute the index for r, g, and b
-            int rindex = R / divisor;
-            int gindex = G / divisor;
-            int bindex = B / divisor;
-
-            // increment the histogram
-            hist.at<float>(rindex, gindex, bindex)++;
-        }
-    }
-
-    // normalize the histogram by the number of pixels
-    hist /= (float)(src.rows * src.cols); // divides all elements of a cv::Mat by the number of pixels
-
-    // convert the histogram image into a feature vector
-    for (int i = 0; i < histsize; i++)
-    {
-        for (int j = 0; j < histsize; j++)
-        {
-            for (int k = 0; k < histsize; k++)
-            {
-                // flattens the 3D histogram image into a single vector containing floats
-                featVec.push_back(hist.at<float>(i, j, k));
-            }
-        }
-    }
+    color_histogram<8>(src, featVec);
 }
 
 // Helper method for the extract_histogram_hsv_features function
@@ -150,77 +67,7 @@ void extract_histogram_rgb_features(cv::Mat &src, std::vector<float> &featVec)
 //       featVec - feature vector to be filled
 void extract_hsv_features(cv::Mat &src, std::vector<float> &featVec)
 {
-    const int histsize = 16;
-
-    float hist[histsize][histsize] = {0};
-    float black_bin = 0;
-    float gray_bin = 0;
-
-    // loop over all pixels
-    for (int i = 0; i < src.rows; i++)
-    {
-        cv::Vec3b *ptr = src.ptr<cv::Vec3b>(i);
-        for (int j = 0; j < src.cols; j++)
-        {
-            // get HSV values
-            float H = ptr[j][0];
-            float S = ptr[j][1];
-            float V = ptr[j][2];
-
-            // normalize s and v values between 0 and 1
-            float s_norm = S / 255.0f;
-            float v_norm = V / 255.0f;
-
-            // take out dark and pale pixels into separate bins to avoid confusing the histogram
-            // instead of trying to assign hue value to a dark pixel, take it out and count them separately
-            if (v_norm < 0.2f)
-            {
-                black_bin += 1.0f; // count dark pixels
-            }
-            else if (s_norm < 0.2f)
-            {
-                gray_bin += 1.0f; // count gray/white pixels
-            }
-            else
-            {
-                // actual valid color
-                // compute the index for h and s
-                int hindex = (int)(H / (180.0f / histsize));
-                int sindex = (int)(S / (256.0f / histsize));
-                // clamp values to (histsize - 1)
-                if (hindex >= histsize)
-                    hindex = histsize - 1;
-                if (sindex >= histsize)
-                    sindex = histsize - 1;
-                // add the normalized saturation value to the histogram
-                hist[hindex][sindex] += s_norm;
-            }
-        }
-    }
-
-    // calculate the total sum of all bins to be used for histogram normalization
-    float total_weight = black_bin + gray_bin;
-    for (int i = 0; i < histsize; i++)
-    {
-        for (int j = 0; j < histsize; j++)
-        {
-            total_weight += hist[i][j];
-        }
-    }
-
-    // convert the histogram into a feature vector  of size 258 (16x16 histogram + black bin + gray bin)
-    for (int i = 0; i < histsize; i++)
-    {
-        for (int j = 0; j < histsize; j++)
-        {
-            // flattens the 2D histogram into a single vector containing floats
-            // normalize the values by the total
-            featVec.push_back(hist[i][j] / total_weight);
-        }
-    }
-    // append the black and gray bins to the end
-    featVec.push_back(black_bin / total_weight);
-    featVec.push_back(gray_bin / total_weight);
+    hue_saturation_histogram<16, 16>(src, featVec);
 }
 
 // Creates a 2D normalized hs chromaticity histogram from the src image (with 16 bins per color channel)
@@ -228,11 +75,15 @@ void extract_hsv_features(cv::Mat &src, std::vector<float> &featVec)
 // Builds a feature vector from the histograms ((16x16+2) x 2 histograms)
 // Args: src     - cv::Mat image
 //       featVec - feature vector to be filled
-void extract_histogram_hsv_features(cv::Mat &src, std::vector<float> &featVec)
+//       extract - hue-saturation extractor used instead of the 16x16 one (see histogram_extractor)
+void extract_histogram_hsv_features(cv::Mat &src, std::vector<float> &featVec, HistogramExtractor extract)
 {
+    if (extract == nullptr)
+        extract = extract_hsv_features;
+
     cv::Mat hsvImage;
     cv::cvtColor(src, hsvImage, cv::COLOR_BGR2HSV); // creates new HSV image
-    extract_hsv_features(hsvImage, featVec);
+    extract(hsvImage, featVec);
 
     // // top half
     // cv::Rect topRect(0, 0, hsvImage.cols, hsvImage.rows / 2);
@@ -250,11 +101,12 @@ void extract_histogram_hsv_features(cv::Mat &src, std::vector<float> &featVec)
     // define a rectangle in the center as the feature (1/2 of image sidelength)
     cv::Rect centerRect(cx - hsvImage.cols / 4, cy - hsvImage.rows / 4, hsvImage.cols / 2, hsvImage.rows / 2);
     cv::Mat center = hsvImage(centerRect);
-    extract_hsv_features(center, featVec);
+    extract(center, featVec);
 }
 
 // Creates a 2D normalized hs chromaticity histogram from the src image (with 16 bins per color channel)
 // Adds another histogram of just the center piece of the image or the face (if the image contains a face)
+// Images without skin tones skip the face detector (see findSkinRegion)
 // Builds a feature vector from the histograms ((16x16 + 1 flag to indicate face presence) x 2 histograms)
 // Args: src     - cv::Mat image
 //       featVec - feature vector to be filled
@@ -267,10 +119,15 @@ void extract_face_features(cv::Mat &src, std::vector<float> &featVec)
     cv::Mat gray;                // grayscale frame used for face detection
     std::vector<cv::Rect> faces; // used for face detection (vector of detected faces to be filled)
     cv::Rect face;
-    // convert the image to grayscale
-    cv::cvtColor(src, gray, cv::COLOR_BGR2GRAY, 0);
+    cv::Rect search; // part of the image with skin tones
 
-    detectFaces(gray, faces); // find all faces in the image
+    // the detector only runs on images with skin tones, and only around them
+    if (findSkinRegion(hsvImage, search))
+    {
+        // convert the image to grayscale
+        cv::cvtColor(src, gray, cv::COLOR_BGR2GRAY, 0);
+        detectFaces(gray, faces, search); // find all faces in the image
+    }
 
     if (faces.size() > 0)
     {
@@ -299,6 +156,154 @@ void extract_face_features(cv::Mat &src, std::vector<float> &featVec)
     }
 }
 
+// Creates normalized 3D RGB histograms (with 8 bins per color channel) for several regions of the src image in a single pass
+// The image is cut into cells along every region edge so that each cell lies either fully inside or fully outside each region
+// Each pixel's bin is computed once and added to the histogram of every region containing its cell
+// Builds a feature vector from the histograms (8x8x8 x number of regions, in the order of regions)
+// Args: src     - cv::Mat image
+//       regions - rectangles within the image to build histograms for
+//       featVec - feature vector to be filled
+void extract_region_rgb_features(cv::Mat &src, std::vector<cv::Rect> &regions, std::vector<float> &featVec)
+{
+    const int histsize = 8;
+    const int nbins = histsize * histsize * histsize;
+
+    // collect the cell boundaries from the region edges
+    std::vector<int> xs = {0, src.cols};
+    std::vector<int> ys = {0, src.rows};
+    for (cv::Rect &r : regions)
+    {
+        xs.push_back(std::clamp(r.x, 0, src.cols));
+        xs.push_back(std::clamp(r.x + r.width, 0, src.cols));
+        ys.push_back(std::clamp(r.y, 0, src.rows));
+        ys.push_back(std::clamp(r.y + r.height, 0, src.rows));
+    }
+    std::sort(xs.begin(), xs.end());
+    xs.erase(std::unique(xs.begin(), xs.end()), xs.end());
+    std::sort(ys.begin(), ys.end());
+    ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+
+    // list the regions containing each cell (a cell is inside a region if its top-left corner is)
+    int ncellx = xs.size() - 1;
+    int ncelly = ys.size() - 1;
+    std::vector<std::vector<int>> cell_regions(ncellx * ncelly);
+    for (int cy = 0; cy < ncelly; cy++)
+    {
+        for (int cx = 0; cx < ncellx; cx++)
+        {
+            for (int k = 0; k < (int)regions.size(); k++)
+            {
+                cv::Rect &r = regions[k];
+                if (xs[cx] >= r.x && xs[cx] < r.x + r.width && ys[cy] >= r.y && ys[cy] < r.y + r.height)
+                    cell_regions[cy * ncellx + cx].push_back(k);
+            }
+        }
+    }
+
+    // integer pixel counts for every region, laid out one histogram after another
+    std::vector<int> hist(regions.size() * nbins, 0);
+
+    // loop over all pixels once (in parallel bands of rows for large images)
+    count_rows(src, hist, [&](int i, int *h)
+               {
+                   // row of cells containing image row i
+                   int cy = std::upper_bound(ys.begin(), ys.end(), i) - ys.begin() - 1;
+                   cv::Vec3b *ptr = src.ptr<cv::Vec3b>(i);
+                   for (int cx = 0; cx < ncellx; cx++)
+                   {
+                       std::vector<int> &cell = cell_regions[cy * ncellx + cx];
+                       if (cell.empty())
+                           continue; // pixels outside every region are skipped
+                       for (int j = xs[cx]; j < xs[cx + 1]; j++)
+                       {
+                           // compute the flat (r, g, b) bin index of the pixel
+                           int bin = color_bin<histsize>(ptr[j]);
+                           // add the pixel to every region that contains it
+                           for (int k : cell)
+                               h[k * nbins + bin]++;
+                       }
+                   }
+               });
+
+    // normalize each histogram by the number of pixels in its region and append it to the feature vector
+    for (int k = 0; k < (int)regions.size(); k++)
+    {
+        cv::Rect r = regions[k] & cv::Rect(0, 0, src.cols, src.rows);
+        float area = r.area() > 0 ? (float)r.area() : 1.0f;
+        for (int b = 0; b < nbins; b++)
+        {
+            featVec.push_back(hist[k * nbins + b] / area);
+        }
+    }
+}
+
+// Builds the list of histogram regions for a region layout
+// Layouts: "legacy"      - whole image, top half, bottom half and center (the original multihist regions)
+//          "CxR+CxR+..." - spatial pyramid of grids with C columns and R rows each, e.g. "1x1+2x2+4x4"
+// Args: layout  - region layout string
+//       cols    - image width
+//       rows    - image height
+//       regions - vector of rectangles to be filled
+// Returns non-zero if the layout string is invalid
+int region_layout_rects(const char *layout, int cols, int rows, std::vector<cv::Rect> &regions)
+{
+    if (strcmp(layout, "legacy") == 0)
+    {
+        // entire image
+        regions.push_back(cv::Rect(0, 0, cols, rows));
+        // top half
+        regions.push_back(cv::Rect(0, 0, cols, rows / 2));
+        // bottom half
+        regions.push_back(cv::Rect(0, rows / 2, cols, rows / 2));
+        // rectangle in the center (1/2 of image sidelength)
+        regions.push_back(cv::Rect(cols / 2 - cols / 4, rows / 2 - rows / 4, cols / 2, rows / 2));
+        return (0);
+    }
+
+    // parse each "CxR" grid of the pyramid
+    const char *p = layout;
+    while (*p)
+    {
+        int gx, gy, n;
+        if (sscanf(p, "%dx%d%n", &gx, &gy, &n) != 2 || gx < 1 || gy < 1)
+            return (-1);
+        p += n;
+        if (*p == '+')
+            p++;
+        else if (*p != '\0')
+            return (-1);
+
+        for (int r = 0; r < gy; r++)
+        {
+            for (int c = 0; c < gx; c++)
+            {
+                int x0 = c * cols / gx;
+                int y0 = r * rows / gy;
+                regions.push_back(cv::Rect(x0, y0, (c + 1) * cols / gx - x0, (r + 1) * rows / gy - y0));
+            }
+        }
+    }
+
+    return regions.empty() ? -1 : 0;
+}
+
+// Creates normalized 3D RGB histograms (with 8 bins per color channel) for every region of a region layout
+// All regions are accumulated in a single pass over the image (see extract_region_rgb_features)
+// Builds a feature vector from the histograms (8x8x8 x number of regions)
+// Args: src     - cv::Mat image
+//       layout  - region layout string (see region_layout_rects)
+//       featVec - feature vector to be filled
+void extract_multihist_features(cv::Mat &src, const char *layout, std::vector<float> &featVec)
+{
+    std::vector<cv::Rect> regions;
+    if (region_layout_rects(layout, src.cols, src.rows, regions) != 0)
+    {
+        printf("Invalid region layout %s\n", layout);
+        exit(-1);
+    }
+    extract_region_rgb_features(src, regions, featVec);
+}
+
 // Creates a 3D normalized RGB histogram from the src image (with 8 bins per color channel)
 // Adds 3 more 3D normalized RGB histograms for the top and bottom halves and the center of the image
 // Builds a feature vector from the histograms (8x8x8 x 4 histograms)
@@ -306,29 +311,11 @@ void extract_face_features(cv::Mat &src, std::vector<float> &featVec)
 //       featVec - feature vector to be filled
 void extract_multihist_features(cv::Mat &src, std::vector<float> &featVec)
 {
-    // histogram of entire image
-    extract_histogram_rgb_features(src, featVec);
-
-    // top half
-    cv::Rect topRect(0, 0, src.cols, src.rows / 2);
-    cv::Mat top = src(topRect);
-    extract_histogram_rgb_features(top, featVec);
-
-    // bottom half
-    cv::Rect botRect(0, src.rows / 2, src.cols, src.rows / 2);
-    cv::Mat bot = src(botRect);
-    extract_histogram_rgb_features(bot, featVec);
-
-    // find the center of image
-    int cx = src.cols / 2;
-    int cy = src.rows / 2;
-    // define a rectangle in the center as the feature (1/2 of image sidelength)
-    cv::Rect centerRect(cx - src.cols / 4, cy - src.rows / 4, src.cols / 2, src.rows / 2);
-    cv::Mat center = src(centerRect);
-    extract_histogram_rgb_features(center, featVec);
+    extract_multihist_features(src, MULTIHIST_DEFAULT_LAYOUT, featVec);
 }
 
 // 3x3 Sobel X filter as separable 1x3 filters (detects vertical edges)
+// Large images are filtered in parallel bands of rows, the second pass starting once the whole temp image is done
 // Args: color src image     Return: 16-bit signed short dst image
 int sobelX3x3(cv::Mat &src, cv::Mat &dst)
 {
@@ -340,50 +327,57 @@ int sobelX3x3(cv::Mat &src, cv::Mat &dst)
     dst = cv::Mat::zeros(src.size(), CV_16SC3);
 
     // first pass (horizontal filter)
-    for (int i = 0; i < dst.rows; i++)
-    {
-        cv::Vec3b *srcPtr = src.ptr<cv::Vec3b>(i);   // gets the row pointer from the src image
-        cv::Vec3s *tempPtr = temp.ptr<cv::Vec3s>(i); // gets the row pointer from the temp image
-        for (int j = 1; j < dst.cols - 1; j++)
-        {
-            // loop over RGB color channels
-            for (int k = 0; k < 3; k++)
-            {
-                // sum of the horizontally neighboring pixel values from the original src image
-                // multiply the left pixel by -1 and the right pixel by 1 (middle pixel is already 0)
-                // filterX = {-1, 0, 1}
-                tempPtr[j][k] = -1 * srcPtr[j - 1][k] + srcPtr[j + 1][k]; // update the temp image
-            }
-        }
-    }
+    for_each_band(dst, [&](int, int first, int end)
+                  {
+                      for (int i = first; i < end; i++)
+                      {
+                          cv::Vec3b *srcPtr = src.ptr<cv::Vec3b>(i);   // gets the row pointer from the src image
+                          cv::Vec3s *tempPtr = temp.ptr<cv::Vec3s>(i); // gets the row pointer from the temp image
+                          for (int j = 1; j < dst.cols - 1; j++)
+                          {
+                              // loop over RGB color channels
+                              for (int k = 0; k < 3; k++)
+                              {
+                                  // sum of the horizontally neighboring pixel values from the original src image
+                                  // multiply the left pixel by -1 and the right pixel by 1 (middle pixel is already 0)
+                                  // filterX = {-1, 0, 1}
+                                  tempPtr[j][k] = -1 * srcPtr[j - 1][k] + srcPtr[j + 1][k]; // update the temp image
+                              }
+                          }
+                      }
+                  });
 
     // vertical part of Sobel X filter
     int filterY[3] = {1, 2, 1};
     // second pass (vertical filter) using the generated temp image
-    for (int i = 1; i < dst.rows - 1; i++)
-    {
-        // gets the 3 row pointers from the temp image
-        cv::Vec3s *p1 = temp.ptr<cv::Vec3s>(i - 1);
-        cv::Vec3s *p2 = temp.ptr<cv::Vec3s>(i);
-        cv::Vec3s *p3 = temp.ptr<cv::Vec3s>(i + 1);
-
-        cv::Vec3s *dstPtr = dst.ptr<cv::Vec3s>(i);
-        for (int j = 0; j < dst.cols; j++)
-        {
-            // loop over RGB color channels
-            for (int k = 0; k < 3; k++)
-            {
-                // sum of the vertically neighboring pixel values from each of the 3 rows in the temp image (multiplied by filterY)
-                // divide by the sum of values in the blur vector to normalize and multiply by 2 to make the edges brighter
-                dstPtr[j][k] = (p1[j][k] * filterY[0] + p2[j][k] * filterY[1] + p3[j][k] * filterY[2]) / 2;
-            }
-        }
-    }
+    for_each_band(dst, [&](int, int first, int end)
+                  {
+                      for (int i = std::max(1, first); i < std::min(dst.rows - 1, end); i++)
+                      {
+                          // gets the 3 row pointers from the temp image
+                          cv::Vec3s *p1 = temp.ptr<cv::Vec3s>(i - 1);
+                          cv::Vec3s *p2 = temp.ptr<cv::Vec3s>(i);
+                          cv::Vec3s *p3 = temp.ptr<cv::Vec3s>(i + 1);
+
+                          cv::Vec3s *dstPtr = dst.ptr<cv::Vec3s>(i);
+                          for (int j = 0; j < dst.cols; j++)
+                          {
+                              // loop over RGB color channels
+                              for (int k = 0; k < 3; k++)
+                              {
+                                  // sum of the vertically neighboring pixel values from each of the 3 rows in the temp image (multiplied by filterY)
+                                  // divide by the sum of values in the blur vector to normalize and multiply by 2 to make the edges brighter
+                                  dstPtr[j][k] = (p1[j][k] * filterY[0] + p2[j][k] * filterY[1] + p3[j][k] * filterY[2]) / 2;
+                              }
+                          }
+                      }
+                  });
 
     return (0);
 }
 
 // 3x3 Sobel Y filter as separable 1x3 filters (detects horizontal edges)
+// Large images are filtered in parallel bands of rows like sobelX3x3
 // Args: color src image     Return: 16-bit signed short dst image
 int sobelY3x3(cv::Mat &src, cv::Mat &dst)
 {
@@ -398,44 +392,50 @@ int sobelY3x3(cv::Mat &src, cv::Mat &dst)
     int filterX[3] = {1, 2, 1};
 
     // first pass (horizontal filter)
-    for (int i = 0; i < dst.rows; i++)
-    {
-        cv::Vec3b *srcPtr = src.ptr<cv::Vec3b>(i);   // gets the row pointer from the src image
-        cv::Vec3s *tempPtr = temp.ptr<cv::Vec3s>(i); // gets the row pointer from the temp image
-        for (int j = 1; j < dst.cols - 1; j++)
-        {
-            // loop over RGB color channels
-            for (int k = 0; k < 3; k++)
-            {
-                // sum of the horizontally neighboring pixel values from the original src image (multiplied by filterX)
-                // divide by the sum of values in the blur vector to normalize
-                tempPtr[j][k] = (srcPtr[j - 1][k] * filterX[0] + srcPtr[j][k] * filterX[1] + srcPtr[j + 1][k] * filterX[2]) / 4;
-            }
-        }
-    }
+    for_each_band(dst, [&](int, int first, int end)
+                  {
+                      for (int i = first; i < end; i++)
+                      {
+                          cv::Vec3b *srcPtr = src.ptr<cv::Vec3b>(i);   // gets the row pointer from the src image
+                          cv::Vec3s *tempPtr = temp.ptr<cv::Vec3s>(i); // gets the row pointer from the temp image
+                          for (int j = 1; j < dst.cols - 1; j++)
+                          {
+                              // loop over RGB color channels
+                              for (int k = 0; k < 3; k++)
+                              {
+                                  // sum of the horizontally neighboring pixel values from the original src image (multiplied by filterX)
+                                  // divide by the sum of values in the blur vector to normalize
+                                  tempPtr[j][k] = (srcPtr[j - 1][k] * filterX[0] + srcPtr[j][k] * filterX[1] + srcPtr[j + 1][k] * filterX[2]) / 4;
+                              }
+                          }
+                      }
+                  });
 
     // vertical part of Sobel Y filter
     int filterY[3] = {1, 0, -1};
     // second pass (vertical filter) using the generated temp image
-    for (int i = 1; i < dst.rows - 1; i++)
-    {
-        // gets the 3 row pointers from the temp image
-        cv::Vec3s *p1 = temp.ptr<cv::Vec3s>(i - 1);
-        cv::Vec3s *p2 = temp.ptr<cv::Vec3s>(i);
-        cv::Vec3s *p3 = temp.ptr<cv::Vec3s>(i + 1);
-
-        cv::Vec3s *dstPtr = dst.ptr<cv::Vec3s>(i);
-        for (int j = 0; j < dst.cols; j++)
-        {
-            // loop over RGB color channels
-            for (int k = 0; k < 3; k++)
-            {
-                // sum of the vertically neighboring pixel values from each of the 3 rows in the temp image (multiplied by filterY)
-                // multiply by 2 to make the edges brighter
-                dstPtr[j][k] = (p1[j][k] * filterY[0] + p2[j][k] * filterY[1] + p3[j][k] * filterY[2]) * 2;
-            }
-        }
-    }
+    for_each_band(dst, [&](int, int first, int end)
+                  {
+                      for (int i = std::max(1, first); i < std::min(dst.rows - 1, end); i++)
+                      {
+                          // gets the 3 row pointers from the temp image
+                          cv::Vec3s *p1 = temp.ptr<cv::Vec3s>(i - 1);
+                          cv::Vec3s *p2 = temp.ptr<cv::Vec3s>(i);
+                          cv::Vec3s *p3 = temp.ptr<cv::Vec3s>(i + 1);
+
+                          cv::Vec3s *dstPtr = dst.ptr<cv::Vec3s>(i);
+                          for (int j = 0; j < dst.cols; j++)
+                          {
+                              // loop over RGB color channels
+                              for (int k = 0; k < 3; k++)
+                              {
+                                  // sum of the vertically neighboring pixel values from each of the 3 rows in the temp image (multiplied by filterY)
+                                  // multiply by 2 to make the edges brighter
+                                  dstPtr[j][k] = (p1[j][k] * filterY[0] + p2[j][k] * filterY[1] + p3[j][k] * filterY[2]) * 2;
+                              }
+                          }
+                      }
+                  });
 
     return (0);
 }
@@ -445,22 +445,25 @@ int sobelY3x3(cv::Mat &src, cv::Mat &dst)
 int magnitude(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst)
 {
     dst.create(sx.size(), CV_8UC3);
-    for (int i = 0; i < dst.rows; i++)
-    {
-        cv::Vec3s *sxPtr = sx.ptr<cv::Vec3s>(i); // row pointer for sx image
-        cv::Vec3s *syPtr = sy.ptr<cv::Vec3s>(i); // row pointer for sy image
-        cv::Vec3b *ptr = dst.ptr<cv::Vec3b>(i);  // row pointer for dst image
-        for (int j = 0; j < dst.cols; j++)
-        {
-            for (int k = 0; k < 3; k++)
-            {
-                int val = std::sqrt(sxPtr[j][k] * sxPtr[j][k] + syPtr[j][k] * syPtr[j][k]);
-                if (val > 255)
-                    val = 255; // clamp the values to 255
-                ptr[j][k] = (uchar)val;
-            }
-        }
-    }
+    for_each_band(dst, [&](int, int first, int end)
+                  {
+                      for (int i = first; i < end; i++)
+                      {
+                          cv::Vec3s *sxPtr = sx.ptr<cv::Vec3s>(i); // row pointer for sx image
+                          cv::Vec3s *syPtr = sy.ptr<cv::Vec3s>(i); // row pointer for sy image
+                          cv::Vec3b *ptr = dst.ptr<cv::Vec3b>(i);  // row pointer for dst image
+                          for (int j = 0; j < dst.cols; j++)
+                          {
+                              for (int k = 0; k < 3; k++)
+                              {
+                                  int val = std::sqrt(sxPtr[j][k] * sxPtr[j][k] + syPtr[j][k] * syPtr[j][k]);
+                                  if (val > 255)
+                                      val = 255; // clamp the values to 255
+                                  ptr[j][k] = (uchar)val;
+                              }
+                          }
+                      }
+                  });
 
     return (0);
 }
@@ -483,6 +486,113 @@ void extract_sobel_features(cv::Mat &src, std::vector<float> &featVec)
     extract_histogram_rgb_features(mag, featVec);
 }
 
+// Computes a 64-bit perceptual hash (DCT hash) and a 64-bit difference hash of the src image
+// pHash: DCT of the 32x32 grayscale image, one bit per coefficient of the 8x8 lowest frequencies
+//        (set if the coefficient is above the median of the 63 AC coefficients)
+// dHash: 9x8 grayscale image, one bit per pixel pair (set if a pixel is brighter than its right neighbour)
+// Args: src   - cv::Mat image
+//       phash - set to the perceptual hash
+//       dhash - set to the difference hash
+void extract_phash_features(cv::Mat &src, uint64_t &phash, uint64_t &dhash)
+{
+    cv::Mat gray, small, dct;
+    cv::cvtColor(src, gray, cv::COLOR_BGR2GRAY);
+
+    // perceptual hash from the low frequencies of the DCT
+    cv::resize(gray, small, cv::Size(32, 32), 0, 0, cv::INTER_AREA);
+    small.convertTo(small, CV_32F);
+    cv::dct(small, dct);
+
+    float coeffs[64];
+    for (int i = 0; i < 8; i++)
+    {
+        float *ptr = dct.ptr<float>(i);
+        for (int j = 0; j < 8; j++)
+        {
+            coeffs[i * 8 + j] = ptr[j];
+        }
+    }
+    // median of the AC coefficients (the DC term only reflects the average brightness)
+    float ac[63];
+    std::copy(coeffs + 1, coeffs + 64, ac);
+    std::nth_element(ac, ac + 31, ac + 63);
+    float median = ac[31];
+
+    phash = 0;
+    for (int i = 0; i < 64; i++)
+    {
+        if (coeffs[i] > median)
+            phash |= (uint64_t)1 << i;
+    }
+
+    // difference hash from the horizontal gradient of a 9x8 thumbnail
+    cv::resize(gray, small, cv::Size(9, 8), 0, 0, cv::INTER_AREA);
+    dhash = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        uchar *ptr = small.ptr<uchar>(i);
+        for (int j = 0; j < 8; j++)
+        {
+            if (ptr[j] > ptr[j + 1])
+                dhash |= (uint64_t)1 << (i * 8 + j);
+        }
+    }
+}
+
+// histogram configurations instantiated for experiments (the feature modes use rg16, rgb8 and hs16 by default)
+static const struct
+{
+    const char *name;
+    const char *mode; // feature mode whose histogram the configuration replaces
+    HistogramExtractor extract;
+} HISTOGRAM_CONFIGS[] = {
+    {"rg8", "hist", chromaticity_histogram<8>},
+    {"rg16", "hist", chromaticity_histogram<16>},
+    {"rg32", "hist", chromaticity_histogram<32>},
+    {"rgb4", "hist2", color_histogram<4>},
+    {"rgb8", "hist2", color_histogram<8>},
+    {"rgb16", "hist2", color_histogram<16>},
+    {"hs8", "hsv", hue_saturation_histogram<8, 8>},
+    {"hs16", "hsv", hue_saturation_histogram<16, 16>},
+    {"hs18x8", "hsv", hue_saturation_histogram<18, 8>},
+};
+
+// Finds a histogram extractor by configuration name
+// Returns nullptr if the configuration is not instantiated
+HistogramExtractor histogram_extractor(const char *config)
+{
+    for (auto &c : HISTOGRAM_CONFIGS)
+    {
+        if (strcmp(config, c.name) == 0)
+            return c.extract;
+    }
+    return nullptr;
+}
+
+// Returns the feature mode whose histogram a configuration replaces, or nullptr if it is not instantiated
+const char *histogram_config_mode(const char *config)
+{
+    for (auto &c : HISTOGRAM_CONFIGS)
+    {
+        if (strcmp(config, c.name) == 0)
+            return c.mode;
+    }
+    return nullptr;
+}
+
+// Builds the feature vector of a histogram feature mode with one of the configurations instead of the mode's default
+// Args: src     - cv::Mat image
+//       config  - configuration name (see histogram_extractor)
+//       featVec - feature vector to be filled
+void extract_histogram_config_features(cv::Mat &src, const char *config, std::vector<float> &featVec)
+{
+    HistogramExtractor extract = histogram_extractor(config);
+    if (strcmp(histogram_config_mode(config), "hsv") == 0)
+        extract_histogram_hsv_features(src, featVec, extract);
+    else
+        extract(src, featVec);
+}
+
 // Append the DNN embeddings to the existing feature vector by matching the filenames
 // Finds the feature vector with the same filename as the current image and appends its DNN embeddings to the vector
 // Args: featVec   - feature vector to be filled
@@ -8,6 +8,8 @@
 #ifndef FEATURES_H
 #define FEATURES_H
 
+#include <cstdint>
+
 // Using the 7x7 square in the middle of the image, builds a feature vector of RGB colors (7x7 image x 3 channels)
 // Args: src     - cv::Mat image
 //       featVec - feature vector to be filled
@@ -25,23 +27,47 @@ void extract_histogram_features(cv::Mat &src, std::vector<float> &featVec);
 //       featVec - feature vector to be filled
 void extract_histogram_rgb_features(cv::Mat &src, std::vector<float> &featVec);
 
+// Histogram extractor appending a normalized histogram of the src image to featVec
+typedef void (*HistogramExtractor)(cv::Mat &src, std::vector<float> &featVec);
+
 // Creates a 2D normalized hs chromaticity histogram from the src image (with 16 bins per color channel)
 // Adds another histogram of just the center piece of the image
 // Builds a feature vector from the histograms (16x16 x 2 histograms)
 // Args: src     - cv::Mat image
 //       featVec - feature vector to be filled
-void extract_histogram_hsv_features(cv::Mat &src, std::vector<float> &featVec);
+//       extract - hue-saturation extractor used instead of the 16x16 one (see histogram_extractor)
+void extract_histogram_hsv_features(cv::Mat &src, std::vector<float> &featVec, HistogramExtractor extract = nullptr);
 
-// Creates normalized histograms (RGB whole image and top and bottom rectangle histograms)
-// from the src image (with 8 bins per color channel)
-// Builds a feature vector from the histogram (8x8x8 x 2 histograms)
+// region layout used by multihist when the DB header does not name one
+#define MULTIHIST_DEFAULT_LAYOUT "legacy"
+
+// Creates normalized 3D RGB histograms (with 8 bins per color channel) for several regions of the src image in a single pass
+// Builds a feature vector from the histograms (8x8x8 x number of regions, in the order of regions)
 // Args: src     - cv::Mat image
+//       regions - rectangles within the image to build histograms for
 //       featVec - feature vector to be filled
-void extract_multihist_features(cv::Mat &src, std::vector<float> &featVec);
+void extract_region_rgb_features(cv::Mat &src, std::vector<cv::Rect> &regions, std::vector<float> &featVec);
+
+// Builds the list of histogram regions for a region layout
+// Layouts: "legacy"      - whole image, top half, bottom half and center (the original multihist regions)
+//          "CxR+CxR+..." - spatial pyramid of grids with C columns and R rows each, e.g. "1x1+2x2+4x4"
+// Args: layout  - region layout string
+//       cols    - image width
+//       rows    - image height
+//       regions - vector of rectangles to be filled
+// Returns non-zero if the layout string is invalid
+int region_layout_rects(const char *layout, int cols, int rows, std::vector<cv::Rect> &regions);
+
+// Creates normalized 3D RGB histograms (with 8 bins per color channel) for every region of a region layout
+// Builds a feature vector from the histograms (8x8x8 x number of regions)
+// Args: src     - cv::Mat image
+//       layout  - region layout string (see region_layout_rects)
+//       featVec - feature vector to be filled
+void extract_multihist_features(cv::Mat &src, const char *layout, std::vector<float> &featVec);
 
 // Creates a 3D normalized RGB histogram from the src image (with 8 bins per color channel)
-// Adds another 3D normalized RGB histogram for the top and bottom halves of the image
-// Builds a feature vector from the histograms (8x8x8 x 3 histograms)
+// Adds 3 more 3D normalized RGB histograms for the top and bottom halves and the center of the image
+// Builds a feature vector from the histograms (8x8x8 x 4 histograms)
 // Args: src     - cv::Mat image
 //       featVec - feature vector to be filled
 void extract_multihist_features(cv::Mat &src, std::vector<float> &featVec);
@@ -60,6 +86,30 @@ void extract_sobel_features(cv::Mat &src, std::vector<float> &featVec);
 //       featVec - feature vector to be filled
 void extract_face_features(cv::Mat &src, std::vector<float> &featVec);
 
+// Computes a 64-bit perceptual hash (DCT hash) and a 64-bit difference hash of the src image
+// pHash: one bit per coefficient of the 8x8 lowest DCT frequencies of the 32x32 grayscale image (above the median or not)
+// dHash: one bit per pixel pair of the 9x8 grayscale image (brighter than its right neighbour or not)
+// Args: src   - cv::Mat image
+//       phash - set to the perceptual hash
+//       dhash - set to the difference hash
+void extract_phash_features(cv::Mat &src, uint64_t &phash, uint64_t &dhash);
+
+// Finds one of the compile-time specialized histogram extractors (see histogram.hpp) by configuration name
+// Configurations: rg8, rg16, rg32 (rg chromaticity), rgb4, rgb8, rgb16 (RGB), hs8, hs16, hs18x8 (hue-saturation of an HSV image)
+// Args: config - configuration name, e.g. "rgb16"
+// Returns nullptr if the configuration is not instantiated
+HistogramExtractor histogram_extractor(const char *config);
+
+// Returns the feature mode whose histogram a configuration replaces (hist, hist2 or hsv), or nullptr if it is not instantiated
+const char *histogram_config_mode(const char *config);
+
+// Builds the feature vector of a histogram feature mode with one of the configurations instead of the mode's default
+// hsv configurations keep the layout of the hsv mode (whole image and center piece)
+// Args: src     - cv::Mat image
+//       config  - configuration name (see histogram_extractor)
+//       featVec - feature vector to be filled
+void extract_histogram_config_features(cv::Mat &src, const char *config, std::vector<float> &featVec);
+
 // Append the DNN embeddings to the existing feature vector by matching the filenames
 // Finds the feature vector with the same filename as the current image and appends its DNN embeddings to the vector
 // Args: featVec   - feature vector to be filled
@@ -0,0 +1,223 @@
+/*
+    Late fusion of several feature databases
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <unordered_map>
+#include "feature_db.hpp"
+#include "fusion.hpp"
+
+// Returns true if a comparison method is a fusion spec (mode:weight pairs) rather than a single mode
+bool is_fusion_spec(const char *spec)
+{
+    return strchr(spec, ':') != NULL || strchr(spec, ',') != NULL;
+}
+
+// Parses a fusion spec such as dnn:0.6,hsv:0.3,sobel:0.1 (a mode without a weight gets 1)
+// Returns non-zero if a mode is unknown, a weight is not positive or a mode is repeated
+int parse_fusion_spec(const char *spec, std::vector<FusionPart> &parts)
+{
+    parts.clear();
+    for (const char *p = spec; *p;)
+    {
+        const char *end = strchr(p, ',');
+        std::string item = end ? std::string(p, end - p) : std::string(p);
+        size_t colon = item.find(':');
+
+        FusionPart part;
+        char csv[256];
+        part.mode = item.substr(0, colon);
+        part.weight = colon == std::string::npos ? 1.0f : atof(item.c_str() + colon + 1);
+        if (feature_mode_db(part.mode.c_str(), csv, part.metric) != 0)
+        {
+            printf("Invalid comparison method %s in %s\n", part.mode.c_str(), spec);
+            return (-1);
+        }
+        if (part.weight <= 0.0f)
+        {
+            printf("Invalid weight for %s in %s\n", part.mode.c_str(), spec);
+            return (-1);
+        }
+        for (FusionPart &other : parts)
+        {
+            if (other.mode == part.mode)
+            {
+                printf("%s appears twice in %s\n", part.mode.c_str(), spec);
+                return (-1);
+            }
+        }
+        part.csv = csv;
+        parts.push_back(part);
+
+        if (end == NULL)
+            break;
+        p = end + 1;
+    }
+    return parts.empty() ? -1 : 0;
+}
+
+// Estimates the mean and standard deviation of the distances of a mode from a fixed set of row pairs
+static void fit_distance_stats(FusionDB &db, int part)
+{
+    std::mt19937 rng(part + 1);
+    double sum = 0.0, sum_sq = 0.0;
+    int pairs = 0;
+    for (int p = 0; p < FUSION_NORM_PAIRS && db.size() > 1; p++)
+    {
+        size_t a = rng() % db.size(), b = rng() % db.size();
+        if (a == b)
+            continue;
+        double d = apply_metric(db.parts[part].metric, db.data[a][part], db.data[b][part]);
+        sum += d;
+        sum_sq += d * d;
+        pairs++;
+    }
+    FusionPart &fp = db.parts[part];
+    fp.mean = pairs > 0 ? sum / pairs : 0.0;
+    double var = pairs > 0 ? sum_sq / pairs - (double)fp.mean * fp.mean : 0.0;
+    fp.stddev = var > 1e-12 ? std::sqrt(var) : 1.0;
+}
+
+// Loads the databases of the modes and joins them by image filename, rows missing from any mode are left out
+// Returns non-zero if a database cannot be read
+int load_fusion_db(FusionDB &db)
+{
+    int nparts = db.parts.size();
+    db.filenames.clear();
+    db.data.clear();
+
+    for (int part = 0; part < nparts; part++)
+    {
+        FeatureDB mode_db;
+        if (load_feature_db(db.parts[part].csv.data(), mode_db) != 0)
+        {
+            printf("Cannot read %s\n", db.parts[part].csv.c_str());
+            return (-1);
+        }
+
+        // the first mode sets the rows and their order
+        if (part == 0)
+        {
+            for (size_t i = 0; i < mode_db.size(); i++)
+            {
+                db.filenames.push_back(mode_db.filenames[i]);
+                db.data.push_back(std::vector<std::vector<float>>(nparts));
+                db.data.back()[0].swap(mode_db.data[i]);
+            }
+            continue;
+        }
+
+        // the other modes are joined by filename
+        std::unordered_map<std::string, int> rows;
+        for (size_t i = 0; i < mode_db.size(); i++)
+            rows.emplace(mode_db.filenames[i], i);
+        for (size_t r = 0; r < db.size(); r++)
+        {
+            auto it = rows.find(db.filenames[r]);
+            if (it != rows.end())
+                db.data[r][part].swap(mode_db.data[it->second]);
+        }
+    }
+
+    // leave out the rows that are missing from a mode
+    size_t kept = 0;
+    for (size_t r = 0; r < db.size(); r++)
+    {
+        bool complete = true;
+        for (auto &vec : db.data[r])
+            complete = complete && !vec.empty();
+        if (!complete)
+            continue;
+        if (kept != r)
+        {
+            db.filenames[kept].swap(db.filenames[r]);
+            db.data[kept].swap(db.data[r]);
+        }
+        kept++;
+    }
+    if (kept < db.size())
+        printf("Left out %zu images missing from some of the databases\n", db.size() - kept);
+    db.filenames.resize(kept);
+    db.data.resize(kept);
+
+    for (int part = 0; part < nparts; part++)
+    {
+        fit_distance_stats(db, part);
+        printf("%s: weight %.3f, %s, distance mean %.4f, deviation %.4f\n", db.parts[part].mode.c_str(), db.parts[part].weight,
+               db.parts[part].csv.c_str(), db.parts[part].mean, db.parts[part].stddev);
+    }
+    return (0);
+}
+
+// Finds the row of an image in the fusion database, or -1 if it is not in it
+int find_fusion_row(FusionDB &db, const char *filename)
+{
+    for (size_t r = 0; r < db.size(); r++)
+        if (db.filenames[r] == filename)
+            return (int)r;
+    return (-1);
+}
+
+/*
+    Scores every row against the query with every mode in one pass and returns the K best fused matches
+*/
+void fusion_topk(FusionDB &db, std::vector<std::vector<float>> &query, FusionMethod method, int K,
+                 std::vector<std::pair<float, int>> &results, ScanStats &stats)
+{
+    int nparts = db.parts.size();
+    size_t n = db.size();
+
+    if (method != FUSION_RANK)
+    {
+        TopK top(K, true);
+        for (size_t r = 0; r < n; r++)
+        {
+            float fused = 0.0f;
+            for (int part = 0; part < nparts; part++)
+            {
+                FusionPart &fp = db.parts[part];
+                float dist = apply_metric(fp.metric, query[part], db.data[r][part]);
+                if (method == FUSION_ZSUM)
+                    dist = (dist - fp.mean) / fp.stddev;
+                fused += fp.weight * dist;
+            }
+            stats.rows++;
+            top.push(fused, r);
+        }
+        top.sorted(results);
+        return;
+    }
+
+    // rank fusion needs the rank of every row in every mode: score all modes in one pass, then rank them
+    std::vector<float> dists(n * nparts);
+    for (size_t r = 0; r < n; r++)
+    {
+        for (int part = 0; part < nparts; part++)
+            dists[r * nparts + part] = apply_metric(db.parts[part].metric, query[part], db.data[r][part]);
+        stats.rows++;
+    }
+
+    std::vector<float> scores(n, 0.0f);
+    std::vector<int> order(n);
+    for (int part = 0; part < nparts; part++)
+    {
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](int a, int b)
+                  {
+                      float dist_a = dists[(size_t)a * nparts + part], dist_b = dists[(size_t)b * nparts + part];
+                      return dist_a != dist_b ? dist_a < dist_b : a < b; });
+        for (size_t rank = 0; rank < n; rank++)
+            scores[order[rank]] += db.parts[part].weight / (FUSION_RRF_K + rank + 1);
+    }
+
+    TopK top(K, false);
+    for (size_t r = 0; r < n; r++)
+        top.push(scores[r], r);
+    top.sorted(results);
+}
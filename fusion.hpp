@@ -0,0 +1,91 @@
+/*
+    Late fusion of several feature databases
+
+    A fusion spec such as dnn:0.6,hsv:0.3,sobel:0.1 names existing feature modes and their weights. Their csv
+    databases are joined by image filename once at load, so each row holds the vectors of every mode, and a
+    query scores all the modes of a row in a single pass with their own metrics. The distances are combined by:
+        - sum: weighted sum of the raw distances (as the dnn_hsv metric does)
+        - zsum: weighted sum of the distances normalized per mode to zero mean and unit deviation, estimated
+          from a sample of row pairs at load, so modes with different distance ranges weigh as intended
+        - rank: weighted reciprocal rank fusion, sum of weight / (FUSION_RRF_K + rank) over the modes
+    New combinations can be tried without extracting or indexing anything again.
+*/
+
+#ifndef FUSION_H
+#define FUSION_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "distance.hpp"
+#include "scan.hpp"
+
+// rank offset of reciprocal rank fusion (damps the influence of the very first ranks)
+#define FUSION_RRF_K 60
+
+// number of row pairs the per-mode distance statistics are estimated from
+#define FUSION_NORM_PAIRS 2000
+
+// how the distances of the modes are combined
+enum FusionMethod
+{
+    FUSION_SUM,  // weighted sum of the raw distances
+    FUSION_ZSUM, // weighted sum of the normalized distances
+    FUSION_RANK  // weighted reciprocal rank fusion
+};
+
+// one mode of a fusion
+struct FusionPart
+{
+    std::string mode;
+    std::string csv;
+    MetricType metric = SSD;
+    float weight = 1.0f;
+    float mean = 0.0f;   // mean distance between rows (see FUSION_ZSUM)
+    float stddev = 1.0f; // standard deviation of the distances between rows
+};
+
+// databases of the modes joined by image filename
+struct FusionDB
+{
+    std::vector<FusionPart> parts;
+    std::vector<std::string> filenames;                // image filename of each row (in the order of the first mode)
+    std::vector<std::vector<std::vector<float>>> data; // data[row][part] is the feature vector of a mode
+
+    size_t size() const { return filenames.size(); }
+};
+
+// Returns true if a comparison method is a fusion spec (mode:weight pairs) rather than a single mode
+bool is_fusion_spec(const char *spec);
+
+// Parses a fusion spec such as dnn:0.6,hsv:0.3,sobel:0.1 (a mode without a weight gets 1)
+// Args: spec  - comma separated mode:weight pairs
+//       parts - vector to be filled with the modes, their csv databases and metrics
+// Returns non-zero if a mode is unknown, a weight is not positive or a mode is repeated
+int parse_fusion_spec(const char *spec, std::vector<FusionPart> &parts);
+
+// Loads the databases of the modes and joins them by image filename, rows missing from any mode are left out
+// Also estimates the distance statistics of each mode from FUSION_NORM_PAIRS row pairs
+// Args: db - fusion database whose parts are set (see parse_fusion_spec)
+// Returns non-zero if a database cannot be read
+int load_fusion_db(FusionDB &db);
+
+// Finds the row of an image in the fusion database, or -1 if it is not in it
+int find_fusion_row(FusionDB &db, const char *filename);
+
+/*
+    Scores every row against the query with every mode in one pass and returns the K best fused matches
+
+    Args:
+        - db: fusion database
+        - query: feature vector of the query for each mode
+        - method: how the distances of the modes are combined
+        - K: number of matches to keep
+        - results: vector of (score, row) pairs to be filled, best first (distances for sum and zsum, where
+                   smaller is better, fused reciprocal ranks for rank, where larger is better)
+        - stats: scan counters to be filled
+*/
+void fusion_topk(FusionDB &db, std::vector<std::vector<float>> &query, FusionMethod method, int K,
+                 std::vector<std::pair<float, int>> &results, ScanStats &stats);
+
+#endif
@@ -0,0 +1,238 @@
+/*
+    Multi-index hashing over 64-bit perceptual hashes
+
+    File layout of <csv>.mih (after the sidecar header):
+        int64 rows, int64 blob size
+        uint64 phash[rows], uint64 dhash[rows]
+        MIH_TABLES x (uint32 offsets[65537], uint32 ids[rows]) - rows bucketed by each 16-bit substring
+        uint64 name_offsets[rows]
+        char blob[] - 0-terminated filenames
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "csv_util.h"
+#include "feature_db.hpp"
+#include "hash_index.hpp"
+
+// sidecar format identifier
+static const char MIH_MAGIC[] = "CBIRMIH1";
+
+// number of buckets per table
+static const int MIH_BUCKETS = 1 << 16;
+
+// Returns the 16-bit substring of a hash used by table t
+static inline uint32_t substring(uint64_t hash, int t)
+{
+    return (hash >> (16 * t)) & 0xffff;
+}
+
+HashIndex::~HashIndex()
+{
+    if (map)
+        munmap(map, map_size);
+}
+
+// Builds <csv>.mih from the hash csv
+// Returns non-zero if the csv cannot be read or the index cannot be written
+int HashIndex::build(char *csv, const char *path)
+{
+    std::vector<char *> filenames;
+    std::vector<std::vector<uint64_t>> hashes;
+    DBStamp stamp;
+
+    if (db_stamp(csv, stamp) != 0 || read_image_hash_csv(csv, filenames, hashes) != 0)
+        return (-1);
+
+    printf("Building hash index %s\n", path);
+    long long n = filenames.size();
+    std::vector<uint64_t> ph(n), dh(n), name_offs(n);
+    long long blob_size = 0;
+    for (long long i = 0; i < n; i++)
+    {
+        ph[i] = hashes[i].size() > 0 ? hashes[i][0] : 0;
+        dh[i] = hashes[i].size() > 1 ? hashes[i][1] : 0;
+        name_offs[i] = blob_size;
+        blob_size += strlen(filenames[i]) + 1;
+    }
+
+    // written to <path>.new and renamed over path, as other processes may have the old index mapped
+    std::string staged = std::string(path) + ".new";
+    FILE *fp = fopen(staged.c_str(), "wb");
+    if (!fp)
+    {
+        printf("Unable to open output file %s\n", staged.c_str());
+        return (-1);
+    }
+    write_sidecar_header(fp, MIH_MAGIC, stamp);
+    fwrite(&n, sizeof(n), 1, fp);
+    fwrite(&blob_size, sizeof(blob_size), 1, fp);
+    fwrite(ph.data(), sizeof(uint64_t), n, fp);
+    fwrite(dh.data(), sizeof(uint64_t), n, fp);
+
+    // counting sort of the rows by each substring
+    std::vector<uint32_t> offs(MIH_BUCKETS + 1), ids(n);
+    for (int t = 0; t < MIH_TABLES; t++)
+    {
+        std::fill(offs.begin(), offs.end(), 0);
+        for (long long i = 0; i < n; i++)
+            offs[substring(ph[i], t) + 1]++;
+        for (int b = 0; b < MIH_BUCKETS; b++)
+            offs[b + 1] += offs[b];
+        std::vector<uint32_t> pos(offs.begin(), offs.end() - 1);
+        for (long long i = 0; i < n; i++)
+            ids[pos[substring(ph[i], t)]++] = i;
+        fwrite(offs.data(), sizeof(uint32_t), offs.size(), fp);
+        fwrite(ids.data(), sizeof(uint32_t), n, fp);
+    }
+
+    fwrite(name_offs.data(), sizeof(uint64_t), n, fp);
+    for (long long i = 0; i < n; i++)
+    {
+        fwrite(filenames[i], 1, strlen(filenames[i]) + 1, fp);
+        delete[] filenames[i];
+    }
+    if (fclose(fp) != 0 || rename(staged.c_str(), path) != 0)
+    {
+        printf("Unable to write %s\n", path);
+        remove(staged.c_str());
+        return (-1);
+    }
+
+    return (0);
+}
+
+// Maps <csv>.mih, building it from the hash csv first if it is missing or stale
+// Returns non-zero if the database cannot be read
+int HashIndex::open(char *csv)
+{
+    char path[512];
+    DBStamp stamp;
+    snprintf(path, sizeof(path), "%s.mih", csv);
+    if (db_stamp(csv, stamp) != 0)
+        return (-1);
+
+    // rebuild the index if it does not match the current csv
+    FILE *fp = fopen(path, "rb");
+    bool fresh = fp && read_sidecar_header(fp, MIH_MAGIC, stamp) == 0;
+    if (fp)
+        fclose(fp);
+    if (!fresh && build(csv, path) != 0)
+        return (-1);
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return (-1);
+
+    // the header is 8 bytes of magic and a 16 byte stamp, followed by the row count and blob size
+    struct stat st;
+    long long n = -1, blob_size = -1;
+    if (fstat(fd, &st) != 0 || pread(fd, &n, sizeof(n), 24) != sizeof(n) ||
+        pread(fd, &blob_size, sizeof(blob_size), 32) != sizeof(blob_size))
+        n = -1;
+
+    // the file must hold every section the counts describe
+    long long max_rows = st.st_size / (3 * sizeof(uint64_t) + MIH_TABLES * sizeof(uint32_t));
+    if (n < 0 || n > max_rows || n > UINT32_MAX || blob_size < 0 || blob_size > st.st_size ||
+        40 + n * (3 * sizeof(uint64_t) + MIH_TABLES * sizeof(uint32_t)) +
+                MIH_TABLES * (MIH_BUCKETS + 1) * (long long)sizeof(uint32_t) + blob_size > st.st_size)
+    {
+        printf("Corrupt hash index %s\n", path);
+        close(fd);
+        return (-1);
+    }
+    map_size = st.st_size;
+    map = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        map = nullptr;
+        return (-1);
+    }
+
+    // locate the sections
+    const char *p = (const char *)map + 40;
+    rows = n;
+    phashes = (const uint64_t *)p;
+    p += n * sizeof(uint64_t);
+    dhashes = (const uint64_t *)p;
+    p += n * sizeof(uint64_t);
+    for (int t = 0; t < MIH_TABLES; t++)
+    {
+        offsets[t] = (const uint32_t *)p;
+        p += (MIH_BUCKETS + 1) * sizeof(uint32_t);
+        ids[t] = (const uint32_t *)p;
+        p += n * sizeof(uint32_t);
+    }
+    name_offsets = (const uint64_t *)p;
+    p += n * sizeof(uint64_t);
+    blob = p;
+
+    // each table must end at the row count and the last filename must be terminated
+    // (only these are checked, so opening the index does not touch every page of it)
+    bool valid = n == 0 || (blob_size > 0 && blob[blob_size - 1] == '\0');
+    for (int t = 0; t < MIH_TABLES && valid; t++)
+        valid = offsets[t][MIH_BUCKETS] == n;
+    if (!valid)
+    {
+        printf("Corrupt hash index %s\n", path);
+        munmap(map, map_size);
+        map = nullptr;
+        rows = 0;
+        return (-1);
+    }
+
+    return (0);
+}
+
+// Calls visit for every 16-bit key within Hamming distance r of key (flipping bits from position start upwards)
+template <typename F>
+static void for_each_key_within(uint32_t key, int r, int start, F &visit)
+{
+    visit(key);
+    if (r == 0)
+        return;
+    for (int b = start; b < 16; b++)
+        for_each_key_within(key ^ (1u << b), r - 1, b + 1, visit);
+}
+
+// Finds every row whose pHash is within radius of the query hash
+// By the pigeonhole principle each match is within radius / MIH_TABLES bits of the query on at least one substring
+void HashIndex::query(uint64_t phash, int radius, std::vector<int> &result, long &candidates) const
+{
+    std::vector<uint32_t> cand;
+    int sub_radius = radius / MIH_TABLES;
+
+    // open only checks the ends of the tables, so a bucket or id of a damaged index can point past the rows
+    for (int t = 0; t < MIH_TABLES; t++)
+    {
+        auto visit = [&](uint32_t key)
+        {
+            uint32_t end = std::min(offsets[t][key + 1], (uint32_t)rows);
+            for (uint32_t k = offsets[t][key]; k < end; k++)
+            {
+                if (ids[t][k] < rows)
+                    cand.push_back(ids[t][k]);
+            }
+        };
+        for_each_key_within(substring(phash, t), sub_radius, 0, visit);
+    }
+
+    // a row can be found through several substrings
+    std::sort(cand.begin(), cand.end());
+    cand.erase(std::unique(cand.begin(), cand.end()), cand.end());
+    candidates = cand.size();
+
+    result.clear();
+    for (uint32_t row : cand)
+    {
+        if (hamming(phashes[row], phash) <= radius)
+            result.push_back(row);
+    }
+}
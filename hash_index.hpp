@@ -0,0 +1,67 @@
+/*
+    Multi-index hashing over 64-bit perceptual hashes
+
+    The 64-bit pHash is split into 4 substrings of 16 bits with one lookup table each. Two hashes within
+    Hamming distance d agree to within d / 4 bits on at least one substring, so a range query only has
+    to probe the buckets near the query's substrings instead of scanning the whole database.
+    The tables are stored next to the hash database in <csv>.mih and memory-mapped, so a query only
+    touches the buckets it probes.
+*/
+
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// number of 16-bit substrings (and lookup tables) of the 64-bit hash
+#define MIH_TABLES 4
+
+// default Hamming radius of a near-duplicate query
+#define PHASH_RADIUS 8
+
+// Hamming distance between 2 64-bit hashes
+inline int hamming(uint64_t a, uint64_t b)
+{
+    return std::popcount(a ^ b);
+}
+
+class HashIndex
+{
+public:
+    ~HashIndex();
+
+    // Maps <csv>.mih, building it from the hash csv first if it is missing or stale
+    // Args: csv - hash database written by readfiles (features_phash.csv)
+    // Returns non-zero if the database cannot be read
+    int open(char *csv);
+
+    // Finds every row whose pHash is within radius of the query hash
+    // Args: phash      - query hash
+    //       radius     - maximum Hamming distance
+    //       rows       - vector to be filled with the matching rows
+    //       candidates - set to the number of distinct rows checked
+    void query(uint64_t phash, int radius, std::vector<int> &rows, long &candidates) const;
+
+    size_t size() const { return rows; }
+    uint64_t phash(int row) const { return phashes[row]; }
+    uint64_t dhash(int row) const { return dhashes[row]; }
+    const char *filename(int row) const { return blob + name_offsets[row]; }
+
+private:
+    int build(char *csv, const char *path);
+
+    void *map = nullptr;
+    size_t map_size = 0;
+    size_t rows = 0;
+    const uint64_t *phashes = nullptr;
+    const uint64_t *dhashes = nullptr;
+    const uint32_t *offsets[MIH_TABLES] = {}; // start of each bucket in ids (65537 values per table)
+    const uint32_t *ids[MIH_TABLES] = {};     // rows ordered by bucket
+    const uint64_t *name_offsets = nullptr;
+    const char *blob = nullptr;
+};
+
+#endif
@@ -0,0 +1,237 @@
+/*
+    Color histogram kernels specialized at compile time on the number of bins and the channel layout
+
+    The bin counts are template parameters, so the quantization divisions become shifts or constant
+    multiplications, the flat bin indices are computed without cv::Mat::at and the small loops unroll.
+    Trying another bin count is an instantiation (see histogram_extractor in features.hpp).
+
+    Large images (scans, panoramas) are cut into bands of rows that are counted on the OpenCV thread pool.
+    Every band fills its own integer partial histogram and the partials are summed before normalizing,
+    so the result does not depend on the number of bands and matches the serial path exactly.
+    The one exception is hue_saturation_histogram: it keeps the original float accumulation of the
+    saturation weights below TILED_EXTRACT_PIXELS, and sums them as integers only for tiled images,
+    so its values for large images can differ from the serial float sums in the last bits.
+*/
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "opencv2/opencv.hpp"
+
+// images with at least this many pixels are processed in parallel bands of rows
+#define TILED_EXTRACT_PIXELS (4 << 20)
+
+// number of rows in a band
+#define TILED_BAND_ROWS 128
+
+// Number of bands an image is processed in (1 below the size threshold)
+inline int row_bands(const cv::Mat &src)
+{
+    if ((long long)src.rows * src.cols < TILED_EXTRACT_PIXELS)
+        return 1;
+    return (src.rows + TILED_BAND_ROWS - 1) / TILED_BAND_ROWS;
+}
+
+// Calls fn(band, first_row, end_row) for every band of an image, in parallel when there are several
+template <typename BandFn>
+void for_each_band(const cv::Mat &src, BandFn fn)
+{
+    int nbands = row_bands(src);
+    if (nbands == 1)
+    {
+        fn(0, 0, src.rows);
+        return;
+    }
+    cv::parallel_for_(cv::Range(0, nbands), [&](const cv::Range &range)
+                      {
+                          for (int b = range.start; b < range.end; b++)
+                              fn(b, b * TILED_BAND_ROWS, std::min(src.rows, (b + 1) * TILED_BAND_ROWS));
+                      });
+}
+
+// Accumulates integer counts over all rows of an image, count_row(i, counts) adding row i to counts
+// In the tiled path every band counts into a partial histogram and the partials are summed in band order
+template <typename Count, typename RowFn>
+void count_rows(const cv::Mat &src, std::vector<Count> &counts, RowFn count_row)
+{
+    int nbands = row_bands(src);
+    if (nbands == 1)
+    {
+        for (int i = 0; i < src.rows; i++)
+            count_row(i, counts.data());
+        return;
+    }
+
+    std::vector<std::vector<Count>> partial(nbands);
+    for_each_band(src, [&](int b, int first, int end)
+                  {
+                      partial[b].assign(counts.size(), 0);
+                      for (int i = first; i < end; i++)
+                          count_row(i, partial[b].data());
+                  });
+    for (std::vector<Count> &p : partial)
+        for (size_t k = 0; k < counts.size(); k++)
+            counts[k] += p[k];
+}
+
+// Flat 3D color bin of a pixel, channels C0, C1 and C2 from the most to the least significant index
+// (the default order r, g, b of a BGR image matches the original RGB histograms)
+template <int Bins, int C0 = 2, int C1 = 1, int C2 = 0>
+inline int color_bin(const cv::Vec3b &px)
+{
+    static_assert(Bins > 0 && Bins <= 256 && (256 % Bins) == 0, "bins must divide 256");
+    constexpr int divisor = 256 / Bins;
+    return ((px[C0] / divisor) * Bins + px[C1] / divisor) * Bins + px[C2] / divisor;
+}
+
+// Normalized 3D color histogram of a 3 channel 8-bit image (Bins^3 values appended to featVec)
+template <int Bins, int C0 = 2, int C1 = 1, int C2 = 0>
+void color_histogram(cv::Mat &src, std::vector<float> &featVec)
+{
+    constexpr int nbins = Bins * Bins * Bins;
+    std::vector<uint32_t> hist(nbins, 0);
+
+    count_rows(src, hist, [&](int i, uint32_t *h)
+               {
+                   const cv::Vec3b *ptr = src.ptr<cv::Vec3b>(i);
+                   for (int j = 0; j < src.cols; j++)
+                       h[color_bin<Bins, C0, C1, C2>(ptr[j])]++;
+               });
+
+    // normalize the histogram by the number of pixels
+    float npixels = (float)(src.rows * src.cols);
+    for (int b = 0; b < nbins; b++)
+        featVec.push_back(hist[b] / npixels);
+}
+
+// Normalized 2D rg chromaticity histogram of a BGR image (Bins^2 values appended to featVec)
+template <int Bins>
+void chromaticity_histogram(cv::Mat &src, std::vector<float> &featVec)
+{
+    std::vector<uint32_t> hist(Bins * Bins, 0);
+
+    count_rows(src, hist, [&](int i, uint32_t *h)
+               {
+                   const cv::Vec3b *ptr = src.ptr<cv::Vec3b>(i);
+                   for (int j = 0; j < src.cols; j++)
+                   {
+                       float B = ptr[j][0];
+                       float G = ptr[j][1];
+                       float R = ptr[j][2];
+
+                       // r and g are in [0, 1]
+                       float divisor = R + G + B;
+                       divisor = divisor > 0.0f ? divisor : 1.0f; // check for divide-by-zero error
+                       int rindex = std::min((int)std::floor(R / divisor * Bins), Bins - 1);
+                       int gindex = std::min((int)std::floor(G / divisor * Bins), Bins - 1);
+                       h[rindex * Bins + gindex]++;
+                   }
+               });
+
+    float npixels = (float)(src.rows * src.cols);
+    for (int b = 0; b < Bins * Bins; b++)
+        featVec.push_back(hist[b] / npixels);
+}
+
+// Saturation-weighted 2D hue-saturation histogram of an HSV image with separate black and gray bins
+// (HBins x SBins values, then the black and gray bins, appended to featVec and normalized by their total)
+// Images below TILED_EXTRACT_PIXELS accumulate the normalized saturations as floats, which keeps their
+// histograms bit-identical to those already stored in the databases. Tiled images sum the saturations
+// as integers and scale them to [0, 1] at the end, so the bands can be reduced exactly
+template <int HBins, int SBins>
+void hue_saturation_histogram(cv::Mat &src, std::vector<float> &featVec)
+{
+    constexpr float hwidth = 180.0f / HBins;
+    constexpr float swidth = 256.0f / SBins;
+    constexpr int nbins = HBins * SBins;
+
+    if (row_bands(src) == 1)
+    {
+        float hist[nbins] = {0};
+        float black_bin = 0;
+        float gray_bin = 0;
+
+        for (int i = 0; i < src.rows; i++)
+        {
+            const cv::Vec3b *ptr = src.ptr<cv::Vec3b>(i);
+            for (int j = 0; j < src.cols; j++)
+            {
+                float H = ptr[j][0];
+                float S = ptr[j][1];
+                float s_norm = S / 255.0f;
+                float v_norm = ptr[j][2] / 255.0f;
+
+                // dark and pale pixels are counted separately instead of being assigned a hue
+                if (v_norm < 0.2f)
+                    black_bin += 1.0f;
+                else if (s_norm < 0.2f)
+                    gray_bin += 1.0f;
+                else
+                {
+                    int hindex = std::min((int)(H / hwidth), HBins - 1);
+                    int sindex = std::min((int)(S / swidth), SBins - 1);
+                    hist[hindex * SBins + sindex] += s_norm;
+                }
+            }
+        }
+
+        float total_weight = black_bin + gray_bin;
+        for (float h : hist)
+            total_weight += h;
+
+        for (float h : hist)
+            featVec.push_back(h / total_weight);
+        featVec.push_back(black_bin / total_weight);
+        featVec.push_back(gray_bin / total_weight);
+        return;
+    }
+
+    constexpr int black = nbins;    // index of the black pixel count
+    constexpr int gray = nbins + 1; // index of the gray pixel count
+    std::vector<uint64_t> sums(nbins + 2, 0);
+
+    count_rows(src, sums, [&](int i, uint64_t *h)
+               {
+                   const cv::Vec3b *ptr = src.ptr<cv::Vec3b>(i);
+                   for (int j = 0; j < src.cols; j++)
+                   {
+                       int H = ptr[j][0];
+                       int S = ptr[j][1];
+                       float s_norm = S / 255.0f;
+                       float v_norm = ptr[j][2] / 255.0f;
+
+                       // dark and pale pixels are counted separately instead of being assigned a hue
+                       if (v_norm < 0.2f)
+                           h[black]++;
+                       else if (s_norm < 0.2f)
+                           h[gray]++;
+                       else
+                       {
+                           int hindex = std::min((int)(H / hwidth), HBins - 1);
+                           int sindex = std::min((int)(S / swidth), SBins - 1);
+                           h[hindex * SBins + sindex] += S;
+                       }
+                   }
+               });
+
+    float hist[nbins];
+    float black_bin = (float)sums[black];
+    float gray_bin = (float)sums[gray];
+    float total_weight = black_bin + gray_bin;
+    for (int b = 0; b < nbins; b++)
+    {
+        hist[b] = sums[b] / 255.0f;
+        total_weight += hist[b];
+    }
+
+    for (float h : hist)
+        featVec.push_back(h / total_weight);
+    featVec.push_back(black_bin / total_weight);
+    featVec.push_back(gray_bin / total_weight);
+}
+
+#endif
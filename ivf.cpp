@@ -0,0 +1,319 @@
+/*
+    Inverted-file (IVF) index with a k-means coarse quantizer
+
+    File layout of <csv>.ivf (after the sidecar header):
+        int32 metric, int32 lists, int32 dims, int64 rows, int64 blob size
+        float centroids[lists * dims]
+        uint32 offsets[lists + 1]
+        float vectors[rows * dims] - list after list
+        char blob[] - 0-terminated filenames in the same order
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+#include "ivf.hpp"
+
+// sidecar format identifier
+static const char IVF_MAGIC[] = "CBIRIVF1";
+
+// Runs fn(i) for i in [0, n) on a pool of threads
+template <typename F>
+static void parallel_rows(size_t n, int threads, F fn)
+{
+    std::atomic<size_t> next(0);
+    auto worker = [&]()
+    {
+        size_t i;
+        while ((i = next++) < n)
+            fn(i);
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 0; t < std::max(1, threads); t++)
+        pool.emplace_back(worker);
+    for (std::thread &t : pool)
+        t.join();
+}
+
+// Finds the list whose centroid is closest to a vector
+static int nearest_list(IVFIndex &index, std::vector<float> &vec, float &dist)
+{
+    int best = 0;
+    dist = apply_metric(index.metric, vec, index.centroids[0]);
+    for (int l = 1; l < index.lists(); l++)
+    {
+        float d = apply_metric(index.metric, vec, index.centroids[l]);
+        if (d < dist)
+        {
+            dist = d;
+            best = l;
+        }
+    }
+    return best;
+}
+
+/*
+    Trains the coarse quantizer with k-means on an evenly spaced sample of the rows
+*/
+int train_ivf(MetricType metric, FeatureDB &db, int nlist, int sample, int iters, int threads, IVFIndex &index)
+{
+    if (db.size() == 0 || nlist < 1)
+        return (-1);
+
+    // evenly spaced sample of rows, the first centroids are evenly spaced within it
+    int n = std::min((size_t)std::max(sample, nlist), db.size());
+    nlist = std::min(nlist, n);
+    std::vector<int> rows(n);
+    for (int i = 0; i < n; i++)
+        rows[i] = (size_t)i * db.size() / n;
+
+    index.metric = metric;
+    index.centroids.clear();
+    for (int l = 0; l < nlist; l++)
+        index.centroids.push_back(db.data[rows[(size_t)l * n / nlist]]);
+    index.offsets.assign(nlist + 1, 0);
+    index.vectors.clear();
+    index.names.clear();
+
+    std::vector<int> assigned(n, -1);
+    std::vector<float> dist(n);
+    size_t dims = db.data[0].size();
+    for (int it = 0; it < iters; it++)
+    {
+        // assignment step
+        std::atomic<int> changed(0);
+        parallel_rows(n, threads, [&](size_t i)
+                      {
+                          int l = nearest_list(index, db.data[rows[i]], dist[i]);
+                          if (l != assigned[i])
+                          {
+                              assigned[i] = l;
+                              changed++;
+                          }
+                      });
+
+        // update step: each centroid moves to the mean of its rows
+        std::vector<std::vector<double>> sums(nlist, std::vector<double>(dims, 0.0));
+        std::vector<int> counts(nlist, 0);
+        for (int i = 0; i < n; i++)
+        {
+            std::vector<float> &row = db.data[rows[i]];
+            for (size_t d = 0; d < dims; d++)
+                sums[assigned[i]][d] += row[d];
+            counts[assigned[i]]++;
+        }
+        int reseeded = 0;
+        for (int l = 0; l < nlist; l++)
+        {
+            if (counts[l] > 0)
+            {
+                for (size_t d = 0; d < dims; d++)
+                    index.centroids[l][d] = sums[l][d] / counts[l];
+                continue;
+            }
+            // an empty list takes over the row that is worst served by its centroid
+            int worst = std::max_element(dist.begin(), dist.end()) - dist.begin();
+            index.centroids[l] = db.data[rows[worst]];
+            dist[worst] = 0.0f;
+            reseeded++;
+        }
+
+        printf("Iteration %d: %d of %d rows changed list, %d empty lists reseeded\n", it + 1, changed.load(), n, reseeded);
+        if (changed == 0 && reseeded == 0)
+            break;
+    }
+    return (0);
+}
+
+/*
+    Brings the rows of the index in line with the database without retraining the quantizer
+*/
+void ivf_add(IVFIndex &index, FeatureDB &db, int threads, int &added, int &removed)
+{
+    // list of each row already in the index
+    std::unordered_map<std::string, int> known;
+    for (int l = 0; l < index.lists(); l++)
+        for (uint32_t p = index.offsets[l]; p < index.offsets[l + 1]; p++)
+            known[index.names[p]] = l;
+
+    std::vector<int> lists(db.size(), -1);
+    std::vector<int> fresh;
+    for (size_t i = 0; i < db.size(); i++)
+    {
+        auto it = known.find(db.filenames[i]);
+        if (it != known.end())
+            lists[i] = it->second;
+        else
+            fresh.push_back(i);
+    }
+    parallel_rows(fresh.size(), threads, [&](size_t k)
+                  {
+                      float dist;
+                      lists[fresh[k]] = nearest_list(index, db.data[fresh[k]], dist);
+                  });
+    added = fresh.size();
+    removed = std::max(0, (int)index.size() - (int)(db.size() - fresh.size()));
+
+    // counting sort of the rows by list, in database order within each list
+    int nlist = index.lists();
+    index.offsets.assign(nlist + 1, 0);
+    for (int l : lists)
+        index.offsets[l + 1]++;
+    for (int l = 0; l < nlist; l++)
+        index.offsets[l + 1] += index.offsets[l];
+    std::vector<uint32_t> pos(index.offsets.begin(), index.offsets.end() - 1);
+    index.vectors.assign(db.size(), std::vector<float>());
+    index.names.assign(db.size(), std::string());
+    for (size_t i = 0; i < db.size(); i++)
+    {
+        uint32_t p = pos[lists[i]]++;
+        index.vectors[p] = db.data[i];
+        index.names[p] = db.filenames[i];
+    }
+}
+
+// Writes the index of a database to <csv>.ivf, stamped with the current version of the csv
+// Returns non-zero if the file could not be written
+int write_ivf(char *csv, IVFIndex &index)
+{
+    char sidecar[512];
+    DBStamp stamp;
+    snprintf(sidecar, sizeof(sidecar), "%s.ivf", csv);
+    if (db_stamp(csv, stamp) != 0)
+        return (-1);
+
+    FILE *fp = fopen(sidecar, "wb");
+    if (!fp)
+    {
+        printf("Unable to write %s\n", sidecar);
+        return (-1);
+    }
+    int metric = index.metric;
+    int nlist = index.lists();
+    int dims = nlist > 0 ? index.centroids[0].size() : 0;
+    long long rows = index.size();
+    long long blob_size = 0;
+    for (std::string &name : index.names)
+        blob_size += name.size() + 1;
+
+    write_sidecar_header(fp, IVF_MAGIC, stamp);
+    fwrite(&metric, sizeof(metric), 1, fp);
+    fwrite(&nlist, sizeof(nlist), 1, fp);
+    fwrite(&dims, sizeof(dims), 1, fp);
+    fwrite(&rows, sizeof(rows), 1, fp);
+    fwrite(&blob_size, sizeof(blob_size), 1, fp);
+    for (auto &c : index.centroids)
+        fwrite(c.data(), sizeof(float), dims, fp);
+    fwrite(index.offsets.data(), sizeof(uint32_t), index.offsets.size(), fp);
+    for (auto &v : index.vectors)
+        fwrite(v.data(), sizeof(float), dims, fp);
+    for (std::string &name : index.names)
+        fwrite(name.c_str(), 1, name.size() + 1, fp);
+    fclose(fp);
+    return (0);
+}
+
+// Reads the index of a database from <csv>.ivf
+// Returns non-zero if there is no index or it was built for another metric
+int read_ivf(char *csv, MetricType metric, IVFIndex &index, bool &fresh)
+{
+    char sidecar[512];
+    DBStamp stamp;
+    snprintf(sidecar, sizeof(sidecar), "%s.ivf", csv);
+    db_stamp(csv, stamp);
+
+    FILE *fp = fopen(sidecar, "rb");
+    if (!fp)
+        return (-1);
+
+    // a stale index is still read, the rows it is missing can be added without retraining
+    // (the header is 8 bytes of magic and a 16 byte stamp)
+    char magic[8];
+    fresh = read_sidecar_header(fp, IVF_MAGIC, stamp) == 0;
+    fseek(fp, 0, SEEK_SET);
+    bool ours = fread(magic, 1, 8, fp) == 8 && memcmp(magic, IVF_MAGIC, 8) == 0;
+    fseek(fp, 24, SEEK_SET);
+
+    int stored_metric, nlist, dims;
+    long long rows, blob_size;
+    if (!ours || fread(&stored_metric, sizeof(stored_metric), 1, fp) != 1 || stored_metric != metric ||
+        fread(&nlist, sizeof(nlist), 1, fp) != 1 || fread(&dims, sizeof(dims), 1, fp) != 1 ||
+        fread(&rows, sizeof(rows), 1, fp) != 1 || fread(&blob_size, sizeof(blob_size), 1, fp) != 1)
+    {
+        fclose(fp);
+        return (-1);
+    }
+
+    // the file must hold every section the counts describe
+    long long left = sidecar_remaining(fp);
+    if (nlist < 1 || dims < 1 || rows < 0 || blob_size < 0 || nlist > left / ((long long)sizeof(float) * dims) ||
+        rows > left / ((long long)sizeof(float) * dims) ||
+        ((long long)nlist * dims + rows * dims + nlist + 1) * (long long)sizeof(float) + blob_size > left)
+    {
+        printf("Corrupt IVF index %s\n", sidecar);
+        fclose(fp);
+        return (-1);
+    }
+
+    index.metric = metric;
+    index.centroids.assign(nlist, std::vector<float>(dims));
+    index.offsets.resize(nlist + 1);
+    index.vectors.assign(rows, std::vector<float>(dims));
+    std::vector<char> blob(blob_size);
+    bool ok = true;
+    for (auto &c : index.centroids)
+        ok = ok && fread(c.data(), sizeof(float), dims, fp) == (size_t)dims;
+    ok = ok && fread(index.offsets.data(), sizeof(uint32_t), index.offsets.size(), fp) == index.offsets.size();
+    for (auto &v : index.vectors)
+        ok = ok && fread(v.data(), sizeof(float), dims, fp) == (size_t)dims;
+    ok = ok && fread(blob.data(), 1, blob_size, fp) == (size_t)blob_size;
+    fclose(fp);
+    // every list must lie within the rows and every filename within the blob
+    if (!ok || index.offsets.front() != 0 || index.offsets.back() != rows ||
+        !std::is_sorted(index.offsets.begin(), index.offsets.end()) || (blob_size > 0 && blob.back() != '\0'))
+        return (-1);
+
+    index.names.clear();
+    for (const char *p = blob.data(); p < blob.data() + blob_size; p += strlen(p) + 1)
+        index.names.push_back(p);
+    return index.names.size() == (size_t)rows ? 0 : -1;
+}
+
+// Finds the position of an image in the index, or -1 if it is not in it
+int ivf_find(IVFIndex &index, const char *filename)
+{
+    for (size_t p = 0; p < index.size(); p++)
+        if (index.names[p] == filename)
+            return (int)p;
+    return (-1);
+}
+
+/*
+    Scores the rows of the nprobe lists whose centroids are closest to the query and returns the K best
+*/
+void ivf_topk(IVFIndex &index, std::vector<float> &featVec, int nprobe, int K,
+              std::vector<std::pair<float, int>> &results, ScanStats &stats)
+{
+    // rank the centroids
+    std::vector<std::pair<float, int>> probes;
+    TopK closest(std::min(std::max(nprobe, 1), index.lists()), true);
+    for (int l = 0; l < index.lists(); l++)
+        closest.push(apply_metric(index.metric, featVec, index.centroids[l]), l);
+    closest.sorted(probes);
+
+    // scan the rows of the probed lists
+    TopK top(K, true);
+    for (auto &probe : probes)
+    {
+        for (uint32_t p = index.offsets[probe.second]; p < index.offsets[probe.second + 1]; p++)
+        {
+            stats.rows++;
+            top.push(apply_metric(index.metric, featVec, index.vectors[p]), p);
+        }
+    }
+    top.sorted(results);
+}
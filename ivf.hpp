@@ -0,0 +1,100 @@
+/*
+    Inverted-file (IVF) index with a k-means coarse quantizer
+
+    A k-means quantizer is trained on a sample of the database with the mode's own metric and every row is
+    assigned to its nearest centroid. The vectors of the rows of each list are stored contiguously, list after
+    list, together with their filenames, so the index answers queries on its own without the csv. A query
+    ranks the centroids, scores only the rows of its nprobe closest lists and keeps the K best; matches in
+    lists that were not probed are missed, so nprobe trades recall for speed.
+
+    Stored next to the database in <csv>.ivf and maintained with the ivf_index tool (train, add), evaluated with eval_recall
+*/
+
+#ifndef IVF_H
+#define IVF_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "distance.hpp"
+#include "feature_db.hpp"
+#include "scan.hpp"
+
+// default number of k-means iterations when training the quantizer
+#define IVF_TRAIN_ITERS 10
+
+struct IVFIndex
+{
+    MetricType metric = SSD;
+    std::vector<std::vector<float>> centroids; // one per list
+    std::vector<uint32_t> offsets;             // start of each list in vectors and names (lists + 1 values)
+    std::vector<std::vector<float>> vectors;   // feature vectors of the rows, list after list
+    std::vector<std::string> names;            // image filenames in the same order
+
+    int lists() const { return centroids.size(); }
+    size_t size() const { return vectors.size(); }
+};
+
+/*
+    Trains the coarse quantizer with k-means on an evenly spaced sample of the rows
+    The rows are assigned with the mode's metric and each centroid is the mean of its rows
+    (a list left empty is moved to the sample row furthest from its centroid)
+    The index is left without rows (see ivf_add)
+
+    Args:
+        - metric: distance metric of the mode
+        - db: feature database
+        - nlist: number of lists
+        - sample: number of rows the quantizer is trained on
+        - iters: maximum number of k-means iterations
+        - threads: number of worker threads of the assignment step
+        - index: index whose centroids are set
+    Returns non-zero if the database is empty
+*/
+int train_ivf(MetricType metric, FeatureDB &db, int nlist, int sample, int iters, int threads, IVFIndex &index);
+
+/*
+    Brings the rows of the index in line with the database without retraining the quantizer
+    Rows already in the index (by filename) keep their list and take their current vector, new rows are assigned
+    to their nearest centroid and rows that are no longer in the database are dropped
+
+    Args:
+        - index: trained index
+        - db: feature database
+        - threads: number of worker threads of the assignment
+        - added: set to the number of rows assigned to a list
+        - removed: set to the number of rows dropped
+*/
+void ivf_add(IVFIndex &index, FeatureDB &db, int threads, int &added, int &removed);
+
+// Writes the index of a database to <csv>.ivf, stamped with the current version of the csv
+// Returns non-zero if the file could not be written
+int write_ivf(char *csv, IVFIndex &index);
+
+// Reads the index of a database from <csv>.ivf
+// Args: csv    - csv database filename
+//       metric - distance metric the index has to be built with
+//       index  - index to be filled
+//       fresh  - set to true if the index was written for the current version of the csv
+// Returns non-zero if there is no index or it was built for another metric
+int read_ivf(char *csv, MetricType metric, IVFIndex &index, bool &fresh);
+
+// Finds the position of an image in the index, or -1 if it is not in it
+int ivf_find(IVFIndex &index, const char *filename);
+
+/*
+    Scores the rows of the nprobe lists whose centroids are closest to the query and returns the K best
+
+    Args:
+        - index: IVF index
+        - featVec: query feature vector
+        - nprobe: number of lists probed
+        - K: number of matches to keep
+        - results: vector of (distance, position in the index) pairs to be filled, best first
+        - stats: scan counters to be filled (rows counts the rows scored)
+*/
+void ivf_topk(IVFIndex &index, std::vector<float> &featVec, int nprobe, int K,
+              std::vector<std::pair<float, int>> &results, ScanStats &stats);
+
+#endif
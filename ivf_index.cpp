@@ -0,0 +1,143 @@
+/*
+    Maintains the inverted-file index of a feature database (see ivf.hpp)
+
+    train:  trains the k-means quantizer on a sample of the database and assigns every row to its list
+    add:    assigns the rows added to the csv since the index was written (and drops the removed ones)
+            without retraining, so the index keeps up with a growing collection
+
+    The recall and speedup of the index for a range of nprobe values are measured by eval_recall (path ivf).
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "feature_db.hpp"
+#include "ivf.hpp"
+
+// Prints the number of rows and the list sizes of an index
+static void print_list_sizes(IVFIndex &index)
+{
+    size_t smallest = index.size(), largest = 0;
+    for (int l = 0; l < index.lists(); l++)
+    {
+        smallest = std::min(smallest, (size_t)(index.offsets[l + 1] - index.offsets[l]));
+        largest = std::max(largest, (size_t)(index.offsets[l + 1] - index.offsets[l]));
+    }
+    printf("%zu rows in %d lists (%.1f per list on average, smallest %zu, largest %zu)\n", index.size(), index.lists(),
+           index.lists() > 0 ? (double)index.size() / index.lists() : 0.0, smallest, largest);
+}
+
+/*
+    Trains or updates the IVF index of the database of a feature mode
+
+    Argv:
+        - command: train or add
+        - feature_mode: feature mode whose database is used (baseline, hist, hist2, multihist, sobel, hsv, face, dnn, dnn_hsv)
+        - train: <lists> [-sample rows] [-iters n] [-t threads]
+            - lists: number of lists of the quantizer (e.g. about the square root of the number of rows)
+            - [-sample rows]: optional, number of rows the quantizer is trained on (default 20000)
+            - [-iters n]: optional, maximum number of k-means iterations (default IVF_TRAIN_ITERS)
+        - add: [-t threads]
+        - [-t threads]: optional, number of worker threads (default: all cores)
+*/
+int main(int argc, char *argv[])
+{
+    char csv[256];
+    MetricType metric;
+    FeatureDB db;
+    IVFIndex index;
+    bool fresh;
+    int threads = std::thread::hardware_concurrency();
+    int sample = 20000;
+    int iters = IVF_TRAIN_ITERS;
+
+    // check for sufficient arguments
+    if (argc < 3)
+    {
+        printf("usage: %s train <feature mode> <lists> [-sample <rows>] [-iters <n>] [-t <threads>]\n", argv[0]);
+        printf("       %s add <feature mode> [-t <threads>]\n", argv[0]);
+        exit(-1);
+    }
+
+    const char *command = argv[1];
+    bool train = strcmp(command, "train") == 0;
+    if (!train && strcmp(command, "add") != 0)
+    {
+        printf("Invalid command %s (use train or add)\n", command);
+        exit(-1);
+    }
+    if (feature_mode_db(argv[2], csv, metric) != 0)
+    {
+        printf("Invalid feature mode %s\n", argv[2]);
+        exit(-1);
+    }
+    int first_option = 3;
+    if (train)
+    {
+        if (argc < 4)
+        {
+            printf("Missing number of lists\n");
+            exit(-1);
+        }
+        first_option = 4;
+    }
+    for (int i = first_option; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-t") == 0)
+            threads = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-sample") == 0)
+            sample = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-iters") == 0)
+            iters = atoi(argv[i + 1]);
+        else
+        {
+            printf("Unknown option %s\n", argv[i]);
+            exit(-1);
+        }
+    }
+
+    if (load_feature_db(csv, db) != 0 || db.size() < 2)
+        exit(-1);
+
+    auto start = std::chrono::steady_clock::now();
+    if (train)
+    {
+        int nlist = atoi(argv[3]);
+        if (nlist < 1 || nlist > (int)db.size())
+        {
+            printf("The number of lists must be between 1 and %zu\n", db.size());
+            exit(-1);
+        }
+        printf("Training %d lists on %d of %zu rows with %d threads\n", nlist, std::min(std::max(sample, nlist), (int)db.size()),
+               db.size(), threads);
+        train_ivf(metric, db, nlist, sample, iters, threads, index);
+        int added, removed;
+        ivf_add(index, db, threads, added, removed);
+        printf("Trained and assigned in %.2f s\n", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        print_list_sizes(index);
+        if (write_ivf(csv, index) != 0)
+            exit(-1);
+        printf("Wrote %s.ivf\n", csv);
+        return (0);
+    }
+
+    if (read_ivf(csv, metric, index, fresh) != 0)
+    {
+        printf("No IVF index for %s, train one first\n", csv);
+        exit(-1);
+    }
+
+    int added, removed;
+    ivf_add(index, db, threads, added, removed);
+    printf("Added %d rows and dropped %d (%.2f s)\n", added, removed,
+           std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    print_list_sizes(index);
+    if (write_ivf(csv, index) != 0)
+        exit(-1);
+    printf("Wrote %s.ivf\n", csv);
+
+    return (0);
+}
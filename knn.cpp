@@ -0,0 +1,269 @@
+/*
+    Precomputed k-nearest-neighbour graph of a feature database
+
+    File layout of <csv>.knn (after the sidecar header):
+        int32 K, int64 rows, int64 blob size
+        int32 sorted_rows[rows]  - row ids ordered by filename
+        int32 row_rank[rows]     - position of each row in the sorted order
+        int64 name_offsets[rows] - offset of each sorted filename in the blob
+        char blob[]              - 0-terminated filenames in sorted order
+        (int32 row, float dist) neighbours[rows][K]
+    The sorted filenames allow a binary search with a handful of small reads, so a lookup never
+    touches the rest of the file
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <string>
+#include <thread>
+#include "knn.hpp"
+#include "scan.hpp"
+
+// sidecar format identifier
+static const char KNN_MAGIC[] = "CBIRKNN1";
+
+// one neighbour as stored on disk
+struct KnnEntry
+{
+    int row;
+    float dist;
+};
+
+/*
+    Finds the K nearest neighbours of every row of the database with a tiled, multi-threaded self-join
+    Each comparison uses the bounded metric against the row's current K-th best distance
+*/
+void build_knn_graph(char *csv, MetricType metric, FeatureDB &db, int K, int threads, int tile,
+                     std::vector<std::pair<float, int>> &neighbours)
+{
+    int n = db.size();
+    int ntiles = (n + tile - 1) / tile;
+    std::atomic<int> next_tile(0);
+    std::atomic<int> done(0);
+
+    load_bounds(csv, db, metric);
+    neighbours.assign((size_t)n * K, {0.0f, -1});
+
+    auto worker = [&]()
+    {
+        int I;
+        while ((I = next_tile++) < ntiles)
+        {
+            int i0 = I * tile;
+            int i1 = std::min(n, i0 + tile);
+            std::vector<TopK> tops(i1 - i0, TopK(K, true));
+            std::vector<std::vector<float>> q_suffix(i1 - i0);
+            for (int a = i0; a < i1; a++)
+                bound_suffix_sums(metric, db.data[a], q_suffix[a - i0]);
+
+            // compare the query tile against every tile of the database
+            for (int j0 = 0; j0 < n; j0 += tile)
+            {
+                int j1 = std::min(n, j0 + tile);
+                for (int a = i0; a < i1; a++)
+                {
+                    TopK &top = tops[a - i0];
+                    for (int b = j0; b < j1; b++)
+                    {
+                        if (a == b)
+                            continue;
+                        const float *r_suffix = metric == SSD ? nullptr : db.row_suffix(b);
+                        float dist;
+                        if (apply_metric_bounded(metric, db.data[a], db.data[b], q_suffix[a - i0].data(), r_suffix, top.bound(), dist))
+                            top.push(dist, b);
+                    }
+                }
+            }
+
+            // store the neighbours of the tile
+            std::vector<std::pair<float, int>> sorted;
+            for (int a = i0; a < i1; a++)
+            {
+                tops[a - i0].sorted(sorted);
+                std::copy(sorted.begin(), sorted.end(), neighbours.begin() + (size_t)a * K);
+            }
+
+            int d = ++done;
+            if (d % std::max(1, ntiles / 10) == 0 || d == ntiles)
+                printf("Finished %d of %d tiles\n", d, ntiles);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 0; t < std::max(1, threads); t++)
+        pool.emplace_back(worker);
+    for (std::thread &t : pool)
+        t.join();
+}
+
+// Writes the neighbour graph of a database to <csv>.knn
+// Returns non-zero if the file could not be written
+int write_knn_graph(char *csv, FeatureDB &db, int K, std::vector<std::pair<float, int>> &neighbours)
+{
+    char path[512];
+    DBStamp stamp;
+    snprintf(path, sizeof(path), "%s.knn", csv);
+    db_stamp(csv, stamp);
+
+    int rows_i = db.size();
+    long long rows = rows_i;
+
+    // order the rows by filename
+    std::vector<int> sorted_rows(rows_i);
+    std::iota(sorted_rows.begin(), sorted_rows.end(), 0);
+    std::sort(sorted_rows.begin(), sorted_rows.end(), [&](int a, int b)
+              { return strcmp(db.filenames[a], db.filenames[b]) < 0; });
+    std::vector<int> row_rank(rows_i);
+    std::vector<long long> name_offsets(rows_i);
+    long long blob_size = 0;
+    for (int i = 0; i < rows_i; i++)
+    {
+        row_rank[sorted_rows[i]] = i;
+        name_offsets[i] = blob_size;
+        blob_size += strlen(db.filenames[sorted_rows[i]]) + 1;
+    }
+
+    // written to <csv>.knn.new and renamed, as running queries may be reading the current graph
+    std::string staged = std::string(path) + ".new";
+    FILE *fp = fopen(staged.c_str(), "wb");
+    if (!fp)
+    {
+        printf("Unable to open output file %s\n", staged.c_str());
+        return (-1);
+    }
+    write_sidecar_header(fp, KNN_MAGIC, stamp);
+    fwrite(&K, sizeof(K), 1, fp);
+    fwrite(&rows, sizeof(rows), 1, fp);
+    fwrite(&blob_size, sizeof(blob_size), 1, fp);
+    fwrite(sorted_rows.data(), sizeof(int), rows_i, fp);
+    fwrite(row_rank.data(), sizeof(int), rows_i, fp);
+    fwrite(name_offsets.data(), sizeof(long long), rows_i, fp);
+    for (int i = 0; i < rows_i; i++)
+        fwrite(db.filenames[sorted_rows[i]], 1, strlen(db.filenames[sorted_rows[i]]) + 1, fp);
+
+    std::vector<KnnEntry> entries(K);
+    for (int i = 0; i < rows_i; i++)
+    {
+        for (int k = 0; k < K; k++)
+            entries[k] = {neighbours[(size_t)i * K + k].second, neighbours[(size_t)i * K + k].first};
+        fwrite(entries.data(), sizeof(KnnEntry), K, fp);
+    }
+    if (fclose(fp) != 0 || rename(staged.c_str(), path) != 0)
+    {
+        printf("Unable to write %s\n", path);
+        remove(staged.c_str());
+        return (-1);
+    }
+
+    printf("Wrote %s (%lld rows, %d neighbours each)\n", path, rows, K);
+    return (0);
+}
+
+// Reads a value of type T at the given offset of the file
+template <typename T>
+static bool read_at(FILE *fp, long long offset, T &value)
+{
+    return fseeko(fp, offset, SEEK_SET) == 0 && fread(&value, sizeof(T), 1, fp) == 1;
+}
+
+// Reads the 0-terminated string at the given offset of the file
+static bool read_name_at(FILE *fp, long long offset, std::string &name)
+{
+    if (fseeko(fp, offset, SEEK_SET) != 0)
+        return false;
+    name.clear();
+    int ch;
+    while ((ch = fgetc(fp)) != EOF && ch != '\0')
+        name.push_back((char)ch);
+    return ch == '\0';
+}
+
+// Looks up the N nearest neighbours of a database image in <csv>.knn without loading the database
+// Returns non-zero if there is no up-to-date graph, it holds fewer than N neighbours per row, or the image is not in it
+int knn_lookup(char *csv, const char *filename, int N, std::vector<std::pair<float, std::string>> &matches)
+{
+    char path[512];
+    DBStamp stamp;
+    snprintf(path, sizeof(path), "%s.knn", csv);
+    if (db_stamp(csv, stamp) != 0)
+        return (-1);
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return (-1);
+
+    int K;
+    long long rows, blob_size;
+    if (read_sidecar_header(fp, KNN_MAGIC, stamp) != 0 || fread(&K, sizeof(K), 1, fp) != 1 ||
+        fread(&rows, sizeof(rows), 1, fp) != 1 || fread(&blob_size, sizeof(blob_size), 1, fp) != 1 || K < N)
+    {
+        fclose(fp);
+        return (-1);
+    }
+
+    // offsets of the sections of the file
+    long long sorted_base = ftello(fp);
+    long long rank_base = sorted_base + rows * sizeof(int);
+    long long offset_base = rank_base + rows * sizeof(int);
+    long long blob_base = offset_base + rows * sizeof(long long);
+    long long neighbour_base = blob_base + blob_size;
+
+    // binary search for the filename
+    long long lo = 0, hi = rows - 1, found = -1;
+    std::string name;
+    while (lo <= hi)
+    {
+        long long mid = (lo + hi) / 2;
+        long long offset;
+        if (!read_at(fp, offset_base + mid * sizeof(long long), offset) || !read_name_at(fp, blob_base + offset, name))
+            break;
+        int cmp = strcmp(name.c_str(), filename);
+        if (cmp == 0)
+        {
+            found = mid;
+            break;
+        }
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+
+    int row;
+    if (found < 0 || !read_at(fp, sorted_base + found * sizeof(int), row))
+    {
+        fclose(fp);
+        return (-1);
+    }
+
+    // read the neighbours and their filenames
+    std::vector<KnnEntry> entries(N);
+    if (fseeko(fp, neighbour_base + (long long)row * K * sizeof(KnnEntry), SEEK_SET) != 0 ||
+        fread(entries.data(), sizeof(KnnEntry), N, fp) != (size_t)N)
+    {
+        fclose(fp);
+        return (-1);
+    }
+    matches.clear();
+    for (KnnEntry &e : entries)
+    {
+        int rank;
+        long long offset;
+        if (e.row < 0)
+            break;
+        if (!read_at(fp, rank_base + (long long)e.row * sizeof(int), rank) ||
+            !read_at(fp, offset_base + (long long)rank * sizeof(long long), offset) ||
+            !read_name_at(fp, blob_base + offset, name))
+        {
+            fclose(fp);
+            return (-1);
+        }
+        matches.push_back({e.dist, name});
+    }
+    fclose(fp);
+
+    return (0);
+}
@@ -0,0 +1,50 @@
+/*
+    Precomputed k-nearest-neighbour graph of a feature database
+
+    Built offline by knn_graph and stored next to the database in <csv>.knn so that queries for images
+    already in the database are answered by a lookup instead of a scan
+*/
+
+#ifndef KNN_H
+#define KNN_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "distance.hpp"
+#include "feature_db.hpp"
+
+/*
+    Finds the K nearest neighbours of every row of the database (excluding the row itself)
+    with a tiled self-join: each thread takes a tile of query rows and compares it against every
+    tile of the database, so each database tile is loaded once per query tile and stays in cache
+
+    Args:
+        - csv: csv database filename (its suffix sums are cached in <csv>.bounds, see load_bounds)
+        - metric: distance metric
+        - db: feature database
+        - K: number of neighbours per row
+        - threads: number of worker threads
+        - tile: number of rows per tile
+        - neighbours: vector to be filled with K (distance, row) pairs per row, best first (row -1 if there are fewer than K)
+*/
+void build_knn_graph(char *csv, MetricType metric, FeatureDB &db, int K, int threads, int tile,
+                     std::vector<std::pair<float, int>> &neighbours);
+
+// Writes the neighbour graph of a database to <csv>.knn
+// Args: csv        - csv database filename
+//       db         - feature database the graph was built from
+//       K          - number of neighbours per row
+//       neighbours - K (distance, row) pairs per row
+// Returns non-zero if the file could not be written
+int write_knn_graph(char *csv, FeatureDB &db, int K, std::vector<std::pair<float, int>> &neighbours);
+
+// Looks up the N nearest neighbours of a database image in <csv>.knn without loading the database
+// Args: csv      - csv database filename
+//       filename - image filename as stored in the database
+//       N        - number of neighbours needed
+//       matches  - vector to be filled with (distance, filename) pairs, best first
+// Returns non-zero if there is no up-to-date graph, it holds fewer than N neighbours per row, or the image is not in it
+int knn_lookup(char *csv, const char *filename, int N, std::vector<std::pair<float, std::string>> &matches);
+
+#endif
@@ -0,0 +1,78 @@
+/*
+    Offline job that builds the k-nearest-neighbour graph of a feature database
+
+    The graph is written next to the database in <csv>.knn and used by cbir to answer queries
+    for images that are already in the database
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "feature_db.hpp"
+#include "knn.hpp"
+
+/*
+    Builds the K nearest neighbours of every image in the database of a feature mode
+
+    Argv:
+        - feature_mode: feature mode whose database is used (baseline, hist, hist2, multihist, sobel, hsv, face, dnn, dnn_hsv)
+        - K: number of neighbours stored per image
+        - [-t threads]: optional, number of worker threads (default: all cores)
+        - [-tile rows]: optional, number of rows per tile of the self-join (default 128)
+*/
+int main(int argc, char *argv[])
+{
+    char csv[256];
+    MetricType metric;
+    FeatureDB db;
+    std::vector<std::pair<float, int>> neighbours;
+    int threads = std::thread::hardware_concurrency();
+    int tile = 128;
+
+    // check for sufficient arguments
+    if (argc < 3)
+    {
+        printf("usage: %s <feature mode>, <K>, [-t <threads>], [-tile <rows>]\n", argv[0]);
+        exit(-1);
+    }
+
+    if (feature_mode_db(argv[1], csv, metric) != 0)
+    {
+        printf("Invalid feature mode %s\n", argv[1]);
+        exit(-1);
+    }
+    int K = atoi(argv[2]);
+    for (int i = 3; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-t") == 0)
+            threads = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-tile") == 0)
+            tile = std::max(1, atoi(argv[i + 1]));
+        else
+        {
+            printf("Unknown option %s\n", argv[i]);
+            exit(-1);
+        }
+    }
+
+    if (load_feature_db(csv, db) != 0)
+        exit(-1);
+    if (K < 1 || K > (int)db.size() - 1)
+    {
+        printf("K must be between 1 and %zu\n", db.size() - 1);
+        exit(-1);
+    }
+
+    printf("Building %d-NN graph of %zu rows with %d threads\n", K, db.size(), threads);
+    auto start = std::chrono::steady_clock::now();
+    build_knn_graph(csv, metric, db, K, threads, tile, neighbours);
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Self-join finished in %.2f s\n", secs);
+
+    if (write_knn_graph(csv, db, K, neighbours) != 0)
+        exit(-1);
+
+    return (0);
+}
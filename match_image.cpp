@@ -9,280 +9,390 @@
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <chrono>
+#include <thread>
 #include "opencv2/opencv.hpp"
 #include "features.hpp"
 #include "csv_util.h"
+#include "distance.hpp"
+#include "feature_db.hpp"
+#include "scan.hpp"
+#include "cascade.hpp"
+#include "knn.hpp"
+#include "hash_index.hpp"
+#include "result_cache.hpp"
+#include "corpus.hpp"
+#include "pca.hpp"
+#include "thumbnails.hpp"
+#include "video.hpp"
+#include "snapshot.hpp"
+#include "stream_scan.hpp"
+#include "bin_index.hpp"
+#include "vp_tree.hpp"
+#include "ivf.hpp"
+#include "fusion.hpp"
+#include "segment_store.hpp"
 
-// available distance metric types
-enum MetricType
+// Helper: parses the passed in filepath into directory and filename
+// Uses the last slash as the delimiter to separate the filepath
+void parse_filepath(char *img_filepath, char *dir, char *&filename)
 {
-    SSD,
-    INTERSECTION,
-    FOUR_HIST_INTERSECTION,
-    TWO_HIST_INTERSECTION,
-    COSINE,
-    FACE,
-    DNN_HSV
+    // grab directory name from the img_filepath
+    char *last_slash = strrchr(img_filepath, '/'); // find the index of the last slash
+    int dir_len = last_slash - img_filepath + 1;   // find the length of directory name
+    strncpy(dir, img_filepath, dir_len);           // copy everything up to the last slash
+    dir[dir_len] = '\0';                           // null terminate
+
+    // strip the filename from the img_filepath
+    filename = last_slash + 1;
+}
+
+// options controlling how the database is searched
+struct QueryOptions
+{
+    bool ascending = true;                   // sort the results best first
+    bool prune = true;                       // abandon rows early in the scan (exact)
+    int cascade = 0;                         // number of candidates kept by the coarse stage (0 disables the cascade)
+    int bins = 0;                            // number of query bins probed in the bin index (0 disables it)
+    bool vptree = false;                     // search the vantage-point tree of the database if there is one (exact)
+    int ivf = 0;                             // number of IVF lists probed (0 disables the IVF index)
+    int radius = PHASH_RADIUS;               // Hamming radius of phash queries
+    bool recall = false;                     // report the recall of the cascade, bin index or tree against the exhaustive scan
+    bool graph = true;                       // answer queries for database images from the neighbour graph if there is one
+    bool cache = true;                       // reuse the results of earlier identical queries (see result_cache)
+    size_t cache_bytes = RESULT_CACHE_BYTES; // byte budget of the result cache
+    int threads = 0;                         // worker threads of the scan (0 uses every core)
+    bool pin = false;                        // pin the scan workers to cores
+    bool thumbs = true;                      // show the matches from the thumbnail store if there is one
+    bool display = true;                     // show the images in windows (otherwise only print the matches)
+    bool stream = false;                     // score the rows while parsing the csv instead of loading it
+    FusionMethod fusion = FUSION_ZSUM;       // how the distances of fused modes are combined (see fusion.hpp)
 };
 
-// Calculates the cosine distance between the 2 feature vectors
-// Returns a float: 1 - cos(theta) = 1 - (v1 dot v2)/(|v1||v2|)
-//                            ^ theta is the angle between the 2 vectors
-float cosine(std::vector<float> &featVec, std::vector<float> &data)
+/*
+    Displays the query image and its N closest matches and prints their distances
+    The query image itself is skipped if it appears among the matches
+
+    Args:
+        - img_filepath: image file path
+        - root: directory holding the images of the database (see db_image_name)
+        - query_name: name of the query image in the database
+        - matches: N+1 (distance, filename) pairs, best first
+        - N: number of matches to be displayed
+        - thumbs: thumbnail store of the database (nullptr to decode the original images and video frames)
+        - show: whether to open the image windows (false only prints the matches, e.g. for benchmarks)
+*/
+void display_matches(char *img_filepath, std::string &root, std::string &query_name,
+                     std::vector<std::pair<float, std::string>> &matches, int N, ThumbnailStore *thumbs, bool show)
 {
-    if (featVec.size() != data.size())
-    {
-        printf("Error: Vector size mismatch! Image: %lu vs Database: %lu\n", featVec.size(), data.size());
-        exit(-1);
-    }
+    std::string filepath;
+    cv::Mat temp;
+    bool skip_first = false;
 
-    float dot = 0.0f;         // dot product
-    float featVec_mag = 0.0f; // magnitude of featVec
-    float data_mag = 0.0f;    // magnitude of data
+    // pre-decoded thumbnail of an image, or the decoded original if it is not in the store
+    auto load_image = [&](const std::string &name, const std::string &path)
+    {
+        int row = thumbs ? thumbs->find(name.c_str()) : -1;
+        if (row >= 0)
+            return thumbs->thumbnail(row);
+
+        // video frames are decoded again from their video at the stored timestamp
+        std::string video;
+        double msec;
+        cv::Mat frame;
+        if (parse_video_frame_name(name, video, msec))
+        {
+            read_video_frame(corpus_path(root, video), msec, frame);
+            return frame;
+        }
+        return cv::imread(path);
+    };
 
-    for (int i = 0; i < featVec.size(); i++)
+    // display the original image
+    if (show)
     {
-        dot += featVec[i] * data[i];
-        featVec_mag += featVec[i] * featVec[i];
-        data_mag += data[i] * data[i];
+        cv::imshow(img_filepath, load_image(query_name, img_filepath));
+        cv::moveWindow(img_filepath, 0, 0);
     }
+    int move_window = 0; // offset to move the subsequent image window
 
-    featVec_mag = std::sqrt(featVec_mag);
-    data_mag = std::sqrt(data_mag);
+    // loop through N+1 closest matches
+    for (int i = 0; i < N + 1 && i < (int)matches.size(); i++)
+    {
+        // if first match was not skipped, only print N matches
+        if (!skip_first && i == N)
+            continue;
 
-    return 1.0f - (dot / (featVec_mag * data_mag));
-}
+        // reconstruct the filepath for each image for viewing
+        filepath = corpus_path(root, matches[i].second);
 
-// Calculates the histogram intersection distance betweeen the 2 vectors (normalized histogram)
-// Divides the sum by the divisor to account for N number of histograms
-// Returns a float: 1 - sum of min(a[i], b[i]) / divisor
-float intersection(std::vector<float> &featVec, std::vector<float> &data, float divisor)
-{
-    if (featVec.size() != data.size())
-    {
-        printf("Error: Vector size mismatch! Image: %lu vs Database: %lu\n", featVec.size(), data.size());
-        exit(-1);
+        // skip first match if the image is identical to the given image
+        if (matches[i].second == query_name)
+        {
+            skip_first = true;
+            continue;
+        }
+
+        if (show)
+        {
+            temp = load_image(matches[i].second, filepath);
+            cv::imshow(filepath, temp);
+            // move the image windows to stagger them for easier viewing
+            move_window += temp.cols / 2;
+            cv::moveWindow(filepath, move_window, 0);
+        }
+        // .second is the filename, .first is the distance
+        printf("Image: %s (Dist: %.4f)\n", matches[i].second.c_str(), matches[i].first);
     }
 
-    float sum = 0;
+    if (!show)
+        return;
 
-    for (int i = 0; i < featVec.size(); i++)
-    {
-        sum += std::min(featVec[i], data[i]);
-    }
+    // wait for any key press and close all windows
+    printf("Press any key to close all windows\n");
+    cv::waitKey(0);
+    cv::destroyAllWindows();
+}
 
-    return 1.0f - (sum / divisor);
+/*
+    Runs the exhaustive scan and reports the recall of an approximate result against it
+
+    Args:
+        - metric: distance metric
+        - featVec: query feature vector
+        - db: feature database
+        - results: (distance, row) pairs returned by the approximate path
+        - K: number of matches compared
+        - approx_ms: time taken by the approximate path
+*/
+void print_recall(MetricType metric, std::vector<float> &featVec, FeatureDB &db, std::vector<std::pair<float, int>> &results,
+                  int K, double approx_ms)
+{
+    std::vector<std::pair<float, int>> exact;
+    ScanStats exact_stats;
+    auto start = std::chrono::steady_clock::now();
+    scan_topk(metric, featVec, db, K, true, false, exact, exact_stats);
+    double exact_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    int found = 0;
+    for (auto &e : exact)
+        for (auto &r : results)
+            if (r.second == e.second)
+                found++;
+    printf("Recall@%d vs exhaustive scan: %.3f (exhaustive %.2f ms, speedup %.1fx)\n", K,
+           exact.empty() ? 1.0 : (double)found / exact.size(), exact_ms, exact_ms / std::max(approx_ms, 1e-6));
 }
 
-// Calculates the histogram intersection distance betweeen the 2 vectors (normalized histogram)
-// Divides the sum by 2 to account for 2 histograms
-// Adds a penalty (0.5) if the 2 vectors have a mismatch in the flag indicating face presence
-// (e.g. if one image contains a face and another doesn't, the distance receives a penalty)
-// Returns a float
-float face_dist(std::vector<float> &featVec, std::vector<float> &data)
+/*
+    Compares every entry of the feature database to the given feature vector
+    Distance metric is chosen based on metric integer
+    Returns the N+1 closest matches (the query image itself is usually one of them)
+
+    Args:
+        - feature_mode: user defined comparison method as a string
+        - csv: csv database filename
+        - db: feature database loaded from csv
+        - featVec: feature vector of the query image
+        - metric: int value corresponding to a distance metric
+        - N: number of closest matches to be returned
+        - opts: query options (sort order, pruning, cascade, bin index, vantage-point tree)
+        - matches: vector to be filled with (distance, filename) pairs, best first
+*/
+void print_closest_match(char *feature_mode, char *csv, FeatureDB &db, std::vector<float> &featVec,
+                         MetricType metric, int N, QueryOptions &opts, std::vector<std::pair<float, std::string>> &matches)
 {
-    if (featVec.size() != data.size())
+    std::vector<std::pair<float, int>> results;
+    ScanStats stats;
+
+    if (N > (int)db.size() - 1)
     {
-        printf("Error: Vector size mismatch! Image: %lu vs Database: %lu\n", featVec.size(), data.size());
+        printf("Index out of bounds! Please enter the number of matches up to %zu\n", db.size() - 1);
         exit(-1);
     }
 
-    float sum = 0;
-
-    // calculate the intersection distance up to N - 1 features
-    for (int i = 0; i < featVec.size() - 1; i++)
+    // keep the N+1 best matches since the query image itself is usually one of them
+    CoarseLayout layout = coarse_layout_for_db(feature_mode, csv);
+    VPTree tree;
+    bool use_tree = opts.vptree && opts.ascending && read_vp_tree(csv, db, metric, tree) == 0;
+    if (opts.vptree && !use_tree)
+        printf("No up-to-date vantage-point tree for %s (see build_vp_tree), scanning\n", csv);
+    auto start = std::chrono::steady_clock::now();
+    if (opts.bins > 0 && opts.ascending && bin_index_mode(feature_mode))
     {
-        sum += std::min(featVec[i], data[i]);
+        // score only the rows sharing a heavy bin with the query
+        BinIndex index;
+        load_bin_index(csv, db, index);
+        start = std::chrono::steady_clock::now();
+        bin_index_topk(metric, featVec, db, index, opts.bins, N + 1, results, stats);
+        double bins_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        printf("Bin index: %d query bins probed, %ld of %zu rows scored (%.1f%%, threshold %.3f, %.2f ms)\n", opts.bins,
+               stats.rows, db.size(), db.size() > 0 ? 100.0 * stats.rows / db.size() : 0.0, index.threshold, bins_ms);
+
+        if (opts.recall)
+            print_recall(metric, featVec, db, results, N + 1, bins_ms);
     }
-
-    float result = 1.0f - (sum / 2.0f);
-    // only check the last feature in the vector
-    if (std::fabs(data.back() - featVec.back()) > 0.1)
-        result += 0.5f; // add penalty for flag mismatch
-
-    return result;
-}
-
-// Calculates the sum squared distance betweeen the 2 vectors
-// Returns a float: sum of (a[i] - b[i])^2
-float ssd(std::vector<float> &featVec, std::vector<float> &data)
-{
-    if (featVec.size() != data.size())
+    else if (opts.cascade > 0 && opts.ascending && layout != COARSE_NONE)
     {
-        printf("Error: Vector size mismatch! Image: %lu vs Database: %lu\n", featVec.size(), data.size());
-        exit(-1);
+        // coarse scan of every row, exact re-rank of the best candidates
+        CoarseDB coarse;
+        load_coarse_db(csv, db, layout, coarse);
+        start = std::chrono::steady_clock::now();
+        cascade_topk(metric, featVec, db, coarse, std::max(opts.cascade, N + 1), N + 1, results, stats);
+        double cascade_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        printf("Cascade: coarse scan of %zu rows, re-ranked %ld in full (%.2f ms)\n", db.size(), stats.rows, cascade_ms);
+
+        if (opts.recall)
+            print_recall(metric, featVec, db, results, N + 1, cascade_ms);
     }
-
-    float dist = 0;
-    float diff;
-
-    for (int i = 0; i < featVec.size(); i++)
+    else if (use_tree)
     {
-        diff = featVec[i] - data[i];
-        dist += diff * diff;
+        // exact search, whole subtrees are skipped by the triangle inequality
+        vp_tree_topk(featVec, db, tree, N + 1, results, stats);
+        double tree_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        printf("VP-tree: %ld distance evaluations of %zu rows (%.1f%% pruned, %.2f ms)\n", stats.rows, db.size(),
+               db.size() > 0 ? 100.0 * stats.pruned / db.size() : 0.0, tree_ms);
+
+        if (opts.recall)
+            print_recall(metric, featVec, db, results, N + 1, tree_ms);
+    }
+    else
+    {
+        if (opts.prune)
+            load_bounds(csv, db, metric);
+        int workers = scan_topk_parallel(metric, featVec, db, N + 1, opts.ascending, opts.prune, opts.threads, opts.pin, results, stats);
+        printf("Scanned %ld rows with %d threads, pruned %ld early (%.1f%%)\n", stats.rows, workers, stats.pruned,
+               stats.rows > 0 ? 100.0 * stats.pruned / stats.rows : 0.0);
     }
 
-    return dist;
-}
-
-float dnn_hsv_dist(std::vector<float> &featVec, std::vector<float> &data)
-{
-    const int dnn_feat_length = 512;
-    std::vector<float> dnn_feat(featVec.begin(), featVec.begin() + dnn_feat_length);
-    std::vector<float> dnn_data(data.begin(), data.begin() + dnn_feat_length);
-
-    std::vector<float> hsv_feat(featVec.begin() + dnn_feat_length, featVec.end());
-    std::vector<float> hsv_data(data.begin() + dnn_feat_length, data.end());
-
-    float dnn_dist = cosine(dnn_feat, dnn_data);
-    float hsv_dist = intersection(hsv_feat, hsv_data, 2.0f);
-
-    return dnn_dist + hsv_dist;
+    for (auto &r : results)
+        matches.push_back({r.first, db.filenames[r.second]});
 }
 
-// Applies the chosen distance metric to calculate the distance between 2 feature vectors
-// Returns the distance as a float
-float apply_metric(MetricType metric, std::vector<float> &featVec, std::vector<float> &data)
-{
-    float dist;
-
-    switch (metric)
-    {
-    case SSD:
-        dist = ssd(featVec, data);
-        break;
-    case INTERSECTION:
-        dist = intersection(featVec, data, 1.0f);
-        break;
-    case FOUR_HIST_INTERSECTION:
-        dist = intersection(featVec, data, 4.0f);
-        break;
-    case TWO_HIST_INTERSECTION:
-        dist = intersection(featVec, data, 2.0f);
-        break;
-    case COSINE:
-        dist = cosine(featVec, data);
-        break;
-    case FACE:
-        dist = face_dist(featVec, data);
-        break;
-    case DNN_HSV:
-        dist = dnn_hsv_dist(featVec, data);
-        break;
-    }
-
-    return dist;
-}
+/*
+    Answers a query for an image that is already in the database from the precomputed neighbour graph
+    (<csv>.knn built by knn_graph) without decoding the image or loading the database
 
-// Helper: parses the passed in filepath into directory and filename
-// Uses the last slash as the delimiter to separate the filepath
-void parse_filepath(char *img_filepath, char *dir, char *&filename)
+    Args:
+        - csv: csv database filename
+        - query_name: name of the query image in the database (see db_image_name)
+        - N: number of closest matches to be returned
+        - matches: vector to be filled with the N closest (distance, filename) pairs, best first
+    Returns false if there is no up-to-date graph or the image is not in it (the caller falls back to a scan)
+*/
+bool print_graph_match(char *csv, std::string &query_name, int N, std::vector<std::pair<float, std::string>> &matches)
 {
-    // grab directory name from the img_filepath
-    char *last_slash = strrchr(img_filepath, '/'); // find the index of the last slash
-    int dir_len = last_slash - img_filepath + 1;   // find the length of directory name
-    strncpy(dir, img_filepath, dir_len);           // copy everything up to the last slash
-    dir[dir_len] = '\0';                           // null terminate
-
-    // strip the filename from the img_filepath
-    filename = last_slash + 1;
+    auto start = std::chrono::steady_clock::now();
+    if (knn_lookup(csv, query_name.c_str(), N, matches) != 0)
+        return false;
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    printf("Found %s in the neighbour graph (lookup %.1f us)\n", query_name.c_str(), us);
+
+    // the graph does not contain the image itself, so all N neighbours are shown
+    return true;
 }
 
 /*
-    Extracts the feature vectors from the csv database and compares every entry to the given feature vector
-    Distance metric is chosen based on metric integer
-    Prints out N closest matches and opens those images
+    Finds every database image whose perceptual hash is within Hamming distance radius of the query image
+    using the multi-index hash tables (no full scan)
+    Matches are ordered by pHash distance, then by dHash distance
 
     Args:
-        - csv: csv database filename
-        - featVec: feature vector to be filled
-        - img_filepath: image file path
-        - metric: int value corresponding to a distance metric
-        - N: number of closest matches to be returned
-        - ascending: whether to sort the results in ascending or descending order (best or worst match)
+        - src: cv::Mat image used for hashing
+        - radius: maximum Hamming distance of a match
+        - matches: vector to be filled with (distance, filename) pairs, best first
 */
-void print_closest_match(char *csv, std::vector<float> &featVec, char *img_filepath,
-                         MetricType metric, int N, bool ascending = true)
+void print_hash_matches(cv::Mat &src, int radius, std::vector<std::pair<float, std::string>> &matches)
 {
-    std::vector<char *> filenames;
-    std::vector<std::vector<float>> data;
-    float distance;
-    std::vector<std::pair<float, char *>> results;
-    char filepath[256];
-    char dir[256];
-    char *filename;
-    cv::Mat temp;
-    bool skip_first = false;
+    char csv[] = "features_phash.csv";
+    HashIndex index;
+    uint64_t phash, dhash;
+    std::vector<int> rows;
+    long candidates;
 
-    if (read_image_data_csv(csv, filenames, data) != 0)
+    if (index.open(csv) != 0)
     {
         printf("Invalid image filepath\n");
         exit(-1);
     }
 
-    parse_filepath(img_filepath, dir, filename);
+    extract_phash_features(src, phash, dhash);
+    index.query(phash, radius, rows, candidates);
+
+    // order by pHash distance and break ties with the dHash distance
+    std::sort(rows.begin(), rows.end(), [&](int a, int b)
+              {
+                  int pa = hamming(index.phash(a), phash), pb = hamming(index.phash(b), phash);
+                  if (pa != pb)
+                      return pa < pb;
+                  int da = hamming(index.dhash(a), dhash), db = hamming(index.dhash(b), dhash);
+                  return da != db ? da < db : a < b; });
+    printf("%zu images within Hamming distance %d (%ld of %zu rows checked)\n", rows.size(), radius, candidates, index.size());
+
+    for (int row : rows)
+        matches.push_back({(float)hamming(index.phash(row), phash), index.filename(row)});
+}
 
-    if (featVec.empty())
-    {
-        // build the feature vector from the ResNet18 csv file
-        append_dnn_vector(featVec, filename, filenames, data);
-    }
+/*
+    Streaming version of print_closest_match for databases that do not fit in memory
+    Each csv row is scored while the file is being parsed and only the N+1 best matches are kept
+    (see stream_scan.hpp), the cascade and bound-based pruning are not used
 
-    // build the vector of {distance, filename} pairs
-    for (int i = 0; i < filenames.size(); i++)
+    Args:
+        - csv: csv database filename
+        - featVec: query feature vector
+        - metric: distance metric
+        - N: number of matches
+        - opts: query options (sort order)
+        - matches: N+1 (distance, filename) pairs to be filled, best first
+*/
+void print_streamed_match(char *csv, std::vector<float> &featVec, MetricType metric, int N, QueryOptions &opts,
+                          std::vector<std::pair<float, std::string>> &matches)
+{
+    ScanStats stats;
+    auto start = std::chrono::steady_clock::now();
+    if (stream_topk(csv, metric, featVec, N + 1, opts.ascending, matches, stats) != 0)
     {
-        distance = apply_metric(metric, featVec, data[i]);
-        results.push_back({distance, filenames[i]});
+        printf("Invalid image filepath\n");
+        exit(-1);
     }
-
-    if (N > results.size() - 1)
+    if (N > stats.rows - 1)
     {
-        printf("Index out of bounds! Please enter the number of matches up to %zu\n", results.size() - 1);
+        printf("Index out of bounds! Please enter the number of matches up to %ld\n", stats.rows - 1);
         exit(-1);
     }
+    printf("Streamed %ld rows (%.2f ms)\n", stats.rows,
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+}
 
-    // sort the results
-    if (ascending)
-        std::sort(results.begin(), results.end());
-    else
-        std::sort(results.begin(), results.end(), std::greater<>());
+/*
+    Answers a query from the IVF index of the database (see ivf.hpp) without loading the csv
+    Only the rows of the nprobe lists closest to the query are scored
 
-    // display the original image
-    cv::imshow(img_filepath, cv::imread(img_filepath));
-    cv::moveWindow(img_filepath, 0, 0);
-    int move_window = 0; // offset to move the subsequent image window
+    Args:
+        - index: IVF index of the database
+        - featVec: query feature vector
+        - N: number of matches
+        - opts: query options (number of lists probed)
+        - matches: N+1 (distance, filename) pairs to be filled, best first
+*/
+void print_ivf_match(IVFIndex &index, std::vector<float> &featVec, int N, QueryOptions &opts,
+                     std::vector<std::pair<float, std::string>> &matches)
+{
+    std::vector<std::pair<float, int>> results;
+    ScanStats stats;
 
-    // loop through N+1 closest matches
-    for (int i = 0; i < N + 1; i++)
+    if (N > (int)index.size() - 1)
     {
-        // if first match was not skipped, only print N matches
-        if (!skip_first && i == N)
-            continue;
-
-        // reconstruct the filepath for each image for viewing
-        strcpy(filepath, dir);
-        strcat(filepath, results[i].second);
-
-        // skip first match if the image is identical to the given image
-        if (strstr(img_filepath, results[i].second) != NULL)
-        {
-            skip_first = true;
-            continue;
-        }
-
-        temp = cv::imread(filepath);
-        cv::imshow(filepath, temp);
-        // move the image windows to stagger them for easier viewing
-        move_window += temp.cols / 2;
-        cv::moveWindow(filepath, move_window, 0);
-        // .second is the filename, .first is the distance
-        printf("Image: %s (Dist: %.4f)\n", results[i].second, results[i].first);
+        printf("Index out of bounds! Please enter the number of matches up to %zu\n", index.size() - 1);
+        exit(-1);
     }
+    auto start = std::chrono::steady_clock::now();
+    ivf_topk(index, featVec, opts.ivf, N + 1, results, stats);
+    printf("IVF: probed %d of %d lists, scored %ld of %zu rows (%.2f ms)\n", std::min(opts.ivf, index.lists()), index.lists(),
+           stats.rows, index.size(), std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
 
-    // wait for any key press and close all windows
-    printf("Press any key to close all windows\n");
-    cv::waitKey(0);
-    cv::destroyAllWindows();
+    for (auto &r : results)
+        matches.push_back({r.first, index.names[r.second]});
 }
 
 /*
@@ -299,59 +409,63 @@ MetricType set_feature_mode(char *feature_mode, char *csv, cv::Mat &src, std::ve
 {
     MetricType dist_metric;
 
-    // find the csv filename based on the requested comparison method
-    // and extract the feature vector from the image
+    // find the csv filename and distance metric based on the requested comparison method
+    if (feature_mode_db(feature_mode, csv, dist_metric) != 0)
+    {
+        printf("Invalid comparison method\n");
+        printf("Please use one of: baseline, hist, hist2, multihist, sobel, hsv, face, dnn, dnn_hsv, phash\n");
+        exit(-1);
+    }
+
+    // the histogram modes use the configuration the DB was built with (see read -histogram, DBs without one use the default)
+    char config[64];
+    bool configured = (strcmp(feature_mode, "hist") == 0 || strcmp(feature_mode, "hist2") == 0 || strcmp(feature_mode, "hsv") == 0) &&
+                      read_image_data_header(csv, "histogram", config, sizeof(config)) == 0;
+    if (configured && (histogram_extractor(config) == nullptr || strcmp(histogram_config_mode(config), feature_mode) != 0))
+    {
+        printf("%s was built with the histogram configuration %s, which is not available for %s\n", csv, config, feature_mode);
+        exit(-1);
+    }
+
+    // extract the feature vector from the image
     if (strcmp(feature_mode, "baseline") == 0)
     {
-        strcpy(csv, "features_baseline.csv");
         extract_baseline_features(src, featVec);
-        dist_metric = SSD;
+    }
+    else if (configured)
+    {
+        extract_histogram_config_features(src, config, featVec);
     }
     else if (strcmp(feature_mode, "hist") == 0)
     {
-        strcpy(csv, "features_histogram.csv");
         extract_histogram_features(src, featVec);
-        dist_metric = INTERSECTION;
     }
     else if (strcmp(feature_mode, "hist2") == 0)
     {
-        strcpy(csv, "features_histogram_rgb.csv");
         extract_histogram_rgb_features(src, featVec);
-        dist_metric = INTERSECTION;
     }
     else if (strcmp(feature_mode, "multihist") == 0)
     {
-        strcpy(csv, "features_multihistogram.csv");
-        extract_multihist_features(src, featVec);
-        dist_metric = FOUR_HIST_INTERSECTION;
+        // use the region layout the DB was built with (DBs without a header use the legacy layout)
+        char layout[256];
+        if (read_image_data_header(csv, "layout", layout, sizeof(layout)) != 0)
+            strcpy(layout, MULTIHIST_DEFAULT_LAYOUT);
+        extract_multihist_features(src, layout, featVec);
     }
     else if (strcmp(feature_mode, "sobel") == 0)
     {
-        strcpy(csv, "features_sobel_magnitude.csv");
         extract_sobel_features(src, featVec);
-        dist_metric = TWO_HIST_INTERSECTION;
     }
     else if (strcmp(feature_mode, "hsv") == 0)
     {
-        strcpy(csv, "features_histogram_hsv.csv");
         extract_histogram_hsv_features(src, featVec);
-        dist_metric = TWO_HIST_INTERSECTION;
     }
     else if (strcmp(feature_mode, "face") == 0)
     {
-        strcpy(csv, "features_histogram_face.csv");
         extract_face_features(src, featVec);
-        dist_metric = FACE;
-    }
-    else if (strcmp(feature_mode, "dnn") == 0)
-    {
-        strcpy(csv, "ResNet18_olym.csv");
-        dist_metric = COSINE;
     }
     else if (strcmp(feature_mode, "dnn_hsv") == 0)
     {
-        strcpy(csv, "features_dnn_hsv.csv");
-
         char dnn[] = "ResNet18_olym.csv";
         std::vector<char *> filenames;
         std::vector<std::vector<float>> data;
@@ -362,15 +476,220 @@ MetricType set_feature_mode(char *feature_mode, char *csv, cv::Mat &src, std::ve
         read_image_data_csv(dnn, filenames, data);
         append_dnn_vector(featVec, filename, filenames, data);
         extract_histogram_hsv_features(src, featVec);
-        dist_metric = DNN_HSV;
     }
-    else
+    // dnn: the embedding only exists for images in the database (see find_query_row)
+    return dist_metric;
+}
+
+// Helper: true if the image has not been modified since the csv was written, so its stored features can be trusted
+bool stored_features_current(char *csv, char *img_filepath)
+{
+    DBStamp db_time, img_time;
+    return db_stamp(csv, db_time) == 0 && db_stamp(img_filepath, img_time) == 0 && img_time.mtime_ns <= db_time.mtime_ns;
+}
+
+// Helper: true if the features of a mode can be extracted from the image itself
+// (dnn embeddings only exist in the database, so their stored row is the only source)
+bool mode_extractable(const char *feature_mode)
+{
+    return strcmp(feature_mode, "dnn") != 0;
+}
+
+// Helper: true if the stored features of an image can be used for a query in the given mode
+// Modes that cannot extract them again use the stored row even if the image has changed since
+bool use_stored_features(const char *feature_mode, char *csv, char *img_filepath)
+{
+    return !mode_extractable(feature_mode) || stored_features_current(csv, img_filepath);
+}
+
+/*
+    Finds the query image in the loaded feature database so that its stored features can be reused
+    The csv only records filenames, so the image is matched by filename (as in the neighbour graph)
+    and only trusted if the file has not been modified since the csv was written (see use_stored_features)
+
+    Args:
+        - db: feature database loaded from csv
+        - feature_mode: user defined comparison method as a string
+        - csv: csv database filename
+        - img_filepath: image file path
+        - query_name: name of the image in the database (see db_image_name)
+    Returns the row of the image, or -1 if its features have to be extracted
+*/
+int find_query_row(FeatureDB &db, char *feature_mode, char *csv, char *img_filepath, std::string &query_name)
+{
+    if (!use_stored_features(feature_mode, csv, img_filepath))
+        return (-1);
+    return find_db_row(db, query_name.c_str());
+}
+
+/*
+    Answers a query on several feature databases joined by image filename (see fusion.hpp)
+    Each mode reuses the stored vector of an image already in the database if it can be trusted, the
+    other modes are extracted from the image (decoded once)
+
+    Args:
+        - db: fusion database whose parts are set (see parse_fusion_spec)
+        - img_filepath: image file path
+        - bytes: raw contents of the image file
+        - query_name: name of the image in the database (see db_image_name)
+        - N: number of matches
+        - opts: query options (fusion method)
+        - matches: N+1 (score, filename) pairs to be filled, best first
+*/
+void print_fused_match(FusionDB &db, char *img_filepath, std::vector<unsigned char> &bytes, std::string &query_name,
+                       int N, QueryOptions &opts, std::vector<std::pair<float, std::string>> &matches)
+{
+    if (load_fusion_db(db) != 0)
+        exit(-1);
+    if (N > (int)db.size() - 1)
     {
-        printf("Invalid comparison method\n");
-        printf("Please use one of: baseline, hist, hist2, multihist, sobel, hsv, face, dnn, dnn_hsv\n");
+        printf("Index out of bounds! Please enter the number of matches up to %zu\n", db.size() - 1);
         exit(-1);
     }
-    return dist_metric;
+
+    // each part uses the stored vector when it can be trusted (see use_stored_features), the others are
+    // extracted from the image, which is decoded at most once
+    int row = find_fusion_row(db, query_name.c_str());
+    std::vector<std::vector<float>> query(db.parts.size());
+    cv::Mat src;
+    int stored = 0;
+    for (size_t p = 0; p < db.parts.size(); p++)
+    {
+        FusionPart &part = db.parts[p];
+        if (row >= 0 && use_stored_features(part.mode.c_str(), part.csv.data(), img_filepath))
+        {
+            query[p] = db.data[row][p];
+            stored++;
+            continue;
+        }
+
+        if (src.empty())
+            src = cv::imdecode(cv::Mat(1, (int)bytes.size(), CV_8UC1, bytes.data()), cv::IMREAD_COLOR);
+        if (src.empty())
+        {
+            printf("Invalid image filepath\n");
+            exit(-1);
+        }
+        char mode[256], csv[256];
+        PCAProjection proj;
+        strcpy(mode, part.mode.c_str());
+        set_feature_mode(mode, csv, src, query[p], img_filepath);
+        // databases reduced with PCA store projected vectors, so the query is projected the same way
+        if (!query[p].empty() && load_db_projection(csv, proj) == 0)
+            pca_project(proj, query[p]);
+        if (query[p].empty() || query[p].size() != db.data[0][p].size())
+        {
+            printf("No %s features for %s that match %s\n", mode, img_filepath, csv);
+            exit(-1);
+        }
+    }
+    if (stored > 0)
+        printf("Using the stored features of %s for %d of %zu modes\n", query_name.c_str(), stored, db.parts.size());
+
+    std::vector<std::pair<float, int>> results;
+    ScanStats stats;
+    const char *methods[] = {"sum", "zsum", "rank"};
+    auto start = std::chrono::steady_clock::now();
+    fusion_topk(db, query, opts.fusion, N + 1, results, stats);
+    printf("Fused %zu modes (%s): scored %ld rows (%.2f ms)\n", db.parts.size(), methods[opts.fusion], stats.rows,
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+    for (auto &r : results)
+        matches.push_back({r.first, db.filenames[r.second]});
+}
+
+// Helper: reads the whole file into bytes
+// Returns non-zero if the file cannot be read
+int read_file_bytes(const char *path, std::vector<unsigned char> &bytes)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return (-1);
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    bytes.resize(size > 0 ? size : 0);
+    size_t n = fread(bytes.data(), 1, bytes.size(), fp);
+    fclose(fp);
+    return (size > 0 && n == bytes.size()) ? 0 : -1;
+}
+
+/*
+    Answers queries read from stdin (one image path per line) until the end of the input, printing their matches
+    The database is held as a snapshot (see snapshot.hpp): a new version published by readfiles is loaded
+    in the background and swapped in without stopping, and every query runs on the snapshot that was
+    current when it started
+
+    Args:
+        - feature_mode: user defined comparison method as a string
+        - csv: csv database filename
+        - N: number of matches printed per query
+        - opts: query options (the cascade, graph, cache and display options do not apply)
+*/
+void serve_queries(char *feature_mode, char *csv, int N, QueryOptions &opts)
+{
+    SnapshotDB snapshots;
+    if (snapshots.open(feature_mode, opts.prune) != 0)
+    {
+        printf("Cannot load %s\n", csv);
+        exit(-1);
+    }
+    snapshots.watch();
+    printf("Serving %s queries on %s, one image path per line\n", feature_mode, csv);
+    fflush(stdout);
+
+    char line[4096];
+    while (fgets(line, sizeof(line), stdin) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0')
+            continue;
+
+        auto start = std::chrono::steady_clock::now();
+        // the metric and projection come with the snapshot, a re-index may have reduced the database
+        std::shared_ptr<Snapshot> snap = snapshots.acquire();
+        FeatureDB &db = snap->db;
+        std::string root, query_name;
+        std::vector<float> featVec;
+        db_image_name(csv, line, root, query_name);
+
+        // images already in the snapshot reuse their stored feature vector
+        int row = find_query_row(db, feature_mode, csv, line, query_name);
+        if (row >= 0)
+            featVec = db.data[row];
+        else
+        {
+            cv::Mat src = cv::imread(line);
+            if (src.empty())
+            {
+                printf("Invalid image filepath %s\n", line);
+                fflush(stdout);
+                continue;
+            }
+            set_feature_mode(feature_mode, csv, src, featVec, line);
+            if (snap->reduced)
+                pca_project(snap->proj, featVec);
+        }
+        if (featVec.empty() || db.size() < 2 || featVec.size() != db.data[0].size())
+        {
+            printf("%s is not in %s\n", line, csv);
+            fflush(stdout);
+            continue;
+        }
+
+        std::vector<std::pair<float, int>> results;
+        std::vector<std::pair<float, std::string>> matches;
+        ScanStats stats;
+        scan_topk_parallel(snap->metric, featVec, db, std::min(N + 1, (int)db.size()), opts.ascending, opts.prune, opts.threads,
+                           opts.pin, results, stats);
+        for (auto &r : results)
+            matches.push_back({r.first, db.filenames[r.second]});
+
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        printf("Query %s: %zu rows in %.2f ms\n", line, db.size(), ms);
+        display_matches(line, root, query_name, matches, N, nullptr, false);
+        fflush(stdout);
+    }
 }
 
 /*
@@ -381,21 +700,38 @@ MetricType set_feature_mode(char *feature_mode, char *csv, cv::Mat &src, std::ve
         - img_filepath: filepath of image to be compared with
         - metric: metric used to compare images (baseline, histogram, multi-histogram, etc.)
         - N: number of closest matches to be printed
+        - [bot]: optional, sorts the results in descending order (worst matches first)
+        - [-exact]: optional, disables bound-based pruning and scores every row in full
+        - [-cascade M]: optional, scores every row with a coarse signature and re-ranks the best M in full
+        - [-bins M]: optional, scores only the rows sharing one of the query's M heaviest bins (hist, hist2, hsv)
+        - [-vptree]: optional, searches the vantage-point tree built by build_vp_tree (exact, ssd and intersection metrics)
+        - [-ivf nprobe]: optional, scores only the rows of the nprobe closest lists of the IVF index built by ivf_index
+        - [-recall]: optional, reports the recall of the cascade, the bin index or the tree against the exhaustive scan
+        - [-scan]: optional, always scans the database even if the image is in the precomputed neighbour graph
+        - [-radius d]: optional, Hamming radius of phash queries (default PHASH_RADIUS)
+        - [-fusion sum|zsum|rank]: optional, how the modes of a fusion spec such as dnn:0.6,hsv:0.3,sobel:0.1 are
+          combined (default zsum, see fusion.hpp); fused queries always scan the joined databases
 */
 int main(int argc, char *argv[])
 {
     std::vector<float> featVec; // flattened feature vector
+    std::vector<std::pair<float, std::string>> matches;
+    std::vector<unsigned char> bytes; // raw contents of the query image file
     char img_filepath[256];
     char feature_mode[256];
     char csv[256];
     int N;
     cv::Mat src;
-    bool ascending = true;
+    QueryOptions opts;
+    std::string key;        // result cache key of the query
+    std::string root;       // directory holding the images of the database
+    std::string query_name; // name of the query image in the database
+    MetricType metric;
 
     // check for sufficient arguments
     if (argc < 4)
     {
-        printf("usage: %s <image filepath>, <comparison method>, <number of matches>\n", argv[0]);
+        printf("usage: %s <image filepath | - (serve queries from stdin)>, <comparison method>, <number of matches>, [bot], [-exact], [-cascade M], [-bins M], [-vptree], [-ivf nprobe], [-recall], [-scan], [-radius d], [-nocache], [-cache_mb MB], [-t threads], [-pin], [-full], [-nodisplay], [-stream], [-fusion sum|zsum|rank]\n", argv[0]);
         exit(-1);
     }
 
@@ -403,21 +739,255 @@ int main(int argc, char *argv[])
     strcpy(img_filepath, argv[1]);
     strcpy(feature_mode, argv[2]);
     N = atoi(argv[3]);
-    if (argc == 5 && strcmp("bot", argv[4]) == 0)
-        ascending = false;
+    // get the optional flags
+    for (int i = 4; i < argc; i++)
+    {
+        if (strcmp("bot", argv[i]) == 0)
+            opts.ascending = false;
+        else if (strcmp("-exact", argv[i]) == 0)
+            opts.prune = false;
+        else if (strcmp("-cascade", argv[i]) == 0 && i + 1 < argc)
+            opts.cascade = atoi(argv[++i]);
+        else if (strcmp("-bins", argv[i]) == 0 && i + 1 < argc)
+            opts.bins = atoi(argv[++i]);
+        else if (strcmp("-vptree", argv[i]) == 0)
+            opts.vptree = true;
+        else if (strcmp("-ivf", argv[i]) == 0 && i + 1 < argc)
+            opts.ivf = atoi(argv[++i]);
+        else if (strcmp("-recall", argv[i]) == 0)
+            opts.recall = true;
+        else if (strcmp("-scan", argv[i]) == 0)
+            opts.graph = false;
+        else if (strcmp("-radius", argv[i]) == 0 && i + 1 < argc)
+            opts.radius = atoi(argv[++i]);
+        else if (strcmp("-nocache", argv[i]) == 0)
+            opts.cache = false;
+        else if (strcmp("-cache_mb", argv[i]) == 0 && i + 1 < argc)
+            opts.cache_bytes = (size_t)(atof(argv[++i]) * (1 << 20));
+        else if (strcmp("-t", argv[i]) == 0 && i + 1 < argc)
+            opts.threads = std::max(0, atoi(argv[++i]));
+        else if (strcmp("-pin", argv[i]) == 0)
+            opts.pin = true;
+        else if (strcmp("-full", argv[i]) == 0)
+            opts.thumbs = false;
+        else if (strcmp("-nodisplay", argv[i]) == 0)
+            opts.display = false;
+        else if (strcmp("-stream", argv[i]) == 0)
+            opts.stream = true;
+        else if (strcmp("-fusion", argv[i]) == 0 && i + 1 < argc)
+        {
+            const char *method = argv[++i];
+            if (strcmp(method, "sum") == 0)
+                opts.fusion = FUSION_SUM;
+            else if (strcmp(method, "zsum") == 0)
+                opts.fusion = FUSION_ZSUM;
+            else if (strcmp(method, "rank") == 0)
+                opts.fusion = FUSION_RANK;
+            else
+            {
+                printf("Invalid fusion method %s (use sum, zsum or rank)\n", method);
+                exit(-1);
+            }
+        }
+        else
+        {
+            printf("Unknown option %s\n", argv[i]);
+            exit(-1);
+        }
+    }
+
+    if (opts.threads == 0)
+        opts.threads = std::max(1u, std::thread::hardware_concurrency());
 
-    // read the image
-    src = cv::imread(img_filepath);
-    if (src.empty())
+    // long-running query loop on a swappable snapshot of the database
+    if (strcmp(img_filepath, "-") == 0)
+    {
+        if (feature_mode_db(feature_mode, csv, metric) != 0)
+        {
+            printf("Invalid comparison method (the query loop supports baseline, hist, hist2, multihist, sobel, hsv, face, dnn, dnn_hsv)\n");
+            exit(-1);
+        }
+        serve_queries(feature_mode, csv, N, opts);
+        return (0);
+    }
+
+    // read the raw image file (its contents identify the query in the result cache)
+    if (read_file_bytes(img_filepath, bytes) != 0)
     {
         printf("Invalid image filepath\n");
         exit(-1);
     }
 
-    // extracts the feature vector from the image and returns an integer value corresponding to the distance metric to be used
-    MetricType metric = set_feature_mode(feature_mode, csv, src, featVec, img_filepath);
-    // compares the image to every image in the database and prints N closest matches
-    print_closest_match(csv, featVec, img_filepath, metric, N, ascending);
+    // find the csv database and distance metric of the mode
+    // (a fusion spec is named after the database of its first mode)
+    FusionDB fused;
+    bool fusion = is_fusion_spec(feature_mode);
+    if (fusion)
+    {
+        if (parse_fusion_spec(feature_mode, fused.parts) != 0)
+            exit(-1);
+        strcpy(csv, fused.parts[0].csv.c_str());
+    }
+    else if (strcmp(feature_mode, "phash") == 0)
+        strcpy(csv, "features_phash.csv");
+    else if (feature_mode_db(feature_mode, csv, metric) != 0)
+    {
+        printf("Invalid comparison method\n");
+        printf("Please use one of: baseline, hist, hist2, multihist, sobel, hsv, face, dnn, dnn_hsv, phash\n");
+        exit(-1);
+    }
+    db_image_name(csv, img_filepath, root, query_name);
+
+    // databases reduced with PCA (see pca_fit) are scanned with ssd on the projected vectors
+    PCAProjection proj;
+    bool reduced = !fusion && strcmp(feature_mode, "phash") != 0 && load_db_projection(csv, proj) == 0;
+    if (reduced)
+    {
+        // the coarse signatures and the bin index need the full histograms
+        opts.cascade = 0;
+        opts.bins = 0;
+    }
+
+    // the streaming scan parses the csv, which no longer holds the rows of a database with a segment store
+    if (opts.stream && !fusion && has_segment_store(csv))
+    {
+        printf("%s has a segment store (see segments), loading it instead of streaming the csv\n", csv);
+        opts.stream = false;
+    }
+
+    // the recall report needs the scan to actually run, and the cache only tracks the version of one database
+    if (opts.recall || fusion)
+        opts.cache = false;
+
+    // thumbnails written by readfiles for the same corpus (see thumbnails.hpp)
+    ThumbnailStore store;
+    ThumbnailStore *thumbs = nullptr;
+    if (opts.thumbs && store.open(THUMBNAIL_FILE) == 0 && root == store.root())
+        thumbs = &store;
+
+    ResultCache cache(opts.cache_bytes);
+    if (opts.cache)
+    {
+        cache.load(RESULT_CACHE_FILE);
+        // -ivf results depend on the index as well as the csv (a missing index leaves the stamp zero)
+        DBStamp index;
+        if (opts.ivf > 0)
+            db_stamp((std::string(csv) + ".ivf").c_str(), index);
+        key = ResultCache::make_key(content_hash(bytes), feature_mode, N, opts.ascending, opts.cascade, opts.bins, opts.ivf, opts.radius,
+                                    index);
+        if (cache.lookup(key, csv, matches))
+        {
+            printf("Result cache hit (%ld hits, %ld misses, %zu entries)\n", cache.hits(), cache.misses(), cache.size());
+            cache.save(RESULT_CACHE_FILE);
+            display_matches(img_filepath, root, query_name, matches, N, thumbs, opts.display);
+            return (0);
+        }
+    }
+
+    // images already in the database are answered from the precomputed neighbour graph (see knn_graph),
+    // unless the image changed since it was indexed (its neighbours were computed from the old features)
+    if (fusion)
+    {
+        print_fused_match(fused, img_filepath, bytes, query_name, N, opts, matches);
+    }
+    else if (!(opts.graph && opts.ascending && opts.cascade == 0 && opts.bins == 0 && opts.ivf == 0 &&
+               use_stored_features(feature_mode, csv, img_filepath) && print_graph_match(csv, query_name, N, matches)))
+    {
+        FeatureDB db;
+        int row = -1;
+
+        // the IVF index holds its own copy of the rows, so the csv is not loaded (see ivf_index)
+        IVFIndex ivf;
+        bool use_ivf = false;
+        if (opts.ivf > 0 && opts.ascending && strcmp(feature_mode, "phash") != 0 && !opts.stream)
+        {
+            bool fresh;
+            use_ivf = read_ivf(csv, metric, ivf, fresh) == 0 && fresh;
+            if (!use_ivf)
+                printf("No up-to-date IVF index for %s (see ivf_index), scanning\n", csv);
+        }
+
+        // the streaming scan and the IVF index never hold the database in memory
+        if (use_ivf)
+        {
+            row = use_stored_features(feature_mode, csv, img_filepath) ? ivf_find(ivf, query_name.c_str()) : -1;
+        }
+        else if (strcmp(feature_mode, "phash") != 0 && !opts.stream)
+        {
+            if (load_feature_db(csv, db) != 0)
+            {
+                printf("Invalid image filepath\n");
+                exit(-1);
+            }
+            // images already in the database reuse their stored feature vector (no decoding or extraction)
+            row = find_query_row(db, feature_mode, csv, img_filepath, query_name);
+        }
+
+        if (row >= 0)
+        {
+            featVec = use_ivf ? ivf.vectors[row] : db.data[row];
+            printf("Using the stored features of %s\n", use_ivf ? ivf.names[row].c_str() : db.filenames[row]);
+        }
+        else
+        {
+            // decode the image
+            src = cv::imdecode(cv::Mat(1, (int)bytes.size(), CV_8UC1, bytes.data()), cv::IMREAD_COLOR);
+            if (src.empty())
+            {
+                printf("Invalid image filepath\n");
+                exit(-1);
+            }
+        }
+
+        if (strcmp(feature_mode, "phash") == 0)
+        {
+            // near-duplicate lookup in Hamming space
+            print_hash_matches(src, opts.radius, matches);
+        }
+        else
+        {
+            // extracts the feature vector from the image and returns an integer value corresponding to the distance metric to be used
+            if (row < 0)
+            {
+                metric = set_feature_mode(feature_mode, csv, src, featVec, img_filepath);
+                // databases reduced with PCA store projected vectors, so the query is projected the same way
+                if (reduced)
+                {
+                    pca_project(proj, featVec);
+                    if ((int)featVec.size() != proj.out_dims)
+                    {
+                        printf("The features of %s do not match the projection of %s\n", img_filepath, csv);
+                        exit(-1);
+                    }
+                }
+            }
+            // dnn embeddings only exist in the database (the streaming scan looks the row up in one pass)
+            if (featVec.empty() && opts.stream)
+                stream_find_row(csv, query_name.c_str(), featVec);
+            if (featVec.empty())
+            {
+                printf("%s is not in %s\n", img_filepath, csv);
+                exit(-1);
+            }
+            // compares the image to every image in the database and finds the N closest matches
+            if (opts.stream)
+                print_streamed_match(csv, featVec, metric, N, opts, matches);
+            else if (use_ivf)
+                print_ivf_match(ivf, featVec, N, opts, matches);
+            else
+                print_closest_match(feature_mode, csv, db, featVec, metric, N, opts, matches);
+        }
+    }
+
+    if (opts.cache)
+    {
+        cache.insert(key, csv, matches);
+        if (cache.save(RESULT_CACHE_FILE) != 0)
+            printf("Cannot write %s\n", RESULT_CACHE_FILE);
+        printf("Result cache miss (%ld hits, %ld misses, %zu entries)\n", cache.hits(), cache.misses(), cache.size());
+    }
+
+    display_matches(img_filepath, root, query_name, matches, N, thumbs, opts.display);
 
     return (0);
-}
\ No newline at end of file
+}
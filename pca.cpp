@@ -0,0 +1,143 @@
+/*
+    PCA projection of stored feature vectors
+
+    File layout of <csv>.pca: 8-byte magic, input and output dimensions, then the mean,
+    the variance of each component and the components (row major), all as floats.
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "opencv2/opencv.hpp"
+#include "csv_util.h"
+#include "pca.hpp"
+
+#define PCA_MAGIC "CBIRPCA1"
+
+int fit_pca(FeatureDB &db, int dims, int sample, PCAProjection &proj, double &retained)
+{
+    if (db.size() == 0)
+        return (-1);
+    int in_dims = db.data[0].size();
+    if (dims < 1 || dims > in_dims)
+        return (-1);
+
+    // evenly spaced sample of rows
+    int n = std::min((size_t)std::max(sample, dims + 1), db.size());
+    cv::Mat rows(n, in_dims, CV_32F);
+    for (int i = 0; i < n; i++)
+    {
+        std::vector<float> &row = db.data[(size_t)i * db.size() / n];
+        if ((int)row.size() != in_dims)
+            return (-1);
+        std::copy(row.begin(), row.end(), rows.ptr<float>(i));
+    }
+
+    cv::PCA pca(rows, cv::Mat(), cv::PCA::DATA_AS_ROW, dims);
+
+    proj.in_dims = in_dims;
+    proj.out_dims = pca.eigenvectors.rows;
+    proj.mean.assign(pca.mean.ptr<float>(0), pca.mean.ptr<float>(0) + in_dims);
+    proj.basis.resize((size_t)proj.out_dims * in_dims);
+    proj.variance.resize(proj.out_dims);
+    for (int k = 0; k < proj.out_dims; k++)
+    {
+        std::copy(pca.eigenvectors.ptr<float>(k), pca.eigenvectors.ptr<float>(k) + in_dims, proj.basis.begin() + (size_t)k * in_dims);
+        proj.variance[k] = pca.eigenvalues.at<float>(k);
+    }
+
+    // total variance of the sample (trace of the covariance, scaled like cv::PCA by 1 / n)
+    double total = 0.0;
+    for (int j = 0; j < in_dims; j++)
+    {
+        double sum = 0.0, sq = 0.0;
+        for (int i = 0; i < n; i++)
+        {
+            double v = rows.at<float>(i, j);
+            sum += v;
+            sq += v * v;
+        }
+        total += sq / n - (sum / n) * (sum / n);
+    }
+    double kept = 0.0;
+    for (float v : proj.variance)
+        kept += v;
+    retained = total > 0.0 ? kept / total : 1.0;
+
+    return (0);
+}
+
+void pca_project(const PCAProjection &proj, std::vector<float> &featVec)
+{
+    if ((int)featVec.size() != proj.in_dims)
+        return;
+
+    std::vector<float> centered(proj.in_dims);
+    for (int j = 0; j < proj.in_dims; j++)
+        centered[j] = featVec[j] - proj.mean[j];
+
+    std::vector<float> out(proj.out_dims);
+    for (int k = 0; k < proj.out_dims; k++)
+    {
+        const float *comp = proj.basis.data() + (size_t)k * proj.in_dims;
+        float sum = 0.0f;
+        for (int j = 0; j < proj.in_dims; j++)
+            sum += comp[j] * centered[j];
+        out[k] = sum;
+    }
+    featVec.swap(out);
+}
+
+int write_pca(const char *path, const PCAProjection &proj)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL)
+    {
+        printf("Unable to write %s\n", path);
+        return (-1);
+    }
+    fwrite(PCA_MAGIC, 1, 8, fp);
+    fwrite(&proj.in_dims, sizeof(proj.in_dims), 1, fp);
+    fwrite(&proj.out_dims, sizeof(proj.out_dims), 1, fp);
+    fwrite(proj.mean.data(), sizeof(float), proj.mean.size(), fp);
+    fwrite(proj.variance.data(), sizeof(float), proj.variance.size(), fp);
+    fwrite(proj.basis.data(), sizeof(float), proj.basis.size(), fp);
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+int read_pca(const char *path, PCAProjection &proj)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return (-1);
+
+    char magic[8];
+    bool ok = fread(magic, 1, 8, fp) == 8 && memcmp(magic, PCA_MAGIC, 8) == 0 &&
+              fread(&proj.in_dims, sizeof(proj.in_dims), 1, fp) == 1 &&
+              fread(&proj.out_dims, sizeof(proj.out_dims), 1, fp) == 1 &&
+              proj.in_dims > 0 && proj.out_dims > 0 && proj.out_dims <= proj.in_dims;
+    if (ok)
+    {
+        proj.mean.resize(proj.in_dims);
+        proj.variance.resize(proj.out_dims);
+        proj.basis.resize((size_t)proj.out_dims * proj.in_dims);
+        ok = fread(proj.mean.data(), sizeof(float), proj.mean.size(), fp) == proj.mean.size() &&
+             fread(proj.variance.data(), sizeof(float), proj.variance.size(), fp) == proj.variance.size() &&
+             fread(proj.basis.data(), sizeof(float), proj.basis.size(), fp) == proj.basis.size();
+    }
+    fclose(fp);
+    return ok ? 0 : -1;
+}
+
+int load_db_projection(char *csv, PCAProjection &proj)
+{
+    char path[1024];
+    if (read_image_data_header(csv, "pca", path, sizeof(path)) != 0)
+        return (-1);
+    if (read_pca(path, proj) != 0)
+    {
+        printf("Unable to read the projection %s of %s\n", path, csv);
+        return (-1);
+    }
+    return (0);
+}
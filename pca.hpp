@@ -0,0 +1,48 @@
+/*
+    PCA projection of stored feature vectors
+
+    A projection is fitted offline on a sample of a feature database (see pca_fit.cpp) and stored next to it
+    in <csv>.pca. A database whose csv header names a projection ("#pca,<file>") stores the projected vectors,
+    readfiles projects new rows and cbir projects the query before scanning with ssd.
+*/
+
+#ifndef PCA_H
+#define PCA_H
+
+#include <vector>
+#include "feature_db.hpp"
+
+struct PCAProjection
+{
+    int in_dims = 0;             // length of the full feature vectors
+    int out_dims = 0;            // length of the projected vectors
+    std::vector<float> mean;     // mean of the sample (in_dims values)
+    std::vector<float> basis;    // principal components, one row of in_dims values per output dimension
+    std::vector<float> variance; // variance along each component
+};
+
+// Fits a projection on a sample of the rows of a database
+// Args: db       - loaded database (full vectors)
+//       dims     - number of components to keep
+//       sample   - maximum number of rows used for the fit (evenly spaced over the database)
+//       proj     - projection to be filled
+//       retained - set to the fraction of the sample's total variance kept by the components
+// Returns non-zero if the database is empty or dims is out of range
+int fit_pca(FeatureDB &db, int dims, int sample, PCAProjection &proj, double &retained);
+
+// Projects a full feature vector in place (vectors of another length are left unchanged)
+void pca_project(const PCAProjection &proj, std::vector<float> &featVec);
+
+// Writes a projection to a binary file
+// Returns non-zero if the file cannot be written
+int write_pca(const char *path, const PCAProjection &proj);
+
+// Reads a projection written by write_pca
+// Returns non-zero if the file cannot be read
+int read_pca(const char *path, PCAProjection &proj);
+
+// Loads the projection of a reduced database (named by the "pca" entry of its csv header)
+// Returns non-zero if the database is not reduced or its projection cannot be read
+int load_db_projection(char *csv, PCAProjection &proj);
+
+#endif
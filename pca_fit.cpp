@@ -0,0 +1,196 @@
+/*
+    Offline job that fits a PCA projection on a feature database
+
+    The projection is written next to the database in <csv>.pca. With -apply the database itself is rewritten
+    with the projected vectors and its header names the projection, after which readfiles projects new rows
+    and cbir projects its queries (and compares them with ssd).
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "csv_util.h"
+#include "feature_db.hpp"
+#include "pca.hpp"
+#include "scan.hpp"
+
+// Rewrites a csv database with projected vectors, keeping its header and naming the projection in it
+// The new version is written next to the csv and renamed over it, so running queries never see it half-written
+// Returns non-zero if the file could not be written
+static int rewrite_reduced_db(char *csv, FeatureDB &reduced, const char *pca_path)
+{
+    int reset_file = 1;
+    std::string staged = std::string(csv) + ".new";
+
+    // carry over the header entries written by readfiles
+    const char *keys[] = {"root", "layout"};
+    char saved[2][4096];
+    bool has[2];
+    for (int k = 0; k < 2; k++)
+        has[k] = read_image_data_header(csv, keys[k], saved[k], sizeof(saved[k])) == 0;
+
+    for (int k = 0; k < 2; k++)
+    {
+        if (has[k])
+        {
+            write_image_data_header(staged.data(), keys[k], saved[k], reset_file);
+            reset_file = 0;
+        }
+    }
+    write_image_data_header(staged.data(), "pca", pca_path, reset_file);
+
+    for (size_t i = 0; i < reduced.size(); i++)
+    {
+        if (append_image_data_csv(staged.data(), reduced.filenames[i], reduced.data[i], 0) != 0)
+            return (-1);
+    }
+    return rename(staged.c_str(), csv) == 0 ? 0 : -1;
+}
+
+// Removes a row from a result list and keeps at most n of the remaining matches
+static void drop_row(std::vector<std::pair<float, int>> &results, int row, int n)
+{
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        if (results[i].second == row)
+        {
+            results.erase(results.begin() + i);
+            break;
+        }
+    }
+    if ((int)results.size() > n)
+        results.resize(n);
+}
+
+/*
+    Fits a PCA projection on a feature database and reports how well it preserves the rankings
+
+    Argv:
+        - feature_mode: feature mode whose database is reduced (baseline, hist, hist2, multihist, sobel, hsv, face, dnn, dnn_hsv)
+        - dims: number of dimensions kept (e.g. 64 to 256)
+        - [-sample n]: optional, number of rows used to fit the projection (default 20000)
+        - [-queries q]: optional, number of database rows used as queries for the overlap report (default 100)
+        - [-topn N]: optional, number of matches compared between the full and the projected vectors (default 10)
+        - [-apply]: optional, rewrite the database with the projected vectors
+*/
+int main(int argc, char *argv[])
+{
+    char csv[256];
+    char pca_path[512];
+    MetricType metric;
+    FeatureDB db;
+    PCAProjection proj;
+    double retained;
+    int sample = 20000;
+    int queries = 100;
+    int topn = 10;
+    bool apply = false;
+
+    // check for sufficient arguments
+    if (argc < 3)
+    {
+        printf("usage: %s <feature mode>, <dims>, [-sample <rows>], [-queries <rows>], [-topn <N>], [-apply]\n", argv[0]);
+        exit(-1);
+    }
+
+    if (feature_mode_db(argv[1], csv, metric) != 0)
+    {
+        printf("Invalid feature mode %s\n", argv[1]);
+        exit(-1);
+    }
+    int dims = atoi(argv[2]);
+    for (int i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-sample") == 0 && i + 1 < argc)
+            sample = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-queries") == 0 && i + 1 < argc)
+            queries = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-topn") == 0 && i + 1 < argc)
+            topn = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "-apply") == 0)
+            apply = true;
+        else
+        {
+            printf("Unknown option %s\n", argv[i]);
+            exit(-1);
+        }
+    }
+
+    if (read_image_data_header(csv, "pca", pca_path, sizeof(pca_path)) == 0)
+    {
+        printf("%s is already reduced with %s\n", csv, pca_path);
+        exit(-1);
+    }
+    if (load_feature_db(csv, db) != 0 || db.size() < 2)
+        exit(-1);
+
+    // fit the projection
+    auto start = std::chrono::steady_clock::now();
+    if (fit_pca(db, dims, sample, proj, retained) != 0)
+    {
+        printf("dims must be between 1 and %zu\n", db.data[0].size());
+        exit(-1);
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Fitted %d of %d dimensions on %d rows in %.2f s, retained variance %.1f%%\n", proj.out_dims, proj.in_dims,
+           std::min(std::max(sample, dims + 1), (int)db.size()), secs, 100.0 * retained);
+
+    snprintf(pca_path, sizeof(pca_path), "%s.pca", csv);
+    if (write_pca(pca_path, proj) != 0)
+        exit(-1);
+
+    // project every row
+    FeatureDB reduced;
+    for (size_t i = 0; i < db.size(); i++)
+    {
+        char *name = new char[strlen(db.filenames[i]) + 1];
+        strcpy(name, db.filenames[i]);
+        reduced.filenames.push_back(name);
+        reduced.data.push_back(db.data[i]);
+        pca_project(proj, reduced.data.back());
+    }
+
+    // top-N overlap between the full vectors (original metric) and the projected ones (ssd)
+    load_bounds(csv, db, metric);
+    int K = std::min(topn + 1, (int)db.size());
+    int nq = std::min(queries, (int)db.size());
+    int compared = 0;
+    double overlap = 0.0;
+    std::vector<std::pair<float, int>> full, proj_results;
+    for (int q = 0; q < nq; q++)
+    {
+        size_t row = (size_t)q * db.size() / nq;
+        ScanStats stats;
+        scan_topk(metric, db.data[row], db, K, true, true, full, stats);
+        scan_topk(SSD, reduced.data[row], reduced, K, true, true, proj_results, stats);
+
+        // the query row is found by both and would inflate the overlap, so only the other N matches are compared
+        drop_row(full, row, K - 1);
+        drop_row(proj_results, row, K - 1);
+        if (full.empty())
+            continue;
+
+        int found = 0;
+        for (auto &f : full)
+            for (auto &p : proj_results)
+                if (f.second == p.second)
+                    found++;
+        overlap += (double)found / full.size();
+        compared++;
+    }
+    printf("Top-%d overlap with the full vectors over %d queries: %.3f\n", K - 1, compared,
+           compared > 0 ? overlap / compared : 1.0);
+    printf("Wrote %s (%zu -> %d floats per row)\n", pca_path, db.data[0].size(), proj.out_dims);
+
+    if (apply)
+    {
+        if (rewrite_reduced_db(csv, reduced, pca_path) != 0)
+            exit(-1);
+        printf("Rewrote %s with the projected vectors\n", csv);
+    }
+
+    return (0);
+}
@@ -0,0 +1,274 @@
+/*
+    Asynchronous read-ahead loader for the ingestion pipeline
+
+    Files are handed out in list order through a ring of queue_depth buffer slots.
+    File k is always read into slot k % queue_depth, and the I/O stage may only claim it
+    once the consumer has taken file k - queue_depth, which bounds the memory in flight.
+*/
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+#include "read_ahead.hpp"
+
+// Reads the rest of an open file into buf starting at offset done with pread
+// Returns the total number of bytes in buf
+static size_t pread_remaining(int fd, std::vector<unsigned char> &buf, size_t done)
+{
+    while (done < buf.size())
+    {
+        ssize_t n = pread(fd, buf.data() + done, buf.size() - done, done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+// Opens a file and sizes buf to hold its contents
+// Returns the file descriptor, or -1 if the file cannot be opened or is empty
+static int open_sized(const char *path, std::vector<unsigned char> &buf)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+        close(fd);
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    buf.resize(st.st_size);
+    return fd;
+}
+
+ReadAheadLoader::ReadAheadLoader(const std::vector<std::string> &paths, int queue_depth, int io_threads)
+    : paths(paths)
+{
+    if (queue_depth < 1)
+        queue_depth = 1;
+    if (io_threads < 1)
+        io_threads = 1;
+    slots.resize(queue_depth);
+
+#ifdef HAVE_LIBURING
+    // a single submission thread keeps up to queue_depth reads in flight
+    use_uring = true;
+    workers.emplace_back(&ReadAheadLoader::uring_worker, this);
+#else
+    for (int i = 0; i < io_threads; i++)
+        workers.emplace_back(&ReadAheadLoader::pread_worker, this);
+#endif
+}
+
+ReadAheadLoader::~ReadAheadLoader()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    slot_freed.notify_all();
+    for (std::thread &t : workers)
+        t.join();
+}
+
+const char *ReadAheadLoader::backend() const
+{
+    return use_uring ? "io_uring" : "pread";
+}
+
+// Claims the next unread file once its slot has been released by the consumer
+// If block is false, returns false immediately when no slot is free
+// Returns false when there is nothing left to read
+bool ReadAheadLoader::claim_slot(int &index, bool block)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    auto claimable = [&]
+    { return stopping || next_to_read >= (int)paths.size() || next_to_read < next_to_consume + (int)slots.size(); };
+
+    if (block)
+        slot_freed.wait(guard, claimable);
+    else if (!claimable())
+        return false;
+
+    if (stopping || next_to_read >= (int)paths.size())
+        return false;
+
+    index = next_to_read++;
+    Slot &slot = slots[index % slots.size()];
+    slot.index = index;
+    slot.ready = false;
+    return true;
+}
+
+// Marks the slot holding file index as ready and wakes the consumer
+void ReadAheadLoader::publish(int index, bool ok)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Slot &slot = slots[index % slots.size()];
+        if (ok)
+            total_bytes += slot.bytes.size();
+        else
+            slot.bytes.clear();
+        slot.ready = true;
+    }
+    slot_ready.notify_all();
+}
+
+// I/O thread for the pread backend: claims files one at a time and reads them synchronously
+void ReadAheadLoader::pread_worker()
+{
+    int index;
+    while (claim_slot(index, true))
+    {
+        // the slot is owned by this thread until it is published
+        std::vector<unsigned char> &buf = slots[index % slots.size()].bytes;
+        int fd = open_sized(paths[index].c_str(), buf);
+        bool ok = false;
+        if (fd >= 0)
+        {
+            size_t n = pread_remaining(fd, buf, 0);
+            buf.resize(n);
+            ok = n > 0;
+            close(fd);
+        }
+        publish(index, ok);
+    }
+}
+
+#ifdef HAVE_LIBURING
+// I/O thread for the io_uring backend: keeps up to queue_depth reads in flight and publishes them as they complete
+void ReadAheadLoader::uring_worker()
+{
+    struct io_uring ring;
+    if (io_uring_queue_init(slots.size(), &ring, 0) < 0)
+    {
+        // the kernel may not allow io_uring (old kernel or seccomp), fall back to pread
+        use_uring = false;
+        pread_worker();
+        return;
+    }
+
+    std::vector<int> fds(slots.size(), -1); // open file descriptor of each in-flight slot
+    int pending = 0;
+    bool exhausted = false;
+
+    while (!exhausted || pending > 0)
+    {
+        // queue as many reads as there are free slots (only block if nothing is in flight)
+        int index;
+        int queued = 0;
+        while (!exhausted && pending < (int)slots.size())
+        {
+            if (!claim_slot(index, pending == 0 && queued == 0))
+            {
+                // a blocking claim only fails once everything has been read
+                if (pending == 0 && queued == 0)
+                    exhausted = true;
+                break;
+            }
+
+            int s = index % slots.size();
+            fds[s] = open_sized(paths[index].c_str(), slots[s].bytes);
+            if (fds[s] < 0)
+            {
+                publish(index, false);
+                continue;
+            }
+
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+            io_uring_prep_read(sqe, fds[s], slots[s].bytes.data(), slots[s].bytes.size(), 0);
+            io_uring_sqe_set_data(sqe, (void *)(intptr_t)s);
+            queued++;
+            pending++;
+        }
+        if (queued > 0)
+            io_uring_submit(&ring);
+        if (pending == 0)
+            continue;
+
+        // reap one completion
+        struct io_uring_cqe *cqe;
+        int err = io_uring_wait_cqe(&ring, &cqe);
+        if (err == -EINTR)
+            continue;
+        if (err < 0)
+        {
+            // the ring is unusable: tearing it down cancels the reads in flight, which are reported as failed
+            // before the remaining files are read with pread
+            printf("io_uring wait failed (%s), falling back to pread\n", strerror(-err));
+            io_uring_queue_exit(&ring);
+            for (size_t f = 0; f < fds.size(); f++)
+            {
+                if (fds[f] < 0)
+                    continue;
+                close(fds[f]);
+                fds[f] = -1;
+                slots[f].bytes.clear();
+                publish(slots[f].index, false);
+            }
+            use_uring = false;
+            pread_worker();
+            return;
+        }
+        int s = (int)(intptr_t)io_uring_cqe_get_data(cqe);
+        int res = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+        pending--;
+
+        // finish short reads synchronously (rare for regular files)
+        std::vector<unsigned char> &buf = slots[s].bytes;
+        size_t n = res > 0 ? pread_remaining(fds[s], buf, res) : 0;
+        buf.resize(n);
+        close(fds[s]);
+        fds[s] = -1;
+        publish(slots[s].index, n > 0);
+    }
+
+    io_uring_queue_exit(&ring);
+}
+#else
+void ReadAheadLoader::uring_worker()
+{
+    pread_worker();
+}
+#endif
+
+/*
+    Blocks until the next file in order has been read and swaps its contents into bytes
+    The caller's previous buffer goes back into the pool so allocations are reused across files
+*/
+bool ReadAheadLoader::next(int &index, std::vector<unsigned char> &bytes)
+{
+    if (next_to_consume >= (int)paths.size())
+        return false;
+
+    auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> guard(lock);
+    Slot &slot = slots[next_to_consume % slots.size()];
+    slot_ready.wait(guard, [&]
+                    { return slot.index == next_to_consume && slot.ready; });
+    io_wait += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    index = next_to_consume;
+    bytes.swap(slot.bytes);
+    slot.bytes.clear();
+    slot.ready = false;
+    next_to_consume++;
+    guard.unlock();
+    slot_freed.notify_all();
+
+    return true;
+}
@@ -0,0 +1,70 @@
+/*
+    Asynchronous read-ahead loader for the ingestion pipeline
+
+    Reads the raw bytes of upcoming image files into a bounded pool of buffers on a background I/O stage
+    so that disk latency overlaps with cv::imdecode and feature extraction on the main thread.
+    Uses io_uring when the build found liburing (HAVE_LIBURING), otherwise a pool of threads doing pread.
+*/
+
+#ifndef READ_AHEAD_H
+#define READ_AHEAD_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ReadAheadLoader
+{
+public:
+    // Starts reading the files in the given order
+    // Args: paths       - file paths to be read (handed back in the same order)
+    //       queue_depth - number of files that may be read ahead of the consumer (size of the buffer pool)
+    //       io_threads  - number of pread threads (ignored by the io_uring backend)
+    ReadAheadLoader(const std::vector<std::string> &paths, int queue_depth = 16, int io_threads = 4);
+    ~ReadAheadLoader();
+
+    // Blocks until the next file in order has been read
+    // The file contents are swapped into bytes (bytes is left empty if the file could not be read)
+    // Returns false once every file has been handed out
+    // Args: index - index of the file in paths
+    //       bytes - buffer to be filled with the file contents
+    bool next(int &index, std::vector<unsigned char> &bytes);
+
+    // Total time (in seconds) the consumer spent blocked waiting for I/O
+    double io_wait_seconds() const { return io_wait; }
+    // Total number of bytes read from disk
+    size_t bytes_read() const { return total_bytes; }
+    // Name of the I/O backend in use ("io_uring" or "pread")
+    const char *backend() const;
+
+private:
+    struct Slot
+    {
+        int index = -1;     // index of the file held in this slot
+        bool ready = false; // true once the read has finished
+        std::vector<unsigned char> bytes;
+    };
+
+    void pread_worker();
+    void uring_worker();
+    bool claim_slot(int &index, bool block);
+    void publish(int index, bool ok);
+
+    const std::vector<std::string> &paths;
+    std::vector<Slot> slots;
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable slot_freed;
+    std::condition_variable slot_ready;
+    int next_to_read = 0;    // next file to be claimed by the I/O stage
+    int next_to_consume = 0; // next file to be handed to the consumer
+    bool stopping = false;
+    std::atomic<bool> use_uring{false};
+    double io_wait = 0.0;
+    size_t total_bytes = 0;
+};
+
+#endif
@@ -13,15 +13,238 @@
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <chrono>
 #include <fstream>
-#include <dirent.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
 #include "opencv2/opencv.hpp"
 #include "features.hpp"
 #include "csv_util.h"
+#include "read_ahead.hpp"
+#include "corpus.hpp"
+#include "pca.hpp"
+#include "thumbnails.hpp"
+#include "video.hpp"
+#include "feature_db.hpp"
+#include "bin_index.hpp"
+#include "segment_store.hpp"
+
+// feature csvs staged by this run (published by publish_feature_csvs)
+static std::set<std::string> staged_csvs;
+
+/*
+  Name of the file a feature csv is written to while readfiles runs
+  The rows go to <csv>.new, which publish_feature_csvs renames over the csv once every image has been processed,
+  so that queries running meanwhile keep reading the complete previous version instead of a half-written file
+
+  Args:
+    - csv: csv filename
+*/
+static std::string staging_csv(const char *csv)
+{
+  staged_csvs.insert(csv);
+  return std::string(csv) + ".new";
+}
+
+/*
+  Segment store of a database written by this run and the images put into it so far
+*/
+struct StoreWriter
+{
+  SegmentStore store;
+  std::set<std::string> written;
+};
+static std::map<std::string, std::unique_ptr<StoreWriter>> store_writers;
+
+/*
+  Returns the writer of the segment store of a csv, opening the store on first use,
+  or NULL if the database has no store (its rows then go to the staged csv)
+
+  Args:
+    - csv: csv filename
+*/
+static StoreWriter *feature_store(const char *csv)
+{
+  auto it = store_writers.find(csv);
+  if (it == store_writers.end())
+  {
+    std::unique_ptr<StoreWriter> writer;
+    if (has_segment_store(csv))
+    {
+      writer.reset(new StoreWriter);
+      if (writer->store.open(csv) != 0)
+        exit(-1);
+      printf("Writing the rows of %s to its segment store\n", csv);
+    }
+    it = store_writers.emplace(csv, std::move(writer)).first;
+  }
+  return it->second.get();
+}
+
+/*
+  Atomically replaces every csv written by this run with its new version
+  Readers that opened the old version finish reading it, later ones see the new one
+  A database with a segment store only gets its header from the csv: the rows of the images that are no longer
+  in the corpus are deleted from the store and the rows written by this run are flushed to a segment
+*/
+static void publish_feature_csvs()
+{
+  for (auto &[csv, writer] : store_writers)
+  {
+    if (!writer)
+      continue;
+    long removed = 0;
+    std::vector<std::string> stale;
+    merge_segments(*writer->store.acquire(), false, [&](const std::string &name, const std::vector<float> &)
+                   { if (writer->written.count(name) == 0) stale.push_back(name); });
+    for (const std::string &name : stale)
+      removed += writer->store.remove(name) == 0;
+    if (writer->store.flush() != 0)
+      printf("Cannot flush the segment store of %s\n", csv.c_str());
+    else
+      printf("Put %zu rows into the segment store of %s and deleted %ld\n", writer->written.size(), csv.c_str(), removed);
+  }
+
+  for (const std::string &csv : staged_csvs)
+  {
+    std::string staged = csv + ".new";
+    if (rename(staged.c_str(), csv.c_str()) != 0)
+      printf("Cannot replace %s with %s\n", csv.c_str(), staged.c_str());
+    else
+      printf("Published %s\n", csv.c_str());
+  }
+  // release the writer locks
+  store_writers.clear();
+}
+
+/*
+  Builds the bin index (<csv>.bins, see bin_index.hpp) of every histogram database published by this run,
+  so that the first cbir -bins query does not have to build it
+
+  Args:
+    - feat_extraction: feature extraction method of the run
+    - threshold: fraction of a row's mass a bin must hold for the row to be listed under it
+*/
+static void build_bin_indexes(const char *feat_extraction, float threshold)
+{
+  const char *modes[] = {"hist", "hist2", "hsv"};
+  for (const char *mode : modes)
+  {
+    char csv[256];
+    MetricType metric;
+    if (strcmp(feat_extraction, mode) != 0 && strcmp(feat_extraction, "all") != 0)
+      continue;
+    // databases reduced with PCA no longer store histograms
+    if (feature_mode_db(mode, csv, metric) != 0 || metric == SSD || staged_csvs.count(csv) == 0)
+      continue;
+
+    FeatureDB db;
+    BinIndex index;
+    if (load_feature_db(csv, db) != 0)
+      continue;
+    build_bin_index(db, threshold, index);
+    if (write_bin_index(csv, index) == 0)
+      printf("Wrote bin index %s.bins (threshold %.3f, %.1f bins per row)\n", csv, threshold,
+             db.size() > 0 ? (double)index.rows.size() / db.size() : 0.0);
+  }
+}
+
+/*
+  Prepares a feature csv before the first row is written
+  When reset_file is set, the file is cleared and the corpus root is recorded in its header
+  so that cbir can locate the images of the (root-relative) rows
+
+  Args:
+    - csv: csv filename
+    - reset_file: if true, clear the file and write the header
+    - root: corpus root directory
+*/
+static void start_feature_csv(char *csv, int reset_file, const char *root)
+{
+  if (reset_file)
+  {
+    std::string staged = staging_csv(csv);
+    write_image_data_header(staged.data(), "root", root, reset_file);
+  }
+}
+
+/*
+  Appends the feature vector of an image to a feature csv
+  With pca set and a projection fitted for the csv (<csv>.pca, see pca_fit), the projected vector is stored
+  and the projection is named in the header so that cbir projects its queries the same way
+
+  Args:
+    - csv: csv filename
+    - img_filename: image filename
+    - featVec: feature vector of the image (projected in place)
+    - reset_file: if true, clear the file and write the header first
+    - root: corpus root directory
+    - header_key: extraction setting to be recorded in the header so that queries extract the same way,
+                  e.g. "layout" for the multihist region layout (NULL if the csv has none)
+    - header_value: value of the setting
+    - pca: whether to project the vector
+*/
+static void write_feature_row(char *csv, char *img_filename, std::vector<float> &featVec, int reset_file,
+                              const char *root, const char *header_key, const char *header_value, bool pca)
+{
+  // projections of the csv files, loaded on first use (null if the csv has none)
+  static std::map<std::string, std::unique_ptr<PCAProjection>> projections;
+
+  std::string staged = staging_csv(csv);
+  start_feature_csv(csv, reset_file, root);
+  if (reset_file && header_key != NULL)
+  {
+    write_image_data_header(staged.data(), header_key, header_value, 0);
+  }
+
+  if (pca)
+  {
+    std::string path = std::string(csv) + ".pca";
+    auto it = projections.find(csv);
+    if (it == projections.end())
+    {
+      std::unique_ptr<PCAProjection> proj(new PCAProjection);
+      if (read_pca(path.c_str(), *proj) != 0)
+      {
+        printf("No projection for %s, storing the full vectors\n", csv);
+        proj.reset();
+      }
+      it = projections.emplace(csv, std::move(proj)).first;
+    }
+    if (it->second)
+    {
+      if (reset_file)
+      {
+        write_image_data_header(staged.data(), "pca", path.c_str(), 0);
+      }
+      pca_project(*it->second, featVec);
+    }
+  }
+
+  // queries read the rows of a database with a segment store from the store (see segment_store.hpp)
+  StoreWriter *writer = feature_store(csv);
+  if (writer == NULL)
+  {
+    append_image_data_csv(staged.data(), img_filename, featVec, 0);
+  }
+  else
+  {
+    if (writer->store.put(img_filename, featVec) != 0)
+    {
+      printf("Cannot write %s to the segment store of %s (to change the vectors, remove %s.segs, run read again and then segments import)\n",
+             img_filename, csv, csv);
+      exit(-1);
+    }
+    writer->written.insert(img_filename);
+  }
+}
 
 /*
   Extracts features based on the chosen feature extraction method and saves the feature vector to the appropriate csv
-  Feature extraction methods: baseline, hist, hist2, multihist, texture, dnn, all
+  Feature extraction methods: baseline, hist, hist2, multihist, sobel, hsv, face, dnn_hsv, phash, all
 
   Args:
     - src: cv::Mat image used for feature extraction
@@ -32,10 +255,16 @@
                   else, open the file in 'append' mode
     - filenames: vector of filenames of DNN embeddings (used for feature vector concatenation)
     - data: vector of DNN embeddings for each image in filenames (used for feature vector concatenation)
+    - layout: region layout of the multihist histograms (stored in the header of the multihist csv)
+    - histogram: histogram configuration replacing the default of its mode (stored in the header of that csv),
+                 NULL to use the defaults
+    - root: corpus root directory (stored in the header of every csv)
+    - pca: whether to store the PCA projection of the feature vectors (for the csv files that have one)
 */
 void extract_feature_to_csv(cv::Mat &src, char *img_filename,
                             std::vector<float> &featVec, char *feature_mode, int &reset_file,
-                            std::vector<char *> &filenames, std::vector<std::vector<float>> &data)
+                            std::vector<char *> &filenames, std::vector<std::vector<float>> &data,
+                            const char *layout, const char *histogram, const char *root, bool pca)
 {
   char baseline[] = "features_baseline.csv";
   char hist[] = "features_histogram.csv";
@@ -45,6 +274,7 @@ void extract_feature_to_csv(cv::Mat &src, char *img_filename,
   char hsv[] = "features_histogram_hsv.csv";
   char face[] = "features_histogram_face.csv";
   char dnn_hsv[] = "features_dnn_hsv.csv";
+  char phash[] = "features_phash.csv";
 
   bool do_baseline = (strcmp(feature_mode, "baseline") == 0 || strcmp(feature_mode, "all") == 0);
   bool do_hist = (strcmp(feature_mode, "hist") == 0 || strcmp(feature_mode, "all") == 0);
@@ -54,39 +284,59 @@ void extract_feature_to_csv(cv::Mat &src, char *img_filename,
   bool do_hist_hsv = (strcmp(feature_mode, "hsv") == 0 || strcmp(feature_mode, "all") == 0);
   bool do_hist_face = (strcmp(feature_mode, "face") == 0 || strcmp(feature_mode, "all") == 0);
   bool do_dnn_hsv_face = (strcmp(feature_mode, "dnn_hsv") == 0 || strcmp(feature_mode, "all") == 0);
+  bool do_phash = (strcmp(feature_mode, "phash") == 0 || strcmp(feature_mode, "all") == 0);
 
   bool do_nothing = true;
 
+  // configuration of the histogram mode it applies to
+  const char *hist_config = NULL, *hist_rgb_config = NULL, *hist_hsv_config = NULL;
+  if (histogram != NULL)
+  {
+    const char *mode = histogram_config_mode(histogram);
+    if (strcmp(mode, "hist") == 0)
+      hist_config = histogram;
+    else if (strcmp(mode, "hist2") == 0)
+      hist_rgb_config = histogram;
+    else
+      hist_hsv_config = histogram;
+  }
+
   if (do_baseline)
   {
     // extract the baseline features (7x7 square) into a csv file
     extract_baseline_features(src, featVec);
     // appends the image filename and feature vector into the csv
-    append_image_data_csv(baseline, img_filename, featVec, reset_file);
+    write_feature_row(baseline, img_filename, featVec, reset_file, root, NULL, NULL, pca);
     featVec.clear(); // clear the feature vector before reusing it
     do_nothing = false;
   }
   if (do_hist)
   {
     // extract the rg chromaticity histogram data into a csv file
-    extract_histogram_features(src, featVec);
-    append_image_data_csv(hist, img_filename, featVec, reset_file);
+    if (hist_config != NULL)
+      extract_histogram_config_features(src, hist_config, featVec);
+    else
+      extract_histogram_features(src, featVec);
+    write_feature_row(hist, img_filename, featVec, reset_file, root, hist_config ? "histogram" : NULL, hist_config, pca);
     featVec.clear(); // clear the feature vector before reusing it
     do_nothing = false;
   }
   if (do_hist_rgb)
   {
     // extract the rgb histogram data into a csv file
-    extract_histogram_rgb_features(src, featVec);
-    append_image_data_csv(hist2, img_filename, featVec, reset_file);
+    if (hist_rgb_config != NULL)
+      extract_histogram_config_features(src, hist_rgb_config, featVec);
+    else
+      extract_histogram_rgb_features(src, featVec);
+    write_feature_row(hist2, img_filename, featVec, reset_file, root, hist_rgb_config ? "histogram" : NULL, hist_rgb_config, pca);
     featVec.clear(); // clear the feature vector before reusing it
     do_nothing = false;
   }
   if (do_multihist)
   {
     // extract the multi-histogram data into a csv file
-    extract_multihist_features(src, featVec);
-    append_image_data_csv(multihist, img_filename, featVec, reset_file);
+    extract_multihist_features(src, layout, featVec);
+    write_feature_row(multihist, img_filename, featVec, reset_file, root, "layout", layout, pca);
     featVec.clear(); // clear the feature vector before reusing it
     do_nothing = false;
   }
@@ -94,15 +344,18 @@ void extract_feature_to_csv(cv::Mat &src, char *img_filename,
   {
     // extract the sobel magnitude texture data into a csv file
     extract_sobel_features(src, featVec);
-    append_image_data_csv(sobel, img_filename, featVec, reset_file);
+    write_feature_row(sobel, img_filename, featVec, reset_file, root, NULL, NULL, pca);
     featVec.clear(); // clear the feature vector before reusing it
     do_nothing = false;
   }
   if (do_hist_hsv)
   {
     // extract the hsv histogram data into a csv file
-    extract_histogram_hsv_features(src, featVec);
-    append_image_data_csv(hsv, img_filename, featVec, reset_file);
+    if (hist_hsv_config != NULL)
+      extract_histogram_config_features(src, hist_hsv_config, featVec);
+    else
+      extract_histogram_hsv_features(src, featVec);
+    write_feature_row(hsv, img_filename, featVec, reset_file, root, hist_hsv_config ? "histogram" : NULL, hist_hsv_config, pca);
     featVec.clear(); // clear the feature vector before reusing it
     do_nothing = false;
   }
@@ -110,7 +363,7 @@ void extract_feature_to_csv(cv::Mat &src, char *img_filename,
   {
     // extract the hsv histogram data of the face into a csv file
     extract_face_features(src, featVec);
-    append_image_data_csv(face, img_filename, featVec, reset_file);
+    write_feature_row(face, img_filename, featVec, reset_file, root, NULL, NULL, pca);
     featVec.clear(); // clear the feature vector before reusing it
     do_nothing = false;
   }
@@ -118,35 +371,76 @@ void extract_feature_to_csv(cv::Mat &src, char *img_filename,
   {
     // extract the hsv histogram data of the face into a csv file
     // concatenate the data with the DNN feature vectors (ResNet18_olym.csv)
-    append_dnn_vector(featVec, img_filename, filenames, data);
+    // the embeddings are keyed by the bare filename
+    char *base = strrchr(img_filename, '/');
+    append_dnn_vector(featVec, base ? base + 1 : img_filename, filenames, data);
     extract_histogram_hsv_features(src, featVec);
-    append_image_data_csv(dnn_hsv, img_filename, featVec, reset_file);
+    write_feature_row(dnn_hsv, img_filename, featVec, reset_file, root, NULL, NULL, pca);
     featVec.clear(); // clear the feature vector before reusing it
     do_nothing = false;
   }
+  if (do_phash)
+  {
+    // compute the perceptual and difference hashes and store them as packed bits
+    std::vector<uint64_t> hashes(2);
+    extract_phash_features(src, hashes[0], hashes[1]);
+    start_feature_csv(phash, reset_file, root);
+    append_image_hash_csv(staging_csv(phash).data(), img_filename, hashes, 0);
+    do_nothing = false;
+  }
   if (do_nothing) // if nothing happened
   {
     printf("Invalid feature extraction method\n");
-    printf("Please use one of: baseline, hist, hist2, multihist, sobel, hsv, face, dnn_hsv, all\n");
+    printf("Please use one of: baseline, hist, hist2, multihist, sobel, hsv, face, dnn_hsv, phash, all\n");
     exit(-1);
   }
 }
 
 /*
-  Given a directory on the command line, scans through the directory for image files.
+  Given a directory on the command line, finds the image and video files under it (or reads them from a path list)
+  and extracts their features into the csv of the chosen method.
 
-  Prints out the full path name for each file.  This can be used as an argument to fopen or to cv::imread.
+  The image files are read ahead of time by a background I/O stage (see read_ahead.hpp)
+  and decoded from memory so that disk latency overlaps with feature extraction.
+  Images are recorded by their path relative to the directory, which is stored in the csv header.
+  Video files are decoded frame by frame and only the frames that start a new scene are extracted
+  (see video.hpp), each recorded as <video path>@<seconds>.
+
+  Optional flags:
+    - -r: also process the images in subdirectories (walked in parallel)
+    - -w <threads>: number of threads walking the directory tree (default: all cores)
+    - -list <file>: read the image paths from a file ("-" for stdin) separated by newlines or NUL characters
+                    instead of listing the directory, paths are taken relative to the directory
+    - -q <depth>: number of files to read ahead of the extractor (default 16)
+    - -t <threads>: number of I/O threads for the pread backend (default 4)
+    - -layout <layout>: region layout for multihist, "legacy" or a spatial pyramid such as "1x1+2x2+4x4"
+    - -histogram <config>: histogram configuration replacing the default of the hist, hist2 or hsv mode
+                           (see histogram_extractor), e.g. rg32, rgb4 or hs18x8
+    - -pca: store the PCA projection of the feature vectors for the methods that have one (see pca_fit)
+    - -thumbs [<side>]: also write a thumbnail of every image (longer side up to <side> pixels, default 256)
+                        to the packed thumbnail store used by cbir to display its matches
+    - -scene <threshold>: signature distance in [0, 1] at which a video frame is indexed (default 0.3)
  */
 int main(int argc, char *argv[])
 {
-  char dirname[256];
   char feat_extraction[256];
-  char buffer[256];
-  char img_filename[256];
-  DIR *dirp;
-  struct dirent *dp;
+  std::string dirname;
   cv::Mat src;
   std::vector<float> featVec; // flattened feature vector
+  std::vector<std::string> img_names; // image paths relative to dirname (written to the csv)
+  std::vector<std::string> img_paths; // full paths of the image files to be processed
+  std::vector<std::string> video_names; // video paths relative to dirname
+  int queue_depth = 16;
+  int io_threads = 4;
+  int walk_threads = std::max(1u, std::thread::hardware_concurrency());
+  bool recursive = false;
+  bool pca = false;
+  int thumb_side = 0; // side of the thumbnails written to the thumbnail store (0 disables it)
+  float scene_threshold = VIDEO_SCENE_THRESHOLD;
+  float bin_threshold = BIN_INDEX_THRESHOLD;
+  const char *list_file = NULL;
+  char layout[256] = MULTIHIST_DEFAULT_LAYOUT;
+  const char *histogram = NULL;
 
   char dnn[] = "ResNet18_olym.csv";
   std::vector<char *> filenames;
@@ -155,58 +449,169 @@ int main(int argc, char *argv[])
   // check for sufficient arguments
   if (argc < 3)
   {
-    printf("usage: %s <directory path>, <feature extraction method>\n", argv[0]);
+    printf("usage: %s <directory path>, <feature extraction method>, [-r], [-w <walk threads>], [-list <path list>], [-q <queue depth>], [-t <io threads>], [-layout <multihist region layout>], [-histogram <config>], [-pca], [-thumbs [<side>]], [-scene <threshold>], [-bin_threshold <fraction>]\n", argv[0]);
     exit(-1);
   }
 
   // get the directory path
-  strcpy(dirname, argv[1]);
+  dirname = argv[1];
   // get the feature extraction method
   strcpy(feat_extraction, argv[2]);
-  printf("Processing directory %s\n", dirname);
+  // get the optional flags
+  for (int i = 3; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-r") == 0)
+      recursive = true;
+    else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+      walk_threads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-list") == 0 && i + 1 < argc)
+      list_file = argv[++i];
+    else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+      queue_depth = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+      io_threads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-layout") == 0 && i + 1 < argc)
+    {
+      if (snprintf(layout, sizeof(layout), "%s", argv[++i]) >= (int)sizeof(layout))
+      {
+        printf("Region layout %s is too long\n", argv[i]);
+        exit(-1);
+      }
+    }
+    else if (strcmp(argv[i], "-histogram") == 0 && i + 1 < argc)
+      histogram = argv[++i];
+    else if (strcmp(argv[i], "-pca") == 0)
+      pca = true;
+    else if (strcmp(argv[i], "-thumbs") == 0)
+      thumb_side = (i + 1 < argc && atoi(argv[i + 1]) > 0) ? atoi(argv[++i]) : THUMBNAIL_SIDE;
+    else if (strcmp(argv[i], "-scene") == 0 && i + 1 < argc)
+      scene_threshold = atof(argv[++i]);
+    else if (strcmp(argv[i], "-bin_threshold") == 0 && i + 1 < argc)
+      bin_threshold = atof(argv[++i]);
+    else
+    {
+      printf("Unknown option %s\n", argv[i]);
+      exit(-1);
+    }
+  }
+  // reject a bad layout before any file is touched (the regions of a 1x1 image are enough to parse it)
+  std::vector<cv::Rect> regions;
+  if (region_layout_rects(layout, 1, 1, regions) != 0)
+  {
+    printf("Invalid region layout %s\n", layout);
+    exit(-1);
+  }
+  if (histogram != NULL)
+  {
+    if (histogram_extractor(histogram) == nullptr)
+    {
+      printf("Unknown histogram configuration %s (use rg8, rg16, rg32, rgb4, rgb8, rgb16, hs8, hs16 or hs18x8)\n", histogram);
+      exit(-1);
+    }
+    if (strcmp(feat_extraction, histogram_config_mode(histogram)) != 0 && strcmp(feat_extraction, "all") != 0)
+    {
+      printf("The %s histogram configuration applies to the %s mode\n", histogram, histogram_config_mode(histogram));
+      exit(-1);
+    }
+  }
+  printf("Processing directory %s\n", dirname.c_str());
 
   if (strcmp(feat_extraction, "dnn_hsv") == 0 || strcmp(feat_extraction, "all") == 0)
   {
     read_image_data_csv(dnn, filenames, data);
   }
 
-  // open the directory
-  dirp = opendir(dirname);
-  if (dirp == NULL)
+  // collect the image files
+  auto start = std::chrono::steady_clock::now();
+  if (list_file != NULL)
   {
-    printf("Cannot open directory %s\n", dirname);
+    if (read_corpus_list(list_file, dirname, img_names) != 0)
+    {
+      printf("Cannot open path list %s\n", list_file);
+      exit(-1);
+    }
+  }
+  else if (walk_corpus(dirname, recursive, walk_threads, img_names) != 0)
+  {
+    printf("Cannot open directory %s\n", dirname.c_str());
     exit(-1);
   }
+  // videos are decoded by cv::VideoCapture after the images instead of going through the loader
+  std::vector<std::string> found;
+  found.swap(img_names);
+  for (std::string &name : found)
+  {
+    if (is_video_file(name.c_str()))
+      video_names.push_back(name);
+    else
+    {
+      img_names.push_back(name);
+      img_paths.push_back(corpus_path(dirname, name));
+    }
+  }
+  printf("Found %zu image files and %zu video files (%.3f s)\n", img_names.size(), video_names.size(),
+         std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
 
   int reset_file = 1; // resets the files initially to clear them before writing to them
 
-  // loop over all the files in the image file listing
-  while ((dp = readdir(dirp)) != NULL)
+  ThumbnailWriter thumbs;
+  if (thumb_side > 0 && thumbs.open(THUMBNAIL_FILE, thumb_side, dirname.c_str()) != 0)
+    exit(-1);
+
+  // the loader reads upcoming files in the background while the current one is decoded and processed
+  ReadAheadLoader loader(img_paths, queue_depth, io_threads);
+  std::vector<unsigned char> bytes;
+  int index;
+  while (loader.next(index, bytes))
   {
-    strcpy(img_filename, dp->d_name);
+    char *img_filename = img_names[index].data();
+    printf("Processing image file: %s\n", img_filename);
 
-    // check if the file is an image
-    if (strstr(img_filename, ".jpg") || strstr(img_filename, ".png") || strstr(img_filename, ".ppm") || strstr(img_filename, ".tif"))
-    {
-      printf("Processing image file: %s\n", img_filename);
+    // decode the image from the bytes read by the loader
+    if (bytes.empty())
+      continue;
+    src = cv::imdecode(bytes, cv::IMREAD_COLOR);
+    if (src.empty())
+      continue;
 
-      // build the overall filename
-      strcpy(buffer, dirname);
-      strcat(buffer, "/");
-      strcat(buffer, img_filename);
+    // extracts the features and appends them to the csv
+    extract_feature_to_csv(src, img_filename, featVec, feat_extraction, reset_file, filenames, data, layout, histogram, dirname.c_str(), pca);
 
-      // read the image
-      src = cv::imread(buffer);
-      if (src.empty())
-        continue;
+    // one thumbnail per csv row
+    if (thumb_side > 0)
+      thumbs.add(img_filename, src);
 
-      // extracts the features and appends them to the csv
-      extract_feature_to_csv(src, img_filename, featVec, feat_extraction, reset_file, filenames, data);
+    reset_file = 0; // append to the file after writing the first line
+  }
 
-      reset_file = 0; // append to the file after writing the first line
-    }
+  for (std::string &video : video_names)
+  {
+    printf("Processing video file: %s\n", video.c_str());
+    int frames;
+    int indexed = index_video_keyframes(corpus_path(dirname, video), scene_threshold, [&](cv::Mat &frame, double msec)
+                                        {
+                                          std::string name = video_frame_name(video, msec);
+                                          extract_feature_to_csv(frame, name.data(), featVec, feat_extraction, reset_file, filenames, data, layout, histogram, dirname.c_str(), pca);
+                                          if (thumb_side > 0)
+                                            thumbs.add(name.c_str(), frame);
+                                          reset_file = 0;
+                                        },
+                                        frames);
+    if (indexed < 0)
+      printf("Cannot open video file %s\n", video.c_str());
+    else
+      printf("Indexed %d of %d frames\n", indexed, frames);
   }
 
+  // swap the new databases in
+  publish_feature_csvs();
+  build_bin_indexes(feat_extraction, bin_threshold);
+
+  if (thumb_side > 0 && thumbs.close() == 0)
+    printf("Wrote thumbnails to %s\n", THUMBNAIL_FILE);
+
+  printf("Read %zu files (%.1f MB) with %s, I/O wait: %.3f s\n", img_paths.size(),
+         loader.bytes_read() / (1024.0 * 1024.0), loader.backend(), loader.io_wait_seconds());
   printf("Terminating\n");
 
   return (0);
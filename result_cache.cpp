@@ -0,0 +1,216 @@
+/*
+    Persistent cache of query results
+
+    File layout: 8-byte magic, hit and miss counters, number of entries, then each entry
+    (most recently used first) as its key, csv name, csv stamp and matches.
+    Strings are stored as a 32-bit length followed by their characters.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "result_cache.hpp"
+
+#define CACHE_MAGIC "CBIRQRC1"
+
+uint64_t content_hash(const std::vector<unsigned char> &bytes)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char b : bytes)
+    {
+        h ^= b;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+std::string ResultCache::make_key(uint64_t hash, const char *feature_mode, int N, bool ascending, int cascade, int bins, int nprobe, int radius,
+                                  const DBStamp &index)
+{
+    char key[512];
+    snprintf(key, sizeof(key), "%016llx|%s|%d|%s|%d|%d|%d|%d|%lld|%lld", (unsigned long long)hash, feature_mode, N,
+             ascending ? "top" : "bot", cascade, bins, nprobe, radius, index.size, index.mtime_ns);
+    return key;
+}
+
+// approximate memory held by an entry (strings plus the match array)
+size_t ResultCache::entry_bytes(const Entry &entry)
+{
+    size_t n = sizeof(Entry) + entry.key.size() + entry.csv.size();
+    for (auto &m : entry.matches)
+        n += sizeof(m) + m.second.size();
+    return n;
+}
+
+// Drops least recently used entries until the cache fits in its budget
+void ResultCache::evict()
+{
+    while (used > budget && !entries.empty())
+    {
+        used -= entries.back().bytes;
+        index.erase(entries.back().key);
+        entries.pop_back();
+    }
+}
+
+bool ResultCache::lookup(const std::string &key, const char *csv, Matches &matches)
+{
+    auto it = index.find(key);
+    DBStamp stamp;
+    if (it == index.end() || it->second->csv != csv || db_stamp(csv, stamp) != 0 || !(it->second->stamp == stamp))
+    {
+        miss_count++;
+        return false;
+    }
+
+    // move to the front of the list
+    entries.splice(entries.begin(), entries, it->second);
+    matches = it->second->matches;
+    hit_count++;
+    return true;
+}
+
+void ResultCache::insert(const std::string &key, const char *csv, const Matches &matches)
+{
+    Entry entry;
+    if (db_stamp(csv, entry.stamp) != 0)
+        return;
+    entry.key = key;
+    entry.csv = csv;
+    entry.matches = matches;
+    entry.bytes = entry_bytes(entry);
+    if (entry.bytes > budget)
+        return;
+
+    // replace an existing entry for the same key
+    auto it = index.find(key);
+    if (it != index.end())
+    {
+        used -= it->second->bytes;
+        entries.erase(it->second);
+    }
+
+    used += entry.bytes;
+    entries.push_front(std::move(entry));
+    index[key] = entries.begin();
+    evict();
+}
+
+static void write_string(FILE *fp, const std::string &s)
+{
+    uint32_t len = s.size();
+    fwrite(&len, sizeof(len), 1, fp);
+    fwrite(s.data(), 1, len, fp);
+}
+
+// Number of bytes left to read in a file of the given size
+static long long remaining(FILE *fp, long long size)
+{
+    return size - ftell(fp);
+}
+
+// Reads a string, failing if its length runs past the end of the file
+static bool read_string(FILE *fp, long long size, std::string &s)
+{
+    uint32_t len;
+    if (fread(&len, sizeof(len), 1, fp) != 1 || len > (1 << 20) || len > remaining(fp, size))
+        return false;
+    s.resize(len);
+    return fread(s.data(), 1, len, fp) == len;
+}
+
+void ResultCache::load(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return;
+
+    // the lengths read from the file are checked against its size before anything is allocated
+    struct stat st;
+    long long size = fstat(fileno(fp), &st) == 0 ? st.st_size : 0;
+    char magic[8];
+    long long count = 0;
+    if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, CACHE_MAGIC, 8) != 0 ||
+        fread(&hit_count, sizeof(hit_count), 1, fp) != 1 || fread(&miss_count, sizeof(miss_count), 1, fp) != 1 ||
+        fread(&count, sizeof(count), 1, fp) != 1)
+    {
+        hit_count = miss_count = 0;
+        fclose(fp);
+        return;
+    }
+
+    // current stamp of each csv referenced by the file (checked once per csv)
+    std::unordered_map<std::string, bool> fresh;
+    for (long long i = 0; i < count; i++)
+    {
+        Entry entry;
+        uint32_t n;
+        if (!read_string(fp, size, entry.key) || !read_string(fp, size, entry.csv) ||
+            fread(&entry.stamp, sizeof(entry.stamp), 1, fp) != 1 || fread(&n, sizeof(n), 1, fp) != 1)
+            break;
+        // a match takes at least its distance and the length of its filename
+        if (n > remaining(fp, size) / (sizeof(float) + sizeof(uint32_t)))
+            break;
+        entry.matches.resize(n);
+        bool ok = true;
+        for (auto &m : entry.matches)
+            ok = ok && fread(&m.first, sizeof(m.first), 1, fp) == 1 && read_string(fp, size, m.second);
+        if (!ok)
+            break;
+
+        // drop results computed from an older version of the database
+        auto f = fresh.find(entry.csv);
+        if (f == fresh.end())
+        {
+            DBStamp stamp;
+            f = fresh.emplace(entry.csv, db_stamp(entry.csv.c_str(), stamp) == 0 && stamp == entry.stamp).first;
+        }
+        if (!f->second || index.count(entry.key))
+            continue;
+
+        // entries are stored most recently used first, so append to keep the order
+        entry.bytes = entry_bytes(entry);
+        used += entry.bytes;
+        entries.push_back(std::move(entry));
+        index[entries.back().key] = std::prev(entries.end());
+    }
+    fclose(fp);
+    evict();
+}
+
+int ResultCache::save(const char *path) const
+{
+    // the temporary file is private to this process, as several cbir processes can save the cache at once
+    std::string tmp = std::string(path) + ".tmp." + std::to_string(getpid());
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (fp == NULL)
+        return (-1);
+
+    long long count = entries.size();
+    fwrite(CACHE_MAGIC, 1, 8, fp);
+    fwrite(&hit_count, sizeof(hit_count), 1, fp);
+    fwrite(&miss_count, sizeof(miss_count), 1, fp);
+    fwrite(&count, sizeof(count), 1, fp);
+    for (const Entry &entry : entries)
+    {
+        uint32_t n = entry.matches.size();
+        write_string(fp, entry.key);
+        write_string(fp, entry.csv);
+        fwrite(&entry.stamp, sizeof(entry.stamp), 1, fp);
+        fwrite(&n, sizeof(n), 1, fp);
+        for (auto &m : entry.matches)
+        {
+            fwrite(&m.first, sizeof(m.first), 1, fp);
+            write_string(fp, m.second);
+        }
+    }
+
+    if (fclose(fp) != 0 || rename(tmp.c_str(), path) != 0)
+    {
+        remove(tmp.c_str());
+        return (-1);
+    }
+    return (0);
+}
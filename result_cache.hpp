@@ -0,0 +1,92 @@
+/*
+    Persistent cache of query results
+
+    Results are keyed by a hash of the query image's bytes together with everything that changes the answer
+    (feature mode, number of matches, sort order, cascade size, Hamming radius, IVF index version) and the
+    stamp of the csv database they were computed from. Entries are evicted least recently used first once the cache grows
+    past its byte budget, and the cache is saved to a local file so it survives between runs.
+*/
+
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "feature_db.hpp"
+
+// default cache file (in the working directory, next to the csv databases)
+#define RESULT_CACHE_FILE "cbir_cache.bin"
+
+// default byte budget of the cache
+#define RESULT_CACHE_BYTES (4 << 20)
+
+// 64-bit FNV-1a hash of a byte buffer (used to identify the query image by content)
+uint64_t content_hash(const std::vector<unsigned char> &bytes);
+
+class ResultCache
+{
+public:
+    typedef std::vector<std::pair<float, std::string>> Matches;
+
+    // Args: budget - maximum number of bytes held by the cached results
+    explicit ResultCache(size_t budget = RESULT_CACHE_BYTES) : budget(budget) {}
+    ResultCache(const ResultCache &) = delete;
+    ResultCache &operator=(const ResultCache &) = delete;
+
+    // Reads the cache file and drops the entries whose csv database has changed since they were stored
+    // A missing or unreadable file leaves the cache empty
+    void load(const char *path);
+
+    // Writes the cache to a file (replaced atomically)
+    // Returns non-zero if the file cannot be written
+    int save(const char *path) const;
+
+    // Looks up the results of a query and marks them as most recently used
+    // Args: key     - query key (see make_key)
+    //       csv     - csv database the query runs against
+    //       matches - vector to be filled with the cached matches
+    // Returns true on a hit
+    bool lookup(const std::string &key, const char *csv, Matches &matches);
+
+    // Stores the results of a query, evicting the least recently used entries to stay within the budget
+    void insert(const std::string &key, const char *csv, const Matches &matches);
+
+    // Builds the key of a query from the hash of the image bytes and the options that change its results
+    // Args: index - stamp of the IVF index the query is answered from (left zero without -ivf), so results
+    //               computed from an earlier index, e.g. one trained with a different nlist, are not reused
+    static std::string make_key(uint64_t hash, const char *feature_mode, int N, bool ascending, int cascade, int bins, int nprobe, int radius,
+                                const DBStamp &index = DBStamp());
+
+    // hit and miss counters (accumulated across runs through the cache file)
+    long hits() const { return hit_count; }
+    long misses() const { return miss_count; }
+    size_t size() const { return entries.size(); }
+    size_t bytes() const { return used; }
+
+private:
+    struct Entry
+    {
+        std::string key;
+        std::string csv;
+        DBStamp stamp; // stamp of the csv when the results were computed
+        Matches matches;
+        size_t bytes = 0;
+    };
+
+    void evict();
+    static size_t entry_bytes(const Entry &entry);
+
+    size_t budget;
+    size_t used = 0;
+    long hit_count = 0;
+    long miss_count = 0;
+    std::list<Entry> entries; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+};
+
+#endif
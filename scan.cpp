@@ -0,0 +1,219 @@
+/*
+    Top-K scan over a feature database
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "scan.hpp"
+
+// Offers a candidate, keeping it if it is among the K best so far
+void TopK::push(float dist, int row)
+{
+    auto cmp = [this](const std::pair<float, int> &a, const std::pair<float, int> &b)
+    { return better(a, b); };
+    std::pair<float, int> cand(dist, row);
+
+    if ((int)heap.size() < K)
+    {
+        heap.push_back(cand);
+        std::push_heap(heap.begin(), heap.end(), cmp);
+    }
+    else if (K > 0 && better(cand, heap.front()))
+    {
+        std::pop_heap(heap.begin(), heap.end(), cmp);
+        heap.back() = cand;
+        std::push_heap(heap.begin(), heap.end(), cmp);
+    }
+}
+
+// Distance of the current K-th best match (+/- infinity until K matches have been seen)
+float TopK::bound() const
+{
+    if (!full() || K == 0)
+        return ascending ? std::numeric_limits<float>::infinity() : -std::numeric_limits<float>::infinity();
+    return heap.front().first;
+}
+
+// Moves the kept matches into results, best first
+void TopK::sorted(std::vector<std::pair<float, int>> &results)
+{
+    results = std::move(heap);
+    heap.clear();
+    std::sort(results.begin(), results.end(), [this](const std::pair<float, int> &a, const std::pair<float, int> &b)
+              { return better(a, b); });
+}
+
+// Scores rows [i0, i1) of the database into top
+// With bounded set, rows are scored against the current K-th best distance of top and abandoned early when they cannot enter
+static void scan_range(MetricType metric, std::vector<float> &featVec, const std::vector<float> &q_suffix, bool bounded,
+                       FeatureDB &db, size_t i0, size_t i1, TopK &top, ScanStats &stats)
+{
+    for (size_t i = i0; i < i1; i++)
+    {
+        float dist;
+        stats.rows++;
+        if (bounded)
+        {
+            const float *r_suffix = metric == SSD ? nullptr : db.row_suffix(i);
+            if (!apply_metric_bounded(metric, featVec, db.data[i], q_suffix.data(), r_suffix, top.bound(), dist))
+            {
+                stats.pruned++;
+                continue;
+            }
+        }
+        else
+        {
+            dist = apply_metric(metric, featVec, db.data[i]);
+        }
+        top.push(dist, i);
+    }
+}
+
+// Whether a scan can use bound-based pruning (bounds only help when looking for the closest matches)
+static bool scan_bounded(MetricType metric, FeatureDB &db, bool ascending, bool prune)
+{
+    return prune && ascending && (metric == SSD || (db.suffix_metric == metric && !db.suffix.empty()));
+}
+
+/*
+    Compares the feature vector to every row of the database and returns the K best matches
+    With pruning, each row is scored against the current K-th best distance and abandoned early when it cannot enter
+*/
+void scan_topk(MetricType metric, std::vector<float> &featVec, FeatureDB &db, int K, bool ascending, bool prune,
+               std::vector<std::pair<float, int>> &results, ScanStats &stats)
+{
+    TopK top(std::min(K, (int)db.size()), ascending);
+    std::vector<float> q_suffix;
+
+    bool bounded = scan_bounded(metric, db, ascending, prune);
+    if (bounded)
+        bound_suffix_sums(metric, featVec, q_suffix);
+
+    scan_range(metric, featVec, q_suffix, bounded, db, 0, db.size(), top, stats);
+    top.sorted(results);
+}
+
+// Range of blocks [begin, end) owned by one worker, packed into a single atomic word
+// The owner takes blocks from the front and thieves take them from the back, so both only need a compare-and-swap
+struct BlockQueue
+{
+    std::atomic<uint64_t> range{0};
+
+    static uint64_t pack(uint32_t begin, uint32_t end) { return ((uint64_t)begin << 32) | end; }
+
+    // Takes the first block (owner) or the last block (thief)
+    // Returns false once the range is empty
+    bool take(bool front, uint32_t &block)
+    {
+        uint64_t cur = range.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            uint32_t begin = cur >> 32, end = (uint32_t)cur;
+            if (begin >= end)
+                return false;
+            uint64_t next = front ? pack(begin + 1, end) : pack(begin, end - 1);
+            if (range.compare_exchange_weak(cur, next, std::memory_order_acq_rel))
+            {
+                block = front ? begin : end - 1;
+                return true;
+            }
+        }
+    }
+};
+
+// Pins the calling thread to a core (best effort, Linux only)
+static void pin_thread(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % std::max(1u, std::thread::hardware_concurrency()), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;
+#endif
+}
+
+/*
+    Parallel version of scan_topk
+    Each worker starts with a contiguous share of the blocks and steals from the back of the other workers'
+    shares once its own is exhausted. Workers keep a private top-K (so pruning only uses the worker's own bound,
+    which is never tighter than the global one) and the private results are merged at the end
+*/
+int scan_topk_parallel(MetricType metric, std::vector<float> &featVec, FeatureDB &db, int K, bool ascending, bool prune,
+                       int threads, bool pin, std::vector<std::pair<float, int>> &results, ScanStats &stats)
+{
+    size_t n = db.size();
+    K = std::min(K, (int)n);
+    if (n == 0 || threads <= 1)
+    {
+        scan_topk(metric, featVec, db, K, ascending, prune, results, stats);
+        return (1);
+    }
+
+    // size the blocks so that the rows of one block fit in SCAN_BLOCK_BYTES
+    size_t row_bytes = std::max<size_t>(1, db.data[0].size() * sizeof(float));
+    size_t block_rows = std::max<size_t>(1, SCAN_BLOCK_BYTES / row_bytes);
+    uint32_t nblocks = (n + block_rows - 1) / block_rows;
+    threads = std::min<int>(threads, nblocks);
+
+    std::vector<float> q_suffix;
+    bool bounded = scan_bounded(metric, db, ascending, prune);
+    if (bounded)
+        bound_suffix_sums(metric, featVec, q_suffix);
+
+    std::vector<BlockQueue> queues(threads);
+    for (int t = 0; t < threads; t++)
+        queues[t].range = BlockQueue::pack((uint64_t)nblocks * t / threads, (uint64_t)nblocks * (t + 1) / threads);
+
+    std::vector<TopK> tops(threads, TopK(K, ascending));
+    std::vector<ScanStats> worker_stats(threads);
+
+    auto worker = [&](int t)
+    {
+        if (pin)
+            pin_thread(t);
+        uint32_t block;
+        for (;;)
+        {
+            // own blocks first, then steal from the other workers in turn
+            bool found = queues[t].take(true, block);
+            for (int v = 1; !found && v < threads; v++)
+                found = queues[(t + v) % threads].take(false, block);
+            if (!found)
+                break;
+            size_t i0 = (size_t)block * block_rows;
+            scan_range(metric, featVec, q_suffix, bounded, db, i0, std::min(n, i0 + block_rows), tops[t], worker_stats[t]);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++)
+        pool.emplace_back(worker, t);
+    for (std::thread &t : pool)
+        t.join();
+
+    // merge the private results (ties are broken by row index, so the merge is independent of the thread count)
+    TopK top(K, ascending);
+    std::vector<std::pair<float, int>> part;
+    for (int t = 0; t < threads; t++)
+    {
+        tops[t].sorted(part);
+        for (auto &p : part)
+            top.push(p.first, p.second);
+        stats.rows += worker_stats[t].rows;
+        stats.pruned += worker_stats[t].pruned;
+    }
+    top.sorted(results);
+    return threads;
+}
@@ -0,0 +1,86 @@
+/*
+    Top-K scan over a feature database
+*/
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <utility>
+#include <vector>
+#include "distance.hpp"
+#include "feature_db.hpp"
+
+// target size of the row blocks handed out by the parallel scan (about the size of a per-core L2 cache)
+#define SCAN_BLOCK_BYTES (256 << 10)
+
+// counters reported by a scan
+struct ScanStats
+{
+    long rows = 0;   // rows visited
+    long pruned = 0; // rows abandoned before their distance was fully computed
+};
+
+// Bounded set of the K best (distance, row) pairs seen so far
+// Ties on the distance are broken by the row index so the result does not depend on the visiting order
+class TopK
+{
+public:
+    TopK(int K, bool ascending) : K(K), ascending(ascending) {}
+
+    // true if a is a better match than b
+    bool better(const std::pair<float, int> &a, const std::pair<float, int> &b) const
+    {
+        if (a.first != b.first)
+            return ascending ? a.first < b.first : a.first > b.first;
+        return a.second < b.second;
+    }
+    // Offers a candidate, keeping it if it is among the K best so far
+    void push(float dist, int row);
+    // Distance of the current K-th best match (+/- infinity until K matches have been seen)
+    float bound() const;
+    bool full() const { return (int)heap.size() >= K; }
+    // Moves the kept matches into results, best first
+    void sorted(std::vector<std::pair<float, int>> &results);
+
+private:
+    int K;
+    bool ascending;
+    std::vector<std::pair<float, int>> heap; // heap with the worst kept match on top
+};
+
+/*
+    Compares the feature vector to every row of the database and returns the K best matches
+    With prune set (and ascending order), rows are abandoned as soon as their distance is certain to exceed
+    the current K-th best distance (see apply_metric_bounded); prepare_bounds must have been called for the metric
+    The result is identical to the exhaustive scan
+
+    Args:
+        - metric: distance metric
+        - featVec: query feature vector
+        - db: feature database
+        - K: number of matches to keep
+        - ascending: whether to keep the closest (true) or the furthest (false) matches
+        - prune: whether to use bound-based pruning
+        - results: vector of (distance, row) pairs to be filled, best first
+        - stats: scan counters to be filled
+*/
+void scan_topk(MetricType metric, std::vector<float> &featVec, FeatureDB &db, int K, bool ascending, bool prune,
+               std::vector<std::pair<float, int>> &results, ScanStats &stats);
+
+/*
+    Multi-threaded scan_topk
+    The rows are split into blocks of about SCAN_BLOCK_BYTES which the workers share through work stealing,
+    each worker keeps its own top-K and the results are merged at the end
+    The result is identical to scan_topk for any number of threads
+
+    Args:
+        - threads: number of worker threads (1 falls back to scan_topk)
+        - pin: whether to pin worker t to core t
+        - (other arguments as in scan_topk)
+
+    Returns the number of workers actually used (at most one per block, 1 when it falls back to scan_topk)
+*/
+int scan_topk_parallel(MetricType metric, std::vector<float> &featVec, FeatureDB &db, int K, bool ascending, bool prune,
+                        int threads, bool pin, std::vector<std::pair<float, int>> &results, ScanStats &stats);
+
+#endif
@@ -0,0 +1,693 @@
+/*
+    Log-structured store of a feature database
+
+    Files in <csv>.segs/:
+        MANIFEST      - text lines "generation g", "dims d", "next id", "wal id" and "segment id" (oldest first)
+        seg_<id>.bin  - "CBIRSEG1", int32 dims, int64 rows, int64 blob size, uint8 deleted[rows],
+                        float vectors[live rows * dims], char blob[] (0-terminated filenames, sorted)
+        wal_<id>.log  - records of the mutable segment: uint8 op ('P' put or 'D' delete), uint32 name length,
+                        name, float vector[dims] for puts
+        LOCK          - held with flock by the writer
+    Files that the MANIFEST does not name are left over from an interrupted flush or compaction and removed by
+    the next writer.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "segment_store.hpp"
+
+// segment file format identifier
+static const char SEGMENT_MAGIC[] = "CBIRSEG1";
+
+// number of times a reader reads the MANIFEST again when a compaction removed one of its files meanwhile
+#define SEGMENT_READ_RETRIES 8
+
+struct Manifest
+{
+    long generation = 0;
+    int dims = 0;
+    long next = 1;
+    long wal = 0;
+    std::vector<long> segments; // oldest first
+};
+
+static std::string store_dir(const char *csv)
+{
+    return std::string(csv) + ".segs";
+}
+
+static std::string segment_path(const std::string &dir, long id)
+{
+    return dir + "/seg_" + std::to_string(id) + ".bin";
+}
+
+static std::string wal_path(const std::string &dir, long id)
+{
+    return dir + "/wal_" + std::to_string(id) + ".log";
+}
+
+// Returns non-zero if there is no MANIFEST
+static int read_manifest(const std::string &dir, Manifest &m)
+{
+    FILE *fp = fopen((dir + "/MANIFEST").c_str(), "r");
+    if (!fp)
+        return (-1);
+
+    char key[64];
+    long value;
+    m = Manifest();
+    while (fscanf(fp, "%63s %ld", key, &value) == 2)
+    {
+        if (strcmp(key, "generation") == 0)
+            m.generation = value;
+        else if (strcmp(key, "dims") == 0)
+            m.dims = value;
+        else if (strcmp(key, "next") == 0)
+            m.next = value;
+        else if (strcmp(key, "wal") == 0)
+            m.wal = value;
+        else if (strcmp(key, "segment") == 0)
+            m.segments.push_back(value);
+    }
+    fclose(fp);
+    return m.wal > 0 ? 0 : -1;
+}
+
+// Replaces the MANIFEST atomically (readers see either the old or the new one)
+// Returns non-zero if it cannot be written
+static int write_manifest_file(const std::string &dir, const Manifest &m)
+{
+    std::string path = dir + "/MANIFEST", staged = path + ".new";
+    FILE *fp = fopen(staged.c_str(), "w");
+    if (!fp)
+    {
+        printf("Unable to write %s\n", staged.c_str());
+        return (-1);
+    }
+    fprintf(fp, "generation %ld\ndims %d\nnext %ld\nwal %ld\n", m.generation, m.dims, m.next, m.wal);
+    for (long id : m.segments)
+        fprintf(fp, "segment %ld\n", id);
+    if (fclose(fp) != 0 || rename(staged.c_str(), path.c_str()) != 0)
+    {
+        printf("Unable to write %s\n", path.c_str());
+        return (-1);
+    }
+    return (0);
+}
+
+// Writes a segment to seg_<id>.bin (through a staged file, so a segment file is always complete)
+// Returns non-zero if it cannot be written
+static int write_segment(const std::string &dir, const Segment &seg, int dims)
+{
+    std::string path = segment_path(dir, seg.id), staged = path + ".new";
+    FILE *fp = fopen(staged.c_str(), "wb");
+    if (!fp)
+    {
+        printf("Unable to write %s\n", staged.c_str());
+        return (-1);
+    }
+
+    long long rows = seg.size();
+    long long blob_size = 0;
+    std::vector<uint8_t> deleted(rows);
+    for (size_t i = 0; i < seg.size(); i++)
+    {
+        deleted[i] = seg.deleted(i);
+        blob_size += seg.names[i].size() + 1;
+    }
+
+    fwrite(SEGMENT_MAGIC, 1, 8, fp);
+    fwrite(&dims, sizeof(dims), 1, fp);
+    fwrite(&rows, sizeof(rows), 1, fp);
+    fwrite(&blob_size, sizeof(blob_size), 1, fp);
+    fwrite(deleted.data(), 1, rows, fp);
+    for (auto &vec : seg.data)
+        fwrite(vec.data(), sizeof(float), vec.size(), fp);
+    for (const std::string &name : seg.names)
+        fwrite(name.c_str(), 1, name.size() + 1, fp);
+    if (fclose(fp) != 0 || rename(staged.c_str(), path.c_str()) != 0)
+    {
+        printf("Unable to write %s\n", path.c_str());
+        return (-1);
+    }
+    return (0);
+}
+
+// Reads seg_<id>.bin
+// Returns non-zero if it does not exist (e.g. removed by a compaction) or is damaged
+static int read_segment(const std::string &dir, long id, int dims, Segment &seg)
+{
+    FILE *fp = fopen(segment_path(dir, id).c_str(), "rb");
+    if (!fp)
+        return (-1);
+
+    char magic[8];
+    int stored_dims;
+    long long rows, blob_size;
+    if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, SEGMENT_MAGIC, 8) != 0 ||
+        fread(&stored_dims, sizeof(stored_dims), 1, fp) != 1 || stored_dims != dims ||
+        fread(&rows, sizeof(rows), 1, fp) != 1 || fread(&blob_size, sizeof(blob_size), 1, fp) != 1 || rows < 0 ||
+        blob_size < 0 || rows + blob_size > sidecar_remaining(fp))
+    {
+        fclose(fp);
+        return (-1);
+    }
+
+    std::vector<uint8_t> deleted(rows);
+    bool ok = fread(deleted.data(), 1, rows, fp) == (size_t)rows;
+    // the vectors of the live rows and the names must fit in the rest of the file
+    long long live = std::count(deleted.begin(), deleted.end(), (uint8_t)0);
+    if (!ok || live * dims * (long long)sizeof(float) + blob_size > sidecar_remaining(fp))
+    {
+        fclose(fp);
+        return (-1);
+    }
+    std::vector<char> blob(blob_size);
+    seg.id = id;
+    seg.data.assign(rows, std::vector<float>());
+    for (long long i = 0; i < rows && ok; i++)
+    {
+        if (deleted[i])
+            continue;
+        seg.data[i].resize(dims);
+        ok = fread(seg.data[i].data(), sizeof(float), dims, fp) == (size_t)dims;
+    }
+    ok = ok && fread(blob.data(), 1, blob_size, fp) == (size_t)blob_size;
+    fclose(fp);
+    if (!ok || (blob_size > 0 && blob.back() != '\0'))
+        return (-1);
+
+    seg.names.clear();
+    for (const char *p = blob.data(); p < blob.data() + blob_size; p += strlen(p) + 1)
+        seg.names.push_back(p);
+    return seg.names.size() == (size_t)rows ? 0 : -1;
+}
+
+// Appends one record to the log and hands it to the OS, so it survives the writer
+static int write_record(FILE *fp, char op, const std::string &name, const std::vector<float> &vec)
+{
+    uint32_t len = name.size();
+    fwrite(&op, 1, 1, fp);
+    fwrite(&len, sizeof(len), 1, fp);
+    fwrite(name.data(), 1, len, fp);
+    fwrite(vec.data(), sizeof(float), vec.size(), fp);
+    return fflush(fp) == 0 && !ferror(fp) ? 0 : -1;
+}
+
+// Replays the complete records of a log into the rows of the mutable segment (tombstones have an empty vector)
+// valid is set to the length of the complete records, a record cut short by a crash or a concurrent write is ignored
+// Returns non-zero if the log does not exist
+static int read_wal(const std::string &path, int dims, std::map<std::string, std::vector<float>> &rows, long &valid)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp)
+        return (-1);
+
+    char op;
+    uint32_t len;
+    std::string name;
+    std::vector<float> vec(dims);
+    valid = 0;
+    // a length past the end of the log is a record cut short as well
+    while (fread(&op, 1, 1, fp) == 1 && fread(&len, sizeof(len), 1, fp) == 1 && (op == 'P' || op == 'D') &&
+           len <= sidecar_remaining(fp))
+    {
+        name.resize(len);
+        if (fread(name.data(), 1, len, fp) != len)
+            break;
+        if (op == 'P')
+        {
+            if (fread(vec.data(), sizeof(float), dims, fp) != (size_t)dims)
+                break;
+            rows[name] = vec;
+        }
+        else
+            rows[name].clear();
+        valid = ftell(fp);
+    }
+    fclose(fp);
+    return (0);
+}
+
+// Builds the segment of the rows of the mutable segment (already sorted by the map)
+static std::shared_ptr<Segment> memtable_segment(const std::map<std::string, std::vector<float>> &rows)
+{
+    auto seg = std::make_shared<Segment>();
+    for (auto &row : rows)
+    {
+        seg->names.push_back(row.first);
+        seg->data.push_back(row.second);
+    }
+    return seg;
+}
+
+// Takes the writer lock of a store
+// Returns the descriptor of the lock file, or -1 if another process is writing to the store
+static int lock_store(const std::string &dir)
+{
+    int fd = open((dir + "/LOCK").c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+        return (-1);
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        printf("Another process is writing to %s\n", dir.c_str());
+        close(fd);
+        return (-1);
+    }
+    return fd;
+}
+
+// Removes the segment and log files left over from an interrupted flush, compaction or import
+static void remove_unreferenced(const std::string &dir, const Manifest &m)
+{
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return;
+
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL)
+    {
+        long id;
+        char ext[16];
+        const char *name = entry->d_name;
+        bool referenced = false;
+        if (sscanf(name, "seg_%ld.%15s", &id, ext) == 2)
+            referenced = strcmp(ext, "bin") == 0 && std::count(m.segments.begin(), m.segments.end(), id) > 0;
+        else if (sscanf(name, "wal_%ld.%15s", &id, ext) == 2)
+            referenced = strcmp(ext, "log") == 0 && id == m.wal;
+        else
+            continue;
+        if (!referenced)
+            unlink((dir + "/" + name).c_str());
+    }
+    closedir(d);
+}
+
+SegmentStore::~SegmentStore()
+{
+    if (compactor.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        compactor.join();
+    }
+    if (wal)
+        fclose(wal);
+    if (lock_fd >= 0)
+        close(lock_fd);
+}
+
+int SegmentStore::import(const char *csv, FeatureDB &db)
+{
+    std::string dir = store_dir(csv);
+    if (db.size() == 0)
+    {
+        printf("%s has no rows to import\n", csv);
+        return (-1);
+    }
+    mkdir(dir.c_str(), 0755);
+    int fd = lock_store(dir);
+    if (fd < 0)
+        return (-1);
+
+    // ids keep growing across imports, so a reader never mixes files of two versions
+    Manifest m;
+    read_manifest(dir, m);
+    m.dims = db.data[0].size();
+
+    // one sorted segment, the last row of an image wins
+    std::vector<int> order(db.size());
+    for (size_t i = 0; i < db.size(); i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+                     { return strcmp(db.filenames[a], db.filenames[b]) < 0; });
+    Segment seg;
+    seg.id = m.next++;
+    for (size_t k = 0; k < order.size(); k++)
+    {
+        int i = order[k];
+        if (db.data[i].size() != (size_t)m.dims)
+        {
+            printf("%s has rows of %zu and %d values, cannot import it\n", csv, db.data[i].size(), m.dims);
+            close(fd);
+            return (-1);
+        }
+        if (k + 1 < order.size() && strcmp(db.filenames[i], db.filenames[order[k + 1]]) == 0)
+            continue;
+        seg.names.push_back(db.filenames[i]);
+        seg.data.push_back(db.data[i]);
+    }
+
+    int status = write_segment(dir, seg, m.dims);
+    m.wal = m.next++;
+    FILE *fp = status == 0 ? fopen(wal_path(dir, m.wal).c_str(), "wb") : NULL;
+    if (fp)
+        fclose(fp);
+    m.generation++;
+    m.segments.assign(1, seg.id);
+    if (fp == NULL || write_manifest_file(dir, m) != 0)
+        status = -1;
+    else
+        remove_unreferenced(dir, m);
+    close(fd);
+    return status;
+}
+
+int SegmentStore::open(const char *csv)
+{
+    dir = store_dir(csv);
+    Manifest m;
+    if (read_manifest(dir, m) != 0)
+    {
+        printf("%s has no segment store\n", csv);
+        return (-1);
+    }
+    if ((lock_fd = lock_store(dir)) < 0)
+        return (-1);
+    // the MANIFEST may have changed before the lock was taken
+    read_manifest(dir, m);
+    remove_unreferenced(dir, m);
+
+    dims = m.dims;
+    generation = m.generation;
+    next_id = m.next;
+    wal_id = m.wal;
+    runs.clear();
+    for (long id : m.segments)
+    {
+        auto seg = std::make_shared<Segment>();
+        if (read_segment(dir, id, dims, *seg) != 0)
+        {
+            printf("Cannot read %s\n", segment_path(dir, id).c_str());
+            return (-1);
+        }
+        runs.push_back(seg);
+    }
+
+    // replay the log and drop a record cut short by a crash before appending to it
+    long valid = 0;
+    std::string path = wal_path(dir, wal_id);
+    memtable.clear();
+    if (read_wal(path, dims, memtable, valid) != 0 || truncate(path.c_str(), valid) != 0 ||
+        (wal = fopen(path.c_str(), "ab")) == NULL)
+    {
+        printf("Cannot open %s\n", path.c_str());
+        return (-1);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    publish();
+    return (0);
+}
+
+int SegmentStore::put(const std::string &name, const std::vector<float> &vec)
+{
+    if (vec.size() != (size_t)dims || dims == 0)
+    {
+        printf("%s has %zu values, the store holds %d\n", name.c_str(), vec.size(), dims);
+        return (-1);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (write_record(wal, 'P', name, vec) != 0)
+    {
+        printf("Cannot append to %s\n", wal_path(dir, wal_id).c_str());
+        return (-1);
+    }
+    memtable[name] = vec;
+    dirty.store(true, std::memory_order_release);
+    return memtable.size() >= SEGMENT_MEMTABLE_ROWS ? flush_locked() : 0;
+}
+
+int SegmentStore::remove(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (write_record(wal, 'D', name, std::vector<float>()) != 0)
+    {
+        printf("Cannot append to %s\n", wal_path(dir, wal_id).c_str());
+        return (-1);
+    }
+    memtable[name].clear();
+    dirty.store(true, std::memory_order_release);
+    return memtable.size() >= SEGMENT_MEMTABLE_ROWS ? flush_locked() : 0;
+}
+
+int SegmentStore::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return flush_locked();
+}
+
+int SegmentStore::flush_locked()
+{
+    if (memtable.empty())
+        return (0);
+
+    // the new segment and log are complete before the MANIFEST names them
+    auto seg = memtable_segment(memtable);
+    seg->id = next_id++;
+    long new_wal = next_id++;
+    FILE *fp = NULL;
+    if (write_segment(dir, *seg, dims) != 0 || (fp = fopen(wal_path(dir, new_wal).c_str(), "ab")) == NULL)
+        return (-1);
+
+    runs.push_back(seg);
+    long old_wal = wal_id;
+    wal_id = new_wal;
+    generation++;
+    if (write_manifest() != 0)
+    {
+        runs.pop_back();
+        wal_id = old_wal;
+        generation--;
+        fclose(fp);
+        return (-1);
+    }
+
+    // readers that still use the previous MANIFEST read the old log to the end, they hold it open
+    fclose(wal);
+    wal = fp;
+    unlink(wal_path(dir, old_wal).c_str());
+    memtable.clear();
+    publish();
+    if ((int)runs.size() > max_runs)
+        wake.notify_one();
+    return (0);
+}
+
+int SegmentStore::compact()
+{
+    std::vector<std::shared_ptr<const Segment>> inputs;
+    long id;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (compacting || runs.size() < 2)
+            return (0);
+        compacting = true;
+        inputs = runs;
+        id = next_id++;
+    }
+
+    // merge without holding up readers and writers: flushes only append newer segments meanwhile
+    // tombstones can be dropped because the merge reaches down to the oldest segment
+    auto start = std::chrono::steady_clock::now();
+    SegmentView view;
+    view.segments.assign(inputs.rbegin(), inputs.rend());
+    auto merged = std::make_shared<Segment>();
+    merged->id = id;
+    merge_segments(view, false, [&](const std::string &name, const std::vector<float> &vec)
+                   {
+                       merged->names.push_back(name);
+                       merged->data.push_back(vec);
+                   });
+    int status = write_segment(dir, *merged, dims);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    compacting = false;
+    wake.notify_all();
+    if (status != 0)
+        return (-1);
+
+    // swap the merged segment in for its inputs, which are still the oldest segments
+    std::vector<std::shared_ptr<const Segment>> previous = runs;
+    runs.erase(runs.begin(), runs.begin() + inputs.size());
+    runs.insert(runs.begin(), merged);
+    generation++;
+    if (write_manifest() != 0)
+    {
+        runs = previous;
+        generation--;
+        unlink(segment_path(dir, id).c_str());
+        return (-1);
+    }
+    publish();
+
+    // views already handed out keep the inputs in memory, readers of other processes read the MANIFEST again
+    size_t rows = 0;
+    for (auto &seg : inputs)
+    {
+        rows += seg->size();
+        unlink(segment_path(dir, seg->id).c_str());
+    }
+    printf("Compacted %zu segments of %zu rows into %zu rows (%.2f s)\n", inputs.size(), rows, merged->size(),
+           std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    return (0);
+}
+
+void SegmentStore::start_compaction(int max_runs)
+{
+    if (compactor.joinable())
+        return;
+
+    this->max_runs = max_runs;
+    compactor = std::thread([this]()
+                            {
+                                std::unique_lock<std::mutex> lock(mutex);
+                                while (!stopping)
+                                {
+                                    wake.wait(lock, [this]
+                                              { return stopping || (int)runs.size() > this->max_runs; });
+                                    if (stopping)
+                                        break;
+                                    lock.unlock();
+                                    int status = compact();
+                                    lock.lock();
+                                    // a failed compaction is retried after the next flush, a running one is waited for
+                                    if (status != 0 || compacting)
+                                        wake.wait(lock);
+                                } });
+}
+
+std::shared_ptr<const SegmentView> SegmentStore::acquire()
+{
+    // the mutable segment is only frozen into a view when a reader asks for it after a write
+    if (dirty.load(std::memory_order_acquire))
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (dirty.load(std::memory_order_relaxed))
+            publish();
+    }
+    return current.load(std::memory_order_acquire);
+}
+
+size_t SegmentStore::pending()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return memtable.size();
+}
+
+void SegmentStore::publish()
+{
+    auto view = std::make_shared<SegmentView>();
+    view->generation = generation;
+    if (!memtable.empty())
+        view->segments.push_back(memtable_segment(memtable));
+    view->segments.insert(view->segments.end(), runs.rbegin(), runs.rend());
+    current.store(std::move(view), std::memory_order_release);
+    dirty.store(false, std::memory_order_release);
+}
+
+int SegmentStore::write_manifest()
+{
+    Manifest m;
+    m.generation = generation;
+    m.dims = dims;
+    m.next = next_id;
+    m.wal = wal_id;
+    for (auto &seg : runs)
+        m.segments.push_back(seg->id);
+    return write_manifest_file(dir, m);
+}
+
+// Returns true if the database has a segment store
+bool has_segment_store(const char *csv)
+{
+    struct stat st;
+    return stat((store_dir(csv) + "/MANIFEST").c_str(), &st) == 0;
+}
+
+// Reads a consistent view of the store of a database from its files (without the writer lock)
+// Returns non-zero if there is no store or it cannot be read
+int read_segment_view(const char *csv, SegmentView &view)
+{
+    std::string dir = store_dir(csv);
+    for (int attempt = 0; attempt < SEGMENT_READ_RETRIES; attempt++)
+    {
+        Manifest m;
+        if (read_manifest(dir, m) != 0)
+            return (-1);
+
+        // every file named by one MANIFEST, a file removed meanwhile means a newer MANIFEST replaced it
+        bool complete = true;
+        std::map<std::string, std::vector<float>> log_rows;
+        long valid;
+        view.generation = m.generation;
+        view.segments.clear();
+        for (auto it = m.segments.rbegin(); it != m.segments.rend() && complete; ++it)
+        {
+            auto seg = std::make_shared<Segment>();
+            complete = read_segment(dir, *it, m.dims, *seg) == 0;
+            view.segments.push_back(seg);
+        }
+        if (!complete || read_wal(wal_path(dir, m.wal), m.dims, log_rows, valid) != 0)
+            continue;
+        if (!log_rows.empty())
+            view.segments.insert(view.segments.begin(), memtable_segment(log_rows));
+        return (0);
+    }
+    printf("Cannot read a consistent version of %s\n", dir.c_str());
+    return (-1);
+}
+
+// Loads the live rows of the store of a database, in filename order
+// Returns non-zero if there is no store or it cannot be read
+int load_segment_db(const char *csv, FeatureDB &db)
+{
+    SegmentView view;
+    if (read_segment_view(csv, view) != 0)
+        return (-1);
+
+    printf("Reading %s.segs (%zu segments)\n", csv, view.segments.size());
+    merge_segments(view, false, [&](const std::string &name, const std::vector<float> &vec)
+                   {
+                       // the filenames are freed like those allocated by read_image_data_csv
+                       char *fname = new char[name.size() + 1];
+                       strcpy(fname, name.c_str());
+                       db.filenames.push_back(fname);
+                       db.data.push_back(vec);
+                   });
+    return (0);
+}
+
+// Reads the stamp of the store of a database, which changes with every write to it
+// Returns non-zero if there is no store
+int segment_store_stamp(const char *csv, DBStamp &stamp)
+{
+    std::string dir = store_dir(csv);
+    for (int attempt = 0; attempt < SEGMENT_READ_RETRIES; attempt++)
+    {
+        Manifest m;
+        struct stat manifest_st, wal_st;
+        if (stat((dir + "/MANIFEST").c_str(), &manifest_st) != 0 || read_manifest(dir, m) != 0)
+            return (-1);
+        // the log of this MANIFEST is removed once a flush has published the next one
+        if (stat(wal_path(dir, m.wal).c_str(), &wal_st) != 0)
+            continue;
+
+        long long manifest_ns = (long long)manifest_st.st_mtim.tv_sec * 1000000000LL + manifest_st.st_mtim.tv_nsec;
+        long long wal_ns = (long long)wal_st.st_mtim.tv_sec * 1000000000LL + wal_st.st_mtim.tv_nsec;
+        stamp.size = ((long long)m.generation << 40) + wal_st.st_size;
+        stamp.mtime_ns = std::max(manifest_ns, wal_ns);
+        return (0);
+    }
+    return (-1);
+}
@@ -0,0 +1,180 @@
+/*
+    Log-structured store of a feature database (immutable sorted segments, a mutable segment and tombstones)
+
+    The rows of a database live in <csv>.segs/ once the store has been created (segments import):
+        - immutable segments, each sorted by filename and never modified after it is written
+        - a small mutable segment held in memory by the writer and recorded in an append-only log, so rows can be
+          added, replaced and deleted (a tombstone row) without rewriting anything
+        - a MANIFEST naming the live segments and log, replaced atomically with a rename
+    A row's newest version wins: the mutable segment shadows the segments, and newer segments shadow older ones.
+    Once the mutable segment reaches SEGMENT_MEMTABLE_ROWS it is written as a new segment and a fresh log is
+    started, and a background thread merges the segments into one (dropping shadowed rows and tombstones) once
+    there are more than SEGMENT_MAX_RUNS of them.
+
+    Readers always see a consistent set of segments: within the writer a view is an immutable list of shared
+    segments swapped in atomically (as in snapshot.hpp), and other processes read the files named by one
+    MANIFEST (trying again if a compaction removed one of them meanwhile) and the complete records of its log.
+    load_feature_db and db_stamp read the store instead of the csv when there is one, so every tool and sidecar
+    follows it. One process writes at a time (flock on <csv>.segs/LOCK).
+*/
+
+#ifndef SEGMENT_STORE_H
+#define SEGMENT_STORE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "feature_db.hpp"
+
+// number of rows of the mutable segment at which it is written as an immutable segment
+#define SEGMENT_MEMTABLE_ROWS 1024
+
+// number of segments above which the background compaction merges them
+#define SEGMENT_MAX_RUNS 4
+
+// one immutable run of rows sorted by filename
+struct Segment
+{
+    long id = 0;                          // file id (0 for the mutable segment)
+    std::vector<std::string> names;       // image filenames, sorted
+    std::vector<std::vector<float>> data; // feature vector of each row (empty for a tombstone)
+
+    size_t size() const { return names.size(); }
+    bool deleted(size_t i) const { return data[i].empty(); }
+};
+
+// consistent set of segments, newest first
+struct SegmentView
+{
+    long generation = 0; // manifest generation the view was read from
+    std::vector<std::shared_ptr<const Segment>> segments;
+};
+
+class SegmentStore
+{
+public:
+    ~SegmentStore();
+
+    // Opens the store of a database for writing: takes the writer lock and replays the log into the mutable segment
+    // Args: csv - csv database filename (the store lives in <csv>.segs)
+    // Returns non-zero if there is no store or another process is writing to it
+    int open(const char *csv);
+
+    // Replaces the contents of the store (creating it if needed) with the rows of a database, as one segment
+    // Args: csv - csv database filename
+    //       db  - rows of the new contents
+    // Returns non-zero if the store cannot be written or another process is writing to it
+    static int import(const char *csv, FeatureDB &db);
+
+    // Adds a row, or replaces the row of the same image
+    // Returns non-zero if the vector does not match the dimension of the store or the log cannot be written
+    int put(const std::string &name, const std::vector<float> &vec);
+
+    // Deletes the row of an image (a tombstone that shadows older versions until the next compaction)
+    // Returns non-zero if the log cannot be written
+    int remove(const std::string &name);
+
+    // Writes the mutable segment as an immutable segment and starts a fresh log
+    // Returns non-zero if the segment cannot be written
+    int flush();
+
+    // Merges every immutable segment into one, dropping shadowed rows and tombstones
+    // Runs alongside readers and writers, which only wait for the final swap of the segment list
+    // Returns non-zero if the merged segment cannot be written
+    int compact();
+
+    // Starts the background thread that compacts the store once there are more than max_runs segments
+    void start_compaction(int max_runs = SEGMENT_MAX_RUNS);
+
+    // Current view of the store, including the rows written so far (not modified once published)
+    std::shared_ptr<const SegmentView> acquire();
+
+    // Number of rows in the mutable segment
+    size_t pending();
+
+private:
+    // Publishes a new view of the segments and the mutable segment (the mutex is held)
+    void publish();
+
+    // Writes the MANIFEST for the current segments and log (the mutex is held)
+    int write_manifest();
+
+    int flush_locked();
+
+    std::string dir;
+    int lock_fd = -1;
+    int dims = 0;
+    long generation = 0;
+    long next_id = 1;
+    long wal_id = 0;
+    FILE *wal = nullptr;
+    std::vector<std::shared_ptr<const Segment>> runs; // immutable segments, oldest first
+    std::map<std::string, std::vector<float>> memtable;
+    std::atomic<std::shared_ptr<const SegmentView>> current;
+    std::atomic<bool> dirty{true};
+    bool compacting = false;
+
+    std::thread compactor;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    int max_runs = SEGMENT_MAX_RUNS;
+};
+
+// Returns true if the database has a segment store
+bool has_segment_store(const char *csv);
+
+// Reads a consistent view of the store of a database from its files (without the writer lock)
+// Args: csv  - csv database filename
+//       view - view to be filled, the rows of the log form its newest segment
+// Returns non-zero if there is no store or it cannot be read
+int read_segment_view(const char *csv, SegmentView &view);
+
+// Visits the newest version of every row of a view in filename order
+// Args: view            - segments, newest first
+//       keep_tombstones - also visit deleted rows (with an empty vector)
+//       fn              - called with the filename and feature vector of each row
+template <typename F>
+void merge_segments(const SegmentView &view, bool keep_tombstones, F fn)
+{
+    size_t nsegs = view.segments.size();
+    std::vector<size_t> pos(nsegs, 0);
+    for (;;)
+    {
+        // the smallest filename among the segments, taken from the newest segment that has it
+        int best = -1;
+        for (size_t s = 0; s < nsegs; s++)
+            if (pos[s] < view.segments[s]->size() &&
+                (best < 0 || view.segments[s]->names[pos[s]] < view.segments[best]->names[pos[best]]))
+                best = s;
+        if (best < 0)
+            return;
+
+        const Segment &seg = *view.segments[best];
+        const std::string &name = seg.names[pos[best]];
+        if (keep_tombstones || !seg.deleted(pos[best]))
+            fn(name, seg.data[pos[best]]);
+
+        // older versions of the row are shadowed
+        for (size_t s = best + 1; s < nsegs; s++)
+            if (pos[s] < view.segments[s]->size() && view.segments[s]->names[pos[s]] == name)
+                pos[s]++;
+        pos[best]++;
+    }
+}
+
+// Loads the live rows of the store of a database, in filename order
+// Returns non-zero if there is no store or it cannot be read
+int load_segment_db(const char *csv, FeatureDB &db);
+
+// Reads the stamp of the store of a database, which changes with every write to it
+// (size is the manifest generation shifted by 40 bits plus the size of the log, mtime the newest of the two files)
+// Returns non-zero if there is no store
+int segment_store_stamp(const char *csv, DBStamp &stamp);
+
+#endif
@@ -0,0 +1,207 @@
+/*
+    Maintains the segment store of a feature database (see segment_store.hpp)
+
+    import:  replaces the contents of the store with the rows of the csv (creating the store)
+    apply:   adds, replaces and deletes rows read from a file or stdin while readers keep querying the store,
+             with background compaction; a line in the csv format of read adds or replaces a row, -<filename>
+             deletes one
+    compact: writes the mutable segment and merges every segment into one
+    export:  writes the live rows back to the csv (keeping its header) for tools that parse it directly
+    stats:   prints the segments, the live rows and the tombstones
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "csv_util.h"
+#include "feature_db.hpp"
+#include "segment_store.hpp"
+
+// Prints the segments of a view and the number of live rows
+static void print_view(const SegmentView &view)
+{
+    size_t live = 0, tombstones = 0;
+    merge_segments(view, true, [&](const std::string &, const std::vector<float> &vec)
+                   { vec.empty() ? tombstones++ : live++; });
+    printf("Generation %ld: %zu live rows, %zu tombstones in %zu segments\n", view.generation, live, tombstones,
+           view.segments.size());
+    for (auto &seg : view.segments)
+    {
+        size_t deleted = 0;
+        for (size_t i = 0; i < seg->size(); i++)
+            deleted += seg->deleted(i);
+        printf("  %-10s %10zu rows %10zu tombstones\n", seg->id > 0 ? ("seg_" + std::to_string(seg->id)).c_str() : "log",
+               seg->size(), deleted);
+    }
+}
+
+// Applies the changes listed in a file (- for stdin) to the store
+// Returns non-zero if the store cannot be written
+static int apply_changes(SegmentStore &store, const char *path)
+{
+    FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!fp)
+    {
+        printf("Cannot read %s\n", path);
+        return (-1);
+    }
+
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    long puts = 0, deletes = 0, skipped = 0;
+    int status = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<float> vec;
+    while (status == 0 && (len = getline(&line, &cap, fp)) >= 0)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '#' || line[0] == '\0')
+            continue;
+        if (line[0] == '-')
+        {
+            status = store.remove(line + 1);
+            deletes++;
+            continue;
+        }
+
+        char *comma = strchr(line, ',');
+        if (comma == NULL)
+        {
+            skipped++;
+            continue;
+        }
+        *comma = '\0';
+        vec.clear();
+        for (char *field = strtok(comma + 1, ","); field; field = strtok(NULL, ","))
+            vec.push_back(strtof(field, NULL));
+        // a row of the wrong length is reported and skipped, it does not stop the stream
+        if (store.put(line, vec) != 0)
+            skipped++;
+        else
+            puts++;
+    }
+    free(line);
+    if (fp != stdin)
+        fclose(fp);
+
+    printf("Applied %ld puts and %ld deletes, skipped %ld lines (%.2f s), %zu rows in the mutable segment\n", puts,
+           deletes, skipped, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+           store.pending());
+    return status;
+}
+
+// Writes the live rows to <csv>.new with the header of the csv and renames it over the csv
+// Returns non-zero if the csv cannot be written
+static int export_csv(char *csv)
+{
+    FeatureDB db;
+    if (load_segment_db(csv, db) != 0)
+        return (-1);
+
+    std::string staged = std::string(csv) + ".new";
+    FILE *out = fopen(staged.c_str(), "w");
+    if (!out)
+    {
+        printf("Unable to write %s\n", staged.c_str());
+        return (-1);
+    }
+    FILE *in = fopen(csv, "r");
+    char line[8192];
+    while (in && fgets(line, sizeof(line), in) && line[0] == '#')
+        fputs(line, out);
+    if (in)
+        fclose(in);
+
+    // same format as append_image_data_csv
+    for (size_t i = 0; i < db.size(); i++)
+    {
+        fputs(db.filenames[i], out);
+        for (float v : db.data[i])
+            fprintf(out, ",%.4f", v);
+        fputc('\n', out);
+    }
+    if (fclose(out) != 0 || rename(staged.c_str(), csv) != 0)
+    {
+        printf("Unable to write %s\n", csv);
+        return (-1);
+    }
+    printf("Wrote %zu rows to %s\n", db.size(), csv);
+    return (0);
+}
+
+/*
+    Creates, updates, compacts or exports the segment store of the database of a feature mode
+
+    Argv:
+        - command: import, apply, compact, export or stats
+        - feature_mode: feature mode whose database is used (baseline, hist, hist2, multihist, sobel, hsv, face, dnn, dnn_hsv)
+        - apply: [file]: optional, file listing the changes (default - for stdin)
+*/
+int main(int argc, char *argv[])
+{
+    char csv[256];
+    MetricType metric;
+
+    // check for sufficient arguments
+    if (argc < 3)
+    {
+        printf("usage: %s import|compact|export|stats <feature mode>\n", argv[0]);
+        printf("       %s apply <feature mode> [<file> | -]\n", argv[0]);
+        exit(-1);
+    }
+
+    const char *command = argv[1];
+    if (feature_mode_db(argv[2], csv, metric) != 0)
+    {
+        printf("Invalid feature mode %s\n", argv[2]);
+        exit(-1);
+    }
+
+    if (strcmp(command, "import") == 0)
+    {
+        // read the csv itself, not the current contents of the store
+        FeatureDB db;
+        if (read_image_data_csv(csv, db.filenames, db.data) != 0 || SegmentStore::import(csv, db) != 0)
+            exit(-1);
+        printf("Imported %zu rows of %s into %s.segs\n", db.size(), csv, csv);
+    }
+    else if (strcmp(command, "apply") == 0)
+    {
+        SegmentStore store;
+        if (store.open(csv) != 0)
+            exit(-1);
+        store.start_compaction();
+        if (apply_changes(store, argc > 3 ? argv[3] : "-") != 0)
+            exit(-1);
+        print_view(*store.acquire());
+    }
+    else if (strcmp(command, "compact") == 0)
+    {
+        SegmentStore store;
+        if (store.open(csv) != 0 || store.flush() != 0 || store.compact() != 0)
+            exit(-1);
+        print_view(*store.acquire());
+    }
+    else if (strcmp(command, "export") == 0)
+    {
+        if (export_csv(csv) != 0)
+            exit(-1);
+    }
+    else if (strcmp(command, "stats") == 0)
+    {
+        SegmentView view;
+        if (read_segment_view(csv, view) != 0)
+            exit(-1);
+        print_view(view);
+    }
+    else
+    {
+        printf("Invalid command %s (use import, apply, compact, export or stats)\n", command);
+        exit(-1);
+    }
+
+    return (0);
+}
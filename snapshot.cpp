@@ -0,0 +1,95 @@
+/*
+    Reference-counted snapshots of a feature database
+*/
+
+#include <chrono>
+#include <cstdio>
+#include "snapshot.hpp"
+
+SnapshotDB::~SnapshotDB()
+{
+    if (watcher.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        watcher.join();
+    }
+}
+
+int SnapshotDB::load(std::shared_ptr<Snapshot> &snap, DBStamp &loaded)
+{
+    DBStamp after;
+    char path[256];
+    if (db_stamp(csv.c_str(), loaded) != 0)
+        return (-1);
+
+    // the metric and projection belong to the version being loaded
+    snap = std::make_shared<Snapshot>();
+    if (feature_mode_db(mode.c_str(), path, snap->metric) != 0)
+        return (-1);
+    snap->reduced = load_db_projection(path, snap->proj) == 0;
+    if (load_feature_db(path, snap->db) != 0)
+        return (-1);
+
+    // a csv replaced while it was being read is loaded again on the next check
+    if (db_stamp(csv.c_str(), after) != 0 || !(after == loaded))
+        return (-1);
+
+    // everything a query needs is prepared before the snapshot is published
+    if (prune)
+        load_bounds(path, snap->db, snap->metric);
+    return (0);
+}
+
+int SnapshotDB::open(const char *feature_mode, bool prune)
+{
+    char path[256];
+    MetricType metric;
+    if (feature_mode_db(feature_mode, path, metric) != 0)
+        return (-1);
+    this->mode = feature_mode;
+    this->csv = path;
+    this->prune = prune;
+
+    std::shared_ptr<Snapshot> snap;
+    if (load(snap, stamp) != 0)
+        return (-1);
+    current.store(snap, std::memory_order_release);
+    versions.store(1, std::memory_order_relaxed);
+    return (0);
+}
+
+void SnapshotDB::watch(int interval_ms)
+{
+    if (watcher.joinable())
+        return;
+
+    watcher = std::thread([this, interval_ms]()
+                          {
+                              std::unique_lock<std::mutex> lock(mutex);
+                              while (!wake.wait_for(lock, std::chrono::milliseconds(interval_ms), [this]
+                                                    { return stopping; }))
+                              {
+                                  DBStamp now;
+                                  if (db_stamp(csv.c_str(), now) != 0 || now == stamp)
+                                      continue;
+
+                                  // build the new version without holding up the queries
+                                  lock.unlock();
+                                  std::shared_ptr<Snapshot> snap;
+                                  DBStamp loaded;
+                                  int status = load(snap, loaded);
+                                  lock.lock();
+                                  if (status != 0)
+                                      continue;
+
+                                  // swap it in, the old snapshot lives on until its last reader drops it
+                                  current.store(std::move(snap), std::memory_order_release);
+                                  stamp = loaded;
+                                  long v = versions.fetch_add(1, std::memory_order_relaxed) + 1;
+                                  printf("Published snapshot %ld of %s\n", v, csv.c_str());
+                              } });
+}
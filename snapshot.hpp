@@ -0,0 +1,78 @@
+/*
+    Reference-counted snapshots of a feature database for long-running query loops
+
+    The loaded database is published, together with the metric and PCA projection of that version, as a snapshot that is never modified afterwards. A query takes the current
+    snapshot with an atomic load and keeps it alive for as long as it holds the pointer. Readers never wait on the
+    reloader: a new version is loaded and prepared off to the side and only the pointer swap is shared with them
+    (std::atomic<std::shared_ptr> is not lock-free in libstdc++, but its internal lock is held only for that swap).
+    A background thread watches the csv, loads a new version when readfiles publishes one and swaps it in
+    atomically (RCU-style): queries already running finish on the old snapshot, which is freed with its last
+    reader, and the following queries see the new one.
+*/
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "distance.hpp"
+#include "feature_db.hpp"
+#include "pca.hpp"
+
+// default interval between two checks of the csv by the watcher
+#define SNAPSHOT_WATCH_MS 1000
+
+// one published version of a database with everything a query on it needs
+// (a re-index with -pca or pca_fit -apply changes the metric and the vectors together)
+struct Snapshot
+{
+    FeatureDB db;
+    MetricType metric = SSD; // distance metric of the version (ssd once it is reduced with PCA)
+    bool reduced = false;    // the version stores projected vectors, queries are projected with proj
+    PCAProjection proj;
+};
+
+class SnapshotDB
+{
+public:
+    ~SnapshotDB();
+
+    // Loads the current version of the database of a feature mode and publishes it as the first snapshot
+    // Args: feature_mode - feature mode whose database is served (its metric is read again with every version)
+    //       prune        - whether to prepare the pruning bounds
+    // Returns non-zero if the database cannot be loaded
+    int open(const char *feature_mode, bool prune);
+
+    // Current snapshot (not modified once published)
+    std::shared_ptr<Snapshot> acquire() const { return current.load(std::memory_order_acquire); }
+
+    // Number of snapshots published so far
+    long version() const { return versions.load(std::memory_order_relaxed); }
+
+    // Starts the background thread that checks the csv every interval_ms and publishes a new snapshot
+    // when the csv has changed
+    void watch(int interval_ms = SNAPSHOT_WATCH_MS);
+
+private:
+    // Loads a complete version of the csv
+    // Returns non-zero if it cannot be loaded or was replaced while being read
+    int load(std::shared_ptr<Snapshot> &snap, DBStamp &loaded);
+
+    std::string mode;
+    std::string csv;
+    bool prune = false;
+    DBStamp stamp; // stamp of the csv version of the current snapshot
+    std::atomic<std::shared_ptr<Snapshot>> current;
+    std::atomic<long> versions{0};
+
+    std::thread watcher;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
+
+#endif
@@ -0,0 +1,222 @@
+/*
+    Streaming top-K query over a csv database
+*/
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include "stream_scan.hpp"
+
+// One row of a csv database
+struct StreamRow
+{
+    std::string name;
+    std::vector<float> data;
+};
+
+// Reads the rows of a csv database one at a time, skipping header lines
+// The values are parsed like read_image_data_csv does, so they are identical to those of a loaded database
+class RowReader
+{
+public:
+    ~RowReader()
+    {
+        if (fp)
+            fclose(fp);
+        free(line);
+    }
+
+    int open(const char *csv)
+    {
+        fp = fopen(csv, "r");
+        return fp ? 0 : -1;
+    }
+
+    // Reads the next row, returns false at the end of the file
+    bool next(StreamRow &row)
+    {
+        ssize_t len;
+        while ((len = getline(&line, &cap, fp)) >= 0)
+        {
+            if (line[0] == '#')
+                continue;
+            while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+                line[--len] = '\0';
+            char *comma = strchr(line, ',');
+            if (comma == NULL)
+                continue;
+
+            row.name.assign(line, comma - line);
+            row.data.clear();
+            for (char *p = comma + 1;; )
+            {
+                char *end = strchr(p, ',');
+                if (end)
+                    *end = '\0';
+                row.data.push_back(atof(p));
+                if (end == NULL)
+                    break;
+                p = end + 1;
+            }
+            return true;
+        }
+        return false;
+    }
+
+private:
+    FILE *fp = nullptr;
+    char *line = nullptr;
+    size_t cap = 0;
+};
+
+/*
+    Parses a csv database on a reader thread and calls fn on each row, in file order, on the calling thread
+    The rows travel in a fixed set of reused batches, so memory does not grow with the database
+
+    Args:
+        - csv: csv database filename
+        - fn: called with each row, returns false to stop early
+    Returns non-zero if the csv cannot be opened
+*/
+static int stream_rows(const char *csv, const std::function<bool(StreamRow &)> &fn)
+{
+    RowReader reader;
+    if (reader.open(csv) != 0)
+    {
+        printf("Unable to open feature file %s\n", csv);
+        return (-1);
+    }
+
+    struct Batch
+    {
+        std::vector<StreamRow> rows = std::vector<StreamRow>(STREAM_BATCH_ROWS);
+        int n = 0;
+    };
+    std::vector<Batch> batches(STREAM_QUEUE_BATCHES);
+    std::deque<int> empty, filled;
+    for (int b = 0; b < STREAM_QUEUE_BATCHES; b++)
+        empty.push_back(b);
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool done = false;     // the reader has reached the end of the file
+    bool stopping = false; // the scorer does not want more rows
+
+    std::thread parser([&]()
+                       {
+                           for (;;)
+                           {
+                               int b;
+                               {
+                                   std::unique_lock<std::mutex> lock(mutex);
+                                   changed.wait(lock, [&] { return !empty.empty() || stopping; });
+                                   if (stopping)
+                                       break;
+                                   b = empty.front();
+                                   empty.pop_front();
+                               }
+
+                               Batch &batch = batches[b];
+                               batch.n = 0;
+                               while (batch.n < STREAM_BATCH_ROWS && reader.next(batch.rows[batch.n]))
+                                   batch.n++;
+
+                               std::lock_guard<std::mutex> lock(mutex);
+                               filled.push_back(b);
+                               if (batch.n < STREAM_BATCH_ROWS)
+                                   done = true;
+                               changed.notify_all();
+                               if (done)
+                                   break;
+                           } });
+
+    for (;;)
+    {
+        int b;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return !filled.empty() || done; });
+            if (filled.empty())
+                break;
+            b = filled.front();
+            filled.pop_front();
+        }
+
+        bool more = true;
+        Batch &batch = batches[b];
+        for (int i = 0; i < batch.n && more; i++)
+            more = fn(batch.rows[i]);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        empty.push_back(b);
+        if (!more)
+            stopping = true;
+        changed.notify_all();
+        if (!more)
+            break;
+    }
+
+    parser.join();
+    return (0);
+}
+
+int stream_topk(const char *csv, MetricType metric, std::vector<float> &featVec, int K, bool ascending,
+                std::vector<std::pair<float, std::string>> &results, ScanStats &stats)
+{
+    TopK top(K, ascending);
+    std::unordered_map<int, std::string> names; // names of the rows that entered the top-K
+    int index = 0;
+
+    int status = stream_rows(csv, [&](StreamRow &row)
+                             {
+                                 int i = index++;
+                                 float dist = apply_metric(metric, featVec, row.data);
+                                 stats.rows++;
+
+                                 // rows come in increasing order, so a tie with the current K-th match loses
+                                 bool kept = !top.full() || (ascending ? dist < top.bound() : dist > top.bound());
+                                 if (!kept)
+                                     return true;
+                                 top.push(dist, i);
+                                 names[i] = std::move(row.name);
+
+                                 // forget the names of the rows that have dropped out again
+                                 if ((int)names.size() > 2 * K + 64)
+                                 {
+                                     TopK current = top;
+                                     std::vector<std::pair<float, int>> kept_rows;
+                                     current.sorted(kept_rows);
+                                     std::unordered_map<int, std::string> still;
+                                     for (auto &r : kept_rows)
+                                         still[r.second] = std::move(names[r.second]);
+                                     names.swap(still);
+                                 }
+                                 return true; });
+    if (status != 0)
+        return status;
+
+    std::vector<std::pair<float, int>> kept_rows;
+    top.sorted(kept_rows);
+    results.clear();
+    for (auto &r : kept_rows)
+        results.push_back({r.first, names[r.second]});
+    return (0);
+}
+
+int stream_find_row(const char *csv, const char *name, std::vector<float> &featVec)
+{
+    bool found = false;
+    int status = stream_rows(csv, [&](StreamRow &row)
+                             {
+                                 if (row.name != name)
+                                     return true;
+                                 featVec.swap(row.data);
+                                 found = true;
+                                 return false; });
+    return (status == 0 && found) ? 0 : -1;
+}
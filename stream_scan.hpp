@@ -0,0 +1,47 @@
+/*
+    Streaming top-K query over a csv database
+
+    Instead of loading the whole database, the csv is parsed one row at a time by a reader thread and each row
+    is scored by the calling thread as soon as it arrives, offered to a bounded top-K and discarded. Only a few
+    batches of rows are in flight between the two threads and only the names of the kept rows are stored, so
+    memory stays constant in the size of the database and parsing overlaps with scoring. Databases larger than
+    the available memory can be queried this way.
+*/
+
+#ifndef STREAM_SCAN_H
+#define STREAM_SCAN_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "distance.hpp"
+#include "scan.hpp"
+
+// rows handed from the reader thread to the scorer at a time
+#define STREAM_BATCH_ROWS 256
+
+// batches in flight between the reader thread and the scorer
+#define STREAM_QUEUE_BATCHES 4
+
+/*
+    Scores every row of a csv database against the feature vector while it is being parsed
+    The matches are the same as those of scan_topk on the loaded database
+
+    Args:
+        - csv: csv database filename
+        - metric: distance metric
+        - featVec: query feature vector
+        - K: number of matches to keep
+        - ascending: whether to keep the closest (true) or the furthest (false) matches
+        - results: vector of (distance, filename) pairs to be filled, best first
+        - stats: scan counters to be filled (no rows are pruned)
+    Returns non-zero if the csv cannot be opened
+*/
+int stream_topk(const char *csv, MetricType metric, std::vector<float> &featVec, int K, bool ascending,
+                std::vector<std::pair<float, std::string>> &results, ScanStats &stats);
+
+// Reads the stored feature vector of one image by streaming through a csv database
+// Returns non-zero if the csv cannot be opened or has no row with that name
+int stream_find_row(const char *csv, const char *name, std::vector<float> &featVec);
+
+#endif
@@ -0,0 +1,212 @@
+/*
+    Packed store of pre-decoded thumbnails
+
+    File layout:
+        char magic[8], int32 side, int32 reserved, int64 rows, int64 index offset
+        rows x (side * side * 3 bytes) - BGR thumbnails, each in the top-left corner of its square slot
+        index: int32 sizes[rows][2] (width, height), int32 sorted_rows[rows] (rows in name order),
+               uint64 name_offsets[rows], then a blob with the 0-terminated root and names
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <numeric>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "thumbnails.hpp"
+
+#define THUMBNAIL_MAGIC "CBIRTHM1"
+
+// size of the fixed file header
+static const long long HEADER_SIZE = 32;
+
+ThumbnailWriter::~ThumbnailWriter()
+{
+    if (fp)
+        close();
+}
+
+int ThumbnailWriter::open(const char *path, int side, const char *root)
+{
+    // the store is written next to the current one and renamed over it by close, because running queries
+    // may have the current one mapped (truncating a mapped file kills them with SIGBUS)
+    this->path = path;
+    staged = this->path + ".new";
+    fp = fopen(staged.c_str(), "wb");
+    if (fp == NULL)
+    {
+        printf("Unable to open output file %s\n", staged.c_str());
+        return (-1);
+    }
+    this->side = side;
+    this->root = root;
+    slot.assign((size_t)side * side * 3, 0);
+
+    // the row count and index offset are filled in by close
+    char header[HEADER_SIZE] = {0};
+    memcpy(header, THUMBNAIL_MAGIC, 8);
+    memcpy(header + 8, &side, sizeof(side));
+    fwrite(header, 1, HEADER_SIZE, fp);
+    return (0);
+}
+
+void ThumbnailWriter::add(const char *name, cv::Mat &src)
+{
+    if (fp == NULL)
+        return;
+
+    // shrink so that the longer side fits the slot (small images are kept as they are)
+    double scale = std::min(1.0, (double)side / std::max(src.cols, src.rows));
+    int w = std::max(1, (int)(src.cols * scale));
+    int h = std::max(1, (int)(src.rows * scale));
+    cv::Mat thumb;
+    if (w != src.cols || h != src.rows)
+        cv::resize(src, thumb, cv::Size(w, h), 0, 0, cv::INTER_AREA);
+    else
+        thumb = src;
+
+    std::fill(slot.begin(), slot.end(), 0);
+    for (int i = 0; i < h; i++)
+        memcpy(slot.data() + (size_t)i * side * 3, thumb.ptr<unsigned char>(i), (size_t)w * 3);
+    fwrite(slot.data(), 1, slot.size(), fp);
+
+    names.push_back(name);
+    sizes.push_back(w);
+    sizes.push_back(h);
+}
+
+int ThumbnailWriter::close()
+{
+    if (fp == NULL)
+        return (-1);
+
+    long long rows = names.size();
+    long long index_offset = HEADER_SIZE + rows * (long long)slot.size();
+
+    std::vector<int32_t> sorted_rows(rows);
+    std::iota(sorted_rows.begin(), sorted_rows.end(), 0);
+    std::sort(sorted_rows.begin(), sorted_rows.end(), [&](int32_t a, int32_t b)
+              { return names[a] < names[b]; });
+
+    // names are stored after the root in the blob
+    std::vector<uint64_t> name_offsets(rows);
+    uint64_t offset = root.size() + 1;
+    for (long long i = 0; i < rows; i++)
+    {
+        name_offsets[i] = offset;
+        offset += names[i].size() + 1;
+    }
+
+    fwrite(sizes.data(), sizeof(int32_t), sizes.size(), fp);
+    fwrite(sorted_rows.data(), sizeof(int32_t), rows, fp);
+    fwrite(name_offsets.data(), sizeof(uint64_t), rows, fp);
+    fwrite(root.c_str(), 1, root.size() + 1, fp);
+    for (std::string &name : names)
+        fwrite(name.c_str(), 1, name.size() + 1, fp);
+
+    // complete the header
+    fseek(fp, 16, SEEK_SET);
+    fwrite(&rows, sizeof(rows), 1, fp);
+    fwrite(&index_offset, sizeof(index_offset), 1, fp);
+
+    int ret = fclose(fp) == 0 && rename(staged.c_str(), path.c_str()) == 0 ? 0 : -1;
+    fp = nullptr;
+    if (ret != 0)
+        printf("Unable to write %s\n", path.c_str());
+    return ret;
+}
+
+ThumbnailStore::~ThumbnailStore()
+{
+    if (map)
+        munmap(map, map_size);
+}
+
+int ThumbnailStore::open(const char *path)
+{
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return (-1);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < HEADER_SIZE)
+    {
+        ::close(fd);
+        return (-1);
+    }
+    map_size = st.st_size;
+    map = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        map = nullptr;
+        return (-1);
+    }
+
+    const char *p = (const char *)map;
+    long long n, index_offset;
+    memcpy(&side, p + 8, sizeof(side));
+    memcpy(&n, p + 16, sizeof(n));
+    memcpy(&index_offset, p + 24, sizeof(index_offset));
+    // an unfinished store (readfiles interrupted) has no index
+    // the name blob follows the index and must end with a terminator, so no name can run past the map
+    if (memcmp(p, THUMBNAIL_MAGIC, 8) != 0 || n <= 0 || side <= 0 || side > 65536 ||
+        index_offset != HEADER_SIZE + n * (long long)side * side * 3 || index_offset + n * 20 >= (long long)map_size ||
+        p[map_size - 1] != '\0')
+    {
+        munmap(map, map_size);
+        map = nullptr;
+        return (-1);
+    }
+
+    rows = n;
+    pixels = (const unsigned char *)p + HEADER_SIZE;
+    p += index_offset;
+    sizes = (const int32_t *)p;
+    p += n * 2 * sizeof(int32_t);
+    sorted_rows = (const int32_t *)p;
+    p += n * sizeof(int32_t);
+    name_offsets = (const uint64_t *)p;
+    p += n * sizeof(uint64_t);
+    blob = p;
+    root_dir = blob;
+
+    // every name, row and size must stay within the file and the slots
+    uint64_t blob_size = (const char *)map + map_size - blob;
+    for (long long i = 0; i < n; i++)
+    {
+        if (name_offsets[i] >= blob_size || sorted_rows[i] < 0 || sorted_rows[i] >= n || sizes[2 * i] < 1 ||
+            sizes[2 * i] > side || sizes[2 * i + 1] < 1 || sizes[2 * i + 1] > side)
+        {
+            munmap(map, map_size);
+            map = nullptr;
+            return (-1);
+        }
+    }
+    return (0);
+}
+
+int ThumbnailStore::find(const char *name) const
+{
+    // binary search over the rows in name order
+    size_t lo = 0, hi = rows;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        int cmp = strcmp(blob + name_offsets[sorted_rows[mid]], name);
+        if (cmp == 0)
+            return sorted_rows[mid];
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (-1);
+}
+
+cv::Mat ThumbnailStore::thumbnail(int row) const
+{
+    unsigned char *slot = (unsigned char *)pixels + (size_t)row * side * side * 3;
+    return cv::Mat(sizes[2 * row + 1], sizes[2 * row], CV_8UC3, slot, (size_t)side * 3);
+}
@@ -0,0 +1,86 @@
+/*
+    Packed store of pre-decoded thumbnails
+
+    readfiles can write a BGR thumbnail of every image it processes into one file (one fixed-size slot per row,
+    in the order of the csv rows). cbir maps the file and shows the thumbnails of its matches directly instead of
+    decoding the original images.
+*/
+
+#ifndef THUMBNAILS_H
+#define THUMBNAILS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "opencv2/opencv.hpp"
+
+// default thumbnail store (in the working directory, next to the csv databases)
+#define THUMBNAIL_FILE "thumbnails.bin"
+
+// default length of the longer side of a thumbnail
+#define THUMBNAIL_SIDE 256
+
+class ThumbnailWriter
+{
+public:
+    ~ThumbnailWriter();
+
+    // Starts a new version of the store in <path>.new (the current one stays readable until close)
+    // Args: path - store filename
+    //       side - length of the longer side of the thumbnails (size of the square slots)
+    //       root - corpus root directory the image names are relative to
+    // Returns non-zero if the file cannot be created
+    int open(const char *path, int side, const char *root);
+
+    // Appends the thumbnail of an image as the next row
+    void add(const char *name, cv::Mat &src);
+
+    // Writes the name index, completes the file and renames it over the current store
+    // Returns non-zero if the file could not be written
+    int close();
+
+private:
+    FILE *fp = nullptr;
+    std::string path;   // store being replaced
+    std::string staged; // <path>.new, renamed over path by close
+    int side = 0;
+    std::string root;
+    std::vector<std::string> names;
+    std::vector<int32_t> sizes; // width and height of each thumbnail
+    std::vector<unsigned char> slot;
+};
+
+class ThumbnailStore
+{
+public:
+    ~ThumbnailStore();
+
+    // Maps a store written by ThumbnailWriter
+    // Returns non-zero if the file is missing or invalid
+    int open(const char *path);
+
+    // Finds the row of an image by its name (binary search over the name index)
+    // Returns -1 if the image is not in the store
+    int find(const char *name) const;
+
+    // Thumbnail of a row (points into the mapped file, no copy)
+    cv::Mat thumbnail(int row) const;
+
+    size_t size() const { return rows; }
+    const char *root() const { return root_dir; }
+
+private:
+    void *map = nullptr;
+    size_t map_size = 0;
+    size_t rows = 0;
+    int side = 0;
+    const unsigned char *pixels = nullptr;
+    const int32_t *sizes = nullptr;
+    const int32_t *sorted_rows = nullptr;   // rows in name order
+    const uint64_t *name_offsets = nullptr; // offset of each row's name in blob
+    const char *root_dir = nullptr;
+    const char *blob = nullptr;
+};
+
+#endif
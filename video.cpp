@@ -0,0 +1,93 @@
+/*
+    Keyframe indexing of video files
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include "corpus.hpp"
+#include "histogram.hpp"
+#include "video.hpp"
+
+std::string video_frame_name(const std::string &video, double msec)
+{
+    char stamp[32];
+    snprintf(stamp, sizeof(stamp), "@%.3f", msec / 1000.0);
+    return video + stamp;
+}
+
+bool parse_video_frame_name(const std::string &name, std::string &video, double &msec)
+{
+    size_t at = name.rfind('@');
+    if (at == std::string::npos || at + 1 == name.size())
+        return false;
+
+    // images may have an @ in their name, so the part before it must be a video and the rest a number
+    std::string path = name.substr(0, at);
+    size_t slash = path.rfind('/');
+    if (!is_video_file(slash == std::string::npos ? path.c_str() : path.c_str() + slash + 1))
+        return false;
+    char *end;
+    double seconds = strtod(name.c_str() + at + 1, &end);
+    if (*end != '\0')
+        return false;
+
+    video = path;
+    msec = seconds * 1000.0;
+    return true;
+}
+
+int read_video_frame(const std::string &path, double msec, cv::Mat &frame)
+{
+    cv::VideoCapture cap(path);
+    if (!cap.isOpened())
+        return (-1);
+    cap.set(cv::CAP_PROP_POS_MSEC, msec);
+    return cap.read(frame) && !frame.empty() ? 0 : -1;
+}
+
+bool SceneChangeDetector::changed(cv::Mat &frame)
+{
+    // the signature only needs the colors, so it is computed on a shrunk copy
+    double scale = std::min(1.0, (double)VIDEO_SIGNATURE_SIDE / std::max(frame.cols, frame.rows));
+    if (scale < 1.0)
+        cv::resize(frame, small, cv::Size(), scale, scale, cv::INTER_AREA);
+    else
+        small = frame;
+    signature.clear();
+    chromaticity_histogram<16>(small, signature);
+
+    if (!reference.empty())
+    {
+        // both histograms sum to 1, so 1 - intersection is in [0, 1]
+        float intersection = 0.0f;
+        for (size_t i = 0; i < signature.size(); i++)
+            intersection += std::min(signature[i], reference[i]);
+        if (1.0f - intersection < threshold)
+            return false;
+    }
+    reference.swap(signature);
+    return true;
+}
+
+int index_video_keyframes(const std::string &path, float threshold,
+                          const std::function<void(cv::Mat &, double)> &keyframe, int &frames)
+{
+    frames = 0;
+    cv::VideoCapture cap(path);
+    if (!cap.isOpened())
+        return (-1);
+
+    SceneChangeDetector detector(threshold);
+    cv::Mat frame;
+    int indexed = 0;
+    while (cap.read(frame) && !frame.empty())
+    {
+        frames++;
+        if (!detector.changed(frame))
+            continue;
+        keyframe(frame, cap.get(cv::CAP_PROP_POS_MSEC));
+        indexed++;
+    }
+    return indexed;
+}
@@ -0,0 +1,63 @@
+/*
+    Keyframe indexing of video files
+
+    Consecutive frames of a video are nearly identical, so readfiles does not extract features from every frame.
+    Each decoded frame gets a cheap signature (a 16x16 rg chromaticity histogram of a shrunk copy) and the full
+    extractors only run when the signature has moved past a threshold from the last indexed frame. Indexed frames
+    are stored as rows named <video>@<seconds>, which cbir decodes again to display a match.
+*/
+
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "opencv2/opencv.hpp"
+
+// default signature distance (1 - histogram intersection, in [0, 1]) at which a frame is indexed
+#define VIDEO_SCENE_THRESHOLD 0.3f
+
+// length of the longer side of the frame copy the signature is computed on
+#define VIDEO_SIGNATURE_SIDE 128
+
+// Builds the row name of a video frame
+// Args: video - video path (relative to the corpus root)
+//       msec  - timestamp of the frame in milliseconds
+std::string video_frame_name(const std::string &video, double msec);
+
+// Splits the row name of a video frame into the video path and the timestamp
+// Returns false if the name is not a video frame (e.g. an image row)
+bool parse_video_frame_name(const std::string &name, std::string &video, double &msec);
+
+// Decodes the frame of a video at a timestamp
+// Returns non-zero if the video cannot be opened or the frame cannot be read
+int read_video_frame(const std::string &path, double msec, cv::Mat &frame);
+
+// Decides which frames of a video are indexed by comparing their signatures with the last indexed frame
+class SceneChangeDetector
+{
+public:
+    explicit SceneChangeDetector(float threshold = VIDEO_SCENE_THRESHOLD) : threshold(threshold) {}
+
+    // Checks whether a frame starts a new scene (always true for the first frame)
+    // The frame becomes the reference for the following frames when it does
+    bool changed(cv::Mat &frame);
+
+private:
+    float threshold;
+    std::vector<float> reference; // signature of the last indexed frame (empty before the first frame)
+    std::vector<float> signature;
+    cv::Mat small;
+};
+
+// Decodes a video and calls keyframe(frame, msec) for every frame that starts a new scene
+// Args: path      - video file
+//       threshold - signature distance at which a frame is indexed
+//       keyframe  - called with each indexed frame and its timestamp in milliseconds
+//       frames    - set to the number of decoded frames
+// Returns the number of indexed frames, or -1 if the video cannot be opened
+int index_video_keyframes(const std::string &path, float threshold,
+                          const std::function<void(cv::Mat &, double)> &keyframe, int &frames);
+
+#endif
@@ -0,0 +1,232 @@
+/*
+    Vantage-point tree for exact nearest-neighbour queries under metric distances
+
+    File layout of <csv>.vpt (after the sidecar header):
+        int32 metric, int64 rows of the database, int64 nodes, int64 leaf rows
+        VPNode nodes[nodes]
+        uint32 leaf_rows[leaf rows]
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include "vp_tree.hpp"
+
+// sidecar format identifier
+static const char VPT_MAGIC[] = "CBIRVPT1";
+
+// seed of the vantage point choice, so that the same database always gives the same tree
+static const unsigned VPTREE_SEED = 12345;
+
+// Returns true if the tree can search with the metric (it has to satisfy the triangle inequality)
+bool vp_tree_metric(MetricType metric)
+{
+    return metric == SSD || metric == INTERSECTION || metric == TWO_HIST_INTERSECTION || metric == RGB_REGION_INTERSECTION;
+}
+
+// Maps a distance of apply_metric to the metric the tree is built on (the Euclidean distance for ssd)
+// The mapping is increasing, so both rank the rows the same way
+static inline float tree_distance(MetricType metric, float dist)
+{
+    return metric == SSD ? std::sqrt(std::max(dist, 0.0f)) : dist;
+}
+
+// Builds the subtree over rows[begin, end) and returns its node index
+// dist is scratch space indexed by row
+static int build_node(VPTree &tree, FeatureDB &db, std::vector<uint32_t> &rows, size_t begin, size_t end,
+                      std::vector<float> &dist, std::mt19937 &rng)
+{
+    int id = tree.nodes.size();
+    tree.nodes.push_back(VPNode());
+    size_t n = end - begin;
+
+    if (n <= VPTREE_LEAF_ROWS)
+    {
+        tree.nodes[id].first = tree.leaf_rows.size();
+        tree.nodes[id].count = n;
+        tree.leaf_rows.insert(tree.leaf_rows.end(), rows.begin() + begin, rows.begin() + end);
+        return id;
+    }
+
+    // a random vantage point, split the other rows at the median of their distance to it
+    std::swap(rows[begin], rows[begin + rng() % n]);
+    uint32_t vp = rows[begin++];
+    for (size_t i = begin; i < end; i++)
+        dist[rows[i]] = tree_distance(tree.metric, apply_metric(tree.metric, db.data[vp], db.data[rows[i]]));
+    size_t mid = begin + (end - begin) / 2;
+    std::nth_element(rows.begin() + begin, rows.begin() + mid, rows.begin() + end, [&](uint32_t a, uint32_t b)
+                     { return dist[a] != dist[b] ? dist[a] < dist[b] : a < b; });
+
+    VPNode node;
+    node.vp = vp;
+    size_t bounds[3] = {begin, mid, end};
+    for (int c = 0; c < 2; c++)
+    {
+        auto [lo, hi] = std::minmax_element(rows.begin() + bounds[c], rows.begin() + bounds[c + 1], [&](uint32_t a, uint32_t b)
+                                            { return dist[a] < dist[b]; });
+        node.lo[c] = dist[*lo];
+        node.hi[c] = dist[*hi];
+    }
+    for (int c = 0; c < 2; c++)
+        node.child[c] = build_node(tree, db, rows, bounds[c], bounds[c + 1], dist, rng);
+    tree.nodes[id] = node;
+    return id;
+}
+
+// Builds the tree over every row of a database
+void build_vp_tree(MetricType metric, FeatureDB &db, VPTree &tree)
+{
+    std::vector<uint32_t> rows(db.size());
+    std::vector<float> dist(db.size());
+    std::mt19937 rng(VPTREE_SEED);
+    for (size_t i = 0; i < db.size(); i++)
+        rows[i] = i;
+
+    tree.metric = metric;
+    tree.rows = db.size();
+    tree.nodes.clear();
+    tree.leaf_rows.clear();
+    build_node(tree, db, rows, 0, rows.size(), dist, rng);
+}
+
+// Writes the tree of a database to <csv>.vpt
+// Returns non-zero if the file could not be written
+int write_vp_tree(char *csv, VPTree &tree)
+{
+    char sidecar[512];
+    DBStamp stamp;
+    snprintf(sidecar, sizeof(sidecar), "%s.vpt", csv);
+    if (db_stamp(csv, stamp) != 0)
+        return (-1);
+
+    FILE *fp = fopen(sidecar, "wb");
+    if (!fp)
+    {
+        printf("Unable to write %s\n", sidecar);
+        return (-1);
+    }
+    int metric = tree.metric;
+    long long nodes = tree.nodes.size(), leaf_rows = tree.leaf_rows.size();
+    write_sidecar_header(fp, VPT_MAGIC, stamp);
+    fwrite(&metric, sizeof(metric), 1, fp);
+    fwrite(&tree.rows, sizeof(tree.rows), 1, fp);
+    fwrite(&nodes, sizeof(nodes), 1, fp);
+    fwrite(&leaf_rows, sizeof(leaf_rows), 1, fp);
+    fwrite(tree.nodes.data(), sizeof(VPNode), nodes, fp);
+    fwrite(tree.leaf_rows.data(), sizeof(uint32_t), leaf_rows, fp);
+    fclose(fp);
+    return (0);
+}
+
+// Returns true if every index of a tree read from a file is in range: vantage points and leaf rows are rows of
+// the database, leaves lie within leaf_rows and children come after their parent (as build_node numbers them,
+// which also rules out cycles)
+static bool valid_tree(const VPTree &tree)
+{
+    long long nodes = tree.nodes.size();
+    for (long long id = 0; id < nodes; id++)
+    {
+        const VPNode &node = tree.nodes[id];
+        if (node.vp < 0)
+        {
+            if ((long long)node.first + node.count > (long long)tree.leaf_rows.size())
+                return false;
+        }
+        else if (node.vp >= tree.rows || node.child[0] <= id || node.child[0] >= nodes || node.child[1] <= id ||
+                 node.child[1] >= nodes)
+            return false;
+    }
+    for (uint32_t row : tree.leaf_rows)
+    {
+        if (row >= tree.rows)
+            return false;
+    }
+    return true;
+}
+
+// Reads the tree of a database from <csv>.vpt
+// Returns non-zero if there is no tree, it was built from another version of the csv or for another metric
+int read_vp_tree(char *csv, FeatureDB &db, MetricType metric, VPTree &tree)
+{
+    char sidecar[512];
+    DBStamp stamp;
+    snprintf(sidecar, sizeof(sidecar), "%s.vpt", csv);
+    if (db_stamp(csv, stamp) != 0)
+        return (-1);
+
+    FILE *fp = fopen(sidecar, "rb");
+    if (!fp)
+        return (-1);
+    int stored_metric;
+    long long nodes, leaf_rows;
+    int status = -1;
+    if (read_sidecar_header(fp, VPT_MAGIC, stamp) == 0 &&
+        fread(&stored_metric, sizeof(stored_metric), 1, fp) == 1 && stored_metric == metric &&
+        fread(&tree.rows, sizeof(tree.rows), 1, fp) == 1 && tree.rows == (long long)db.size() &&
+        fread(&nodes, sizeof(nodes), 1, fp) == 1 && fread(&leaf_rows, sizeof(leaf_rows), 1, fp) == 1 &&
+        nodes > 0 && leaf_rows >= 0 &&
+        nodes <= sidecar_remaining(fp) / (long long)sizeof(VPNode) &&
+        leaf_rows <= (sidecar_remaining(fp) - nodes * (long long)sizeof(VPNode)) / (long long)sizeof(uint32_t))
+    {
+        tree.metric = metric;
+        tree.nodes.resize(nodes);
+        tree.leaf_rows.resize(leaf_rows);
+        if (fread(tree.nodes.data(), sizeof(VPNode), nodes, fp) == (size_t)nodes &&
+            fread(tree.leaf_rows.data(), sizeof(uint32_t), leaf_rows, fp) == (size_t)leaf_rows && valid_tree(tree))
+            status = 0;
+    }
+    fclose(fp);
+    return status;
+}
+
+// Searches the subtree of a node, offering every row that may still enter the top-K
+static void search_node(std::vector<float> &featVec, FeatureDB &db, VPTree &tree, int id, TopK &top, ScanStats &stats)
+{
+    const VPNode &node = tree.nodes[id];
+    if (node.vp < 0)
+    {
+        for (uint32_t k = node.first; k < node.first + node.count; k++)
+        {
+            uint32_t row = tree.leaf_rows[k];
+            stats.rows++;
+            top.push(apply_metric(tree.metric, featVec, db.data[row]), row);
+        }
+        return;
+    }
+
+    float dist = apply_metric(tree.metric, featVec, db.data[node.vp]);
+    stats.rows++;
+    top.push(dist, node.vp);
+    float d = tree_distance(tree.metric, dist);
+
+    // the side the query falls on first, it is the most likely to hold close rows and shrink the bound
+    int near = d <= node.hi[0] ? 0 : 1;
+    for (int c : {near, 1 - near})
+    {
+        // triangle inequality: every row of the child is at least this far from the query
+        float lower = std::max(d - node.hi[c], node.lo[c] - d);
+        if (top.full())
+        {
+            float tau = tree_distance(tree.metric, top.bound());
+            if (lower - VPTREE_SLACK * (1.0f + d + tau) > tau)
+                continue;
+        }
+        search_node(featVec, db, tree, node.child[c], top, stats);
+    }
+}
+
+/*
+    Finds the K closest rows to the feature vector by searching the tree
+    The rows are offered with the distances of apply_metric, so the ranking and the ties are those of the scan
+*/
+void vp_tree_topk(std::vector<float> &featVec, FeatureDB &db, VPTree &tree, int K,
+                  std::vector<std::pair<float, int>> &results, ScanStats &stats)
+{
+    TopK top(K, true);
+    long evaluated = stats.rows;
+    if (!tree.nodes.empty())
+        search_node(featVec, db, tree, 0, top, stats);
+    stats.pruned += db.size() - (stats.rows - evaluated);
+    top.sorted(results);
+}
@@ -0,0 +1,89 @@
+/*
+    Vantage-point tree for exact nearest-neighbour queries under metric distances
+
+    Each node picks a vantage point among its rows and splits the others at the median of their distance to it,
+    recording the range of distances on each side. A query computes its distance d to the vantage point, and
+    by the triangle inequality a row whose distance to the vantage point lies in [lo, hi] is at least
+    max(d - hi, lo - d) away from the query, so a whole side is skipped once that exceeds the current K-th best
+    distance. The matches are exactly those of the full scan.
+
+    This needs a true metric: ssd is searched as the Euclidean distance (its square root, which ranks the rows
+    the same way), and the intersection distances of L1-normalized histograms are proportional to their L1
+    distance (hist, hist2, multihist, sobel, hsv). Built offline by build_vp_tree and stored next to the
+    database in <csv>.vpt
+*/
+
+#ifndef VP_TREE_H
+#define VP_TREE_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "distance.hpp"
+#include "feature_db.hpp"
+#include "scan.hpp"
+
+// largest number of rows stored in a leaf instead of being split further
+#define VPTREE_LEAF_ROWS 8
+
+// slack added to the pruning test to absorb float rounding in the distances (relative, plus the same absolute)
+#define VPTREE_SLACK 1e-4f
+
+// node of the tree
+// inner nodes have a vantage point and 2 children (inside: closer than the median, outside: the others),
+// leaves (vp = -1) list their rows in leaf_rows[first, first + count)
+struct VPNode
+{
+    int32_t vp = -1;
+    int32_t child[2] = {-1, -1};
+    float lo[2] = {0.0f, 0.0f}; // smallest distance of the rows of each child to the vantage point
+    float hi[2] = {0.0f, 0.0f}; // largest distance of the rows of each child to the vantage point
+    uint32_t first = 0;
+    uint32_t count = 0;
+};
+
+struct VPTree
+{
+    MetricType metric = SSD;
+    long long rows = 0;              // rows of the database the tree was built from
+    std::vector<VPNode> nodes;       // nodes[0] is the root
+    std::vector<uint32_t> leaf_rows; // rows of the leaves
+};
+
+// Returns true if the tree can search with the metric (it has to satisfy the triangle inequality)
+bool vp_tree_metric(MetricType metric);
+
+// Builds the tree over every row of a database
+// Args: metric - distance metric of the database (see vp_tree_metric)
+//       db     - loaded database
+//       tree   - tree to be filled
+void build_vp_tree(MetricType metric, FeatureDB &db, VPTree &tree);
+
+// Writes the tree of a database to <csv>.vpt
+// Returns non-zero if the file could not be written
+int write_vp_tree(char *csv, VPTree &tree);
+
+// Reads the tree of a database from <csv>.vpt
+// Args: csv    - csv database filename
+//       db     - loaded database
+//       metric - distance metric the queries use
+//       tree   - tree to be filled
+// Returns non-zero if there is no tree, it was built from another version of the csv or for another metric
+int read_vp_tree(char *csv, FeatureDB &db, MetricType metric, VPTree &tree);
+
+/*
+    Finds the K closest rows to the feature vector by searching the tree
+    The result is identical to the exhaustive scan
+
+    Args:
+        - featVec: query feature vector
+        - db: feature database the tree was built from
+        - tree: vantage-point tree of the database
+        - K: number of matches to keep
+        - results: vector of (distance, row) pairs to be filled, best first
+        - stats: scan counters to be filled (rows counts the distance evaluations, pruned the rows never compared)
+*/
+void vp_tree_topk(std::vector<float> &featVec, FeatureDB &db, VPTree &tree, int K,
+                  std::vector<std::pair<float, int>> &results, ScanStats &stats);
+
+#endif